@@ -0,0 +1,54 @@
+#include "UncertaintyPreprocessor.h"
+#include "PreprocessorTesting.h"
+
+#include <cstdlib> // for EXIT_SUCCESS
+#include <iostream>
+
+/**
+  * Checks that eroding only from the background connected to the edge zeros the same voxels as dilating the background
+  * that a breadth-first fill from the edge reaches, whole and streamed (slabThickness > 0).
+  */
+static bool checkBorderErosion(const unsigned int size[3], unsigned int zeroPercentage, int radius, unsigned int slabThickness) {
+  std::vector<double> values = PreprocessorTesting::randomUncertainty(size, zeroPercentage, 200 + zeroPercentage);
+  mitk::Image::Pointer uncertainty = PreprocessorTesting::makeImage(values, size);
+
+  UncertaintyPreprocessor preprocessor;
+  preprocessor.setUncertainty(uncertainty);
+  preprocessor.setNormalizationParams(0.0, 1.0);
+  preprocessor.setErodeParams(radius, true);
+  preprocessor.setStreamingParams(slabThickness, "");
+  std::vector<double> normalized = PreprocessorTesting::readImage(preprocessor.preprocessUncertainty(false, false, false));
+  std::vector<double> eroded = PreprocessorTesting::readImage(preprocessor.preprocessUncertainty(false, true, false));
+
+  std::vector<unsigned char> borderBackground = PreprocessorTesting::findBorderBackground(PreprocessorTesting::findZeros(normalized), size);
+  std::vector<double> expected = PreprocessorTesting::erodeWithBall(normalized, borderBackground, size, radius);
+
+  size_t first;
+  size_t differences = PreprocessorTesting::countDifferences(eroded, expected, first);
+  if (differences > 0) {
+    std::cerr << "Erosion by " << radius << " from the edge only (" << zeroPercentage << "% zeros, slab thickness "
+      << slabThickness << ") differs from the breadth-first fill at " << differences << " voxels, starting at voxel "
+      << first << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+  * Checks the flood fill of the background connected to the edge against a breadth-first fill.
+  * The densities are either side of where zeros start to join up across the volume, so there are both enclosed and
+  * winding connected zeros.
+  */
+int BorderBackgroundTest(int /*argc*/, char * /*argv*/[]) {
+  bool passed = true;
+
+  unsigned int size[3] = { 21, 18, 16 };
+  unsigned int zeroPercentages[3] = { 10, 25, 35 };
+  for (unsigned int i = 0; i < 3; i++) {
+    passed = checkBorderErosion(size, zeroPercentages[i], 1, 0) && passed;
+    passed = checkBorderErosion(size, zeroPercentages[i], 1, 3) && passed;
+    passed = checkBorderErosion(size, zeroPercentages[i], 2, 5) && passed;
+  }
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
\ No newline at end of file
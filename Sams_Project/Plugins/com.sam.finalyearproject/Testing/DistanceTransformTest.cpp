@@ -0,0 +1,130 @@
+#include "DistanceTransform.h"
+#include "UncertaintyPreprocessor.h"
+#include "PreprocessorTesting.h"
+
+#include <algorithm> // for min
+#include <cstdlib> // for EXIT_SUCCESS
+#include <iostream>
+#include <random> // for mt19937
+
+/**
+  * The squared distance from every voxel to the nearest feature, found by checking every feature.
+  */
+static std::vector<float> bruteForceSquaredDistances(const std::vector<unsigned char> & features, const unsigned int size[3]) {
+  std::vector<float> squaredDistances(features.size(), DistanceTransform::INFINITE_DISTANCE);
+  for (size_t i = 0; i < features.size(); i++) {
+    int x = i % size[0];
+    int y = (i / size[0]) % size[1];
+    int z = i / ((size_t) size[0] * size[1]);
+    for (size_t j = 0; j < features.size(); j++) {
+      if (features[j] == 0) {
+        continue;
+      }
+      int dx = (int) (j % size[0]) - x;
+      int dy = (int) ((j / size[0]) % size[1]) - y;
+      int dz = (int) (j / ((size_t) size[0] * size[1])) - z;
+      squaredDistances[i] = std::min(squaredDistances[i], (float) (dx * dx + dy * dy + dz * dz));
+    }
+  }
+  return squaredDistances;
+}
+
+/**
+  * Checks the distance transform of a random volume against the brute-force distances (they're integers, so exactly).
+  */
+static bool checkDistances(const unsigned int size[3], unsigned int featurePercentage, unsigned int seed) {
+  std::mt19937 generator(seed);
+  std::vector<unsigned char> features((size_t) size[0] * size[1] * size[2]);
+  for (size_t i = 0; i < features.size(); i++) {
+    features[i] = (generator() % 100 < featurePercentage) ? 1 : 0;
+  }
+
+  std::vector<float> squaredDistances;
+  DistanceTransform::computeSquaredDistances(&features[0], size, squaredDistances);
+  std::vector<float> expected = bruteForceSquaredDistances(features, size);
+
+  for (size_t i = 0; i < expected.size(); i++) {
+    if (squaredDistances[i] != expected[i]) {
+      std::cerr << "Distance transform of " << size[0] << "x" << size[1] << "x" << size[2] << " volume (seed " << seed << ")"
+        << " has squared distance " << squaredDistances[i] << " at voxel " << i << ", brute force found " << expected[i] << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+  * Checks that eroding (zeroing everything with a squared distance to the background of at most r^2 + r) zeros the
+  * same voxels as the ball dilation it replaced, whole and streamed (slabThickness > 0).
+  * The whole volume has two paths, and both are checked: eroding straight away (distances found while normalizing) and
+  * eroding the kept normalized uncertainty (distances found afterwards). Streaming keeps nothing, so it only has one.
+  */
+static bool checkErosion(const unsigned int size[3], int radius, unsigned int slabThickness) {
+  std::vector<double> values = PreprocessorTesting::randomUncertainty(size, 2, 100 + radius);
+  mitk::Image::Pointer uncertainty = PreprocessorTesting::makeImage(values, size);
+
+  UncertaintyPreprocessor preprocessor;
+  preprocessor.setUncertainty(uncertainty);
+  preprocessor.setNormalizationParams(0.0, 1.0);
+  preprocessor.setErodeParams(radius);
+  preprocessor.setStreamingParams(slabThickness, "");
+  std::vector<double> eroded = PreprocessorTesting::readImage(preprocessor.preprocessUncertainty(false, true, false));
+
+  UncertaintyPreprocessor keepingPreprocessor;
+  keepingPreprocessor.setUncertainty(uncertainty);
+  keepingPreprocessor.setNormalizationParams(0.0, 1.0);
+  keepingPreprocessor.setErodeParams(radius);
+  keepingPreprocessor.setStreamingParams(slabThickness, "");
+  std::vector<double> normalized = PreprocessorTesting::readImage(keepingPreprocessor.preprocessUncertainty(false, false, false));
+
+  std::vector<double> expected = PreprocessorTesting::erodeWithBall(normalized, PreprocessorTesting::findZeros(normalized), size, radius);
+
+  bool passed = true;
+  size_t first;
+  size_t differences = PreprocessorTesting::countDifferences(eroded, expected, first);
+  if (differences > 0) {
+    std::cerr << "Erosion by " << radius << " (slab thickness " << slabThickness << ") differs from the ball dilation at "
+      << differences << " voxels, starting at voxel " << first << std::endl;
+    passed = false;
+  }
+
+  if (slabThickness == 0) {
+    std::vector<double> erodedAfter = PreprocessorTesting::readImage(keepingPreprocessor.preprocessUncertainty(false, true, false));
+    differences = PreprocessorTesting::countDifferences(erodedAfter, expected, first);
+    if (differences > 0) {
+      std::cerr << "Erosion by " << radius << " of the kept normalized uncertainty differs from the ball dilation at "
+        << differences << " voxels, starting at voxel " << first << std::endl;
+      passed = false;
+    }
+  }
+  return passed;
+}
+
+/**
+  * Checks the exact distance transform against a brute-force nearest feature search, and the erosion built on it against
+  * the ball dilation it replaced.
+  */
+int DistanceTransformTest(int /*argc*/, char * /*argv*/[]) {
+  bool passed = true;
+
+  // Random shapes (including lines and single voxels) and densities (including no features at all).
+  std::mt19937 generator(1);
+  for (unsigned int test = 0; test < 60; test++) {
+    unsigned int size[3];
+    for (unsigned int i = 0; i < 3; i++) {
+      size[i] = 1 + generator() % 12;
+    }
+    unsigned int featurePercentage = generator() % 30;
+    passed = checkDistances(size, featurePercentage, test) && passed;
+  }
+
+  // Slabs thinner than the halo, and slabs that don't divide the depth.
+  unsigned int size[3] = { 23, 19, 17 };
+  for (int radius = 0; radius <= 3; radius++) {
+    passed = checkErosion(size, radius, 0) && passed;
+    passed = checkErosion(size, radius, 2) && passed;
+    passed = checkErosion(size, radius, 5) && passed;
+  }
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
\ No newline at end of file
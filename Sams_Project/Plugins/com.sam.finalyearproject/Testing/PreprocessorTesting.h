@@ -0,0 +1,185 @@
+#ifndef Preprocessor_Testing_h
+#define Preprocessor_Testing_h
+
+#include <mitkImage.h>
+#include <mitkITKImageImport.h>
+#include <mitkImagePixelReadAccessor.h>
+#include <itkImage.h>
+#include <itkBinaryBallStructuringElement.h>
+#include <itkGrayscaleDilateImageFilter.h>
+
+#include <algorithm> // for copy, max
+#include <deque>
+#include <random> // for mt19937
+#include <vector>
+
+/**
+  * Helpers shared by the preprocessor tests. Volumes are flat (x fastest, then y, then z).
+  */
+namespace PreprocessorTesting {
+  /**
+    * Random uncertainty in (0, 1], where about zeroPercentage percent of the voxels are zero (the background).
+    * Seeded, so every run (and every platform) sees the same volume.
+    */
+  inline std::vector<double> randomUncertainty(const unsigned int size[3], unsigned int zeroPercentage, unsigned int seed) {
+    std::mt19937 generator(seed);
+    std::vector<double> values((size_t) size[0] * size[1] * size[2]);
+    for (size_t i = 0; i < values.size(); i++) {
+      bool zero = generator() % 100 < zeroPercentage;
+      values[i] = zero ? 0.0 : (generator() + 1.0) / 4294967296.0;
+    }
+
+    // Normalizing maps the minimum to 0, so make sure it is 0.
+    values[0] = 0.0;
+    return values;
+  }
+
+  /**
+    * Wraps the values in a double MITK image.
+    */
+  inline mitk::Image::Pointer makeImage(const std::vector<double> & values, const unsigned int size[3]) {
+    typedef itk::Image<double, 3> ImageType;
+    ImageType::SizeType imageSize;
+    for (unsigned int i = 0; i < 3; i++) {
+      imageSize[i] = size[i];
+    }
+
+    ImageType::Pointer image = ImageType::New();
+    image->SetRegions(imageSize);
+    image->Allocate();
+    std::copy(values.begin(), values.end(), image->GetBufferPointer());
+    return mitk::GrabItkImageMemory(image.GetPointer());
+  }
+
+  template <typename TPixel>
+  std::vector<double> readPixels(mitk::Image::Pointer image) {
+    mitk::ImagePixelReadAccessor<TPixel, 3> readAccess(image);
+    const TPixel * data = readAccess.GetData();
+    size_t numberOfVoxels = (size_t) image->GetDimension(0) * image->GetDimension(1) * image->GetDimension(2);
+    return std::vector<double>(data, data + numberOfVoxels);
+  }
+
+  /**
+    * The values of a (double or float) image, as doubles.
+    */
+  inline std::vector<double> readImage(mitk::Image::Pointer image) {
+    if (image->GetPixelType().GetComponentType() == itk::ImageIOBase::FLOAT) {
+      return readPixels<float>(image);
+    }
+    return readPixels<double>(image);
+  }
+
+  /**
+    * The voxels (1) that are exactly zero.
+    */
+  inline std::vector<unsigned char> findZeros(const std::vector<double> & values) {
+    std::vector<unsigned char> zeros(values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+      zeros[i] = (values[i] == 0.0) ? 1 : 0;
+    }
+    return zeros;
+  }
+
+  /**
+    * Keeps only the background (1) that's 6-connected to the edge of the volume, with a breadth-first fill from the
+    * background on the edge.
+    */
+  inline std::vector<unsigned char> findBorderBackground(const std::vector<unsigned char> & background, const unsigned int size[3]) {
+    std::vector<unsigned char> border(background.size(), 0);
+    std::deque<size_t> queue;
+    for (size_t i = 0; i < background.size(); i++) {
+      unsigned int x = i % size[0];
+      unsigned int y = (i / size[0]) % size[1];
+      unsigned int z = i / ((size_t) size[0] * size[1]);
+      bool edge = x == 0 || y == 0 || z == 0 || x == size[0] - 1 || y == size[1] - 1 || z == size[2] - 1;
+      if (background[i] != 0 && edge) {
+        border[i] = 1;
+        queue.push_back(i);
+      }
+    }
+
+    const int offsets[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+    while (!queue.empty()) {
+      size_t i = queue.front();
+      queue.pop_front();
+      int position[3] = { (int) (i % size[0]), (int) ((i / size[0]) % size[1]), (int) (i / ((size_t) size[0] * size[1])) };
+      for (unsigned int n = 0; n < 6; n++) {
+        int neighbour[3];
+        bool inside = true;
+        for (unsigned int axis = 0; axis < 3; axis++) {
+          neighbour[axis] = position[axis] + offsets[n][axis];
+          inside = inside && neighbour[axis] >= 0 && neighbour[axis] < (int) size[axis];
+        }
+        if (!inside) {
+          continue;
+        }
+        size_t j = ((size_t) neighbour[2] * size[1] + neighbour[1]) * size[0] + neighbour[0];
+        if (background[j] != 0 && border[j] == 0) {
+          border[j] = 1;
+          queue.push_back(j);
+        }
+      }
+    }
+    return border;
+  }
+
+  /**
+    * Erodes the way the preprocessor used to: dilates the background (1) with ITK's ball of the given radius and zeros
+    * everything it covers.
+    */
+  inline std::vector<double> erodeWithBall(const std::vector<double> & values, const std::vector<unsigned char> & background, const unsigned int size[3], int radius) {
+    typedef itk::Image<unsigned char, 3> BackgroundImageType;
+    BackgroundImageType::SizeType imageSize;
+    for (unsigned int i = 0; i < 3; i++) {
+      imageSize[i] = size[i];
+    }
+
+    BackgroundImageType::Pointer backgroundImage = BackgroundImageType::New();
+    backgroundImage->SetRegions(imageSize);
+    backgroundImage->Allocate();
+    std::copy(background.begin(), background.end(), backgroundImage->GetBufferPointer());
+
+    typedef itk::BinaryBallStructuringElement<unsigned char, 3> StructuringElementType;
+    StructuringElementType ball;
+    ball.SetRadius(radius);
+    ball.CreateStructuringElement();
+
+    typedef itk::GrayscaleDilateImageFilter<BackgroundImageType, BackgroundImageType, StructuringElementType> GrayscaleDilateImageFilterType;
+    GrayscaleDilateImageFilterType::Pointer dilateFilter = GrayscaleDilateImageFilterType::New();
+    dilateFilter->SetInput(backgroundImage);
+    dilateFilter->SetKernel(ball);
+    dilateFilter->Update();
+
+    const unsigned char * dilated = dilateFilter->GetOutput()->GetBufferPointer();
+    std::vector<double> eroded(values);
+    for (size_t i = 0; i < eroded.size(); i++) {
+      if (dilated[i] != 0) {
+        eroded[i] = 0.0;
+      }
+    }
+    return eroded;
+  }
+
+  /**
+    * The number of voxels that differ, and the first of them (if any).
+    */
+  inline size_t countDifferences(const std::vector<double> & values, const std::vector<double> & expected, size_t & first) {
+    first = 0;
+    if (values.size() != expected.size()) {
+      return std::max(values.size(), expected.size());
+    }
+
+    size_t differences = 0;
+    for (size_t i = 0; i < values.size(); i++) {
+      if (values[i] != expected[i]) {
+        if (differences == 0) {
+          first = i;
+        }
+        differences++;
+      }
+    }
+    return differences;
+  }
+}
+
+#endif
\ No newline at end of file
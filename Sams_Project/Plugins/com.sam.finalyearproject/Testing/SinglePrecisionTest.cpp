@@ -0,0 +1,88 @@
+#include "UncertaintyPreprocessor.h"
+#include "PreprocessorTesting.h"
+
+#include <algorithm> // for max
+#include <cmath> // for abs
+#include <cstdlib> // for EXIT_SUCCESS
+#include <iostream>
+#include <limits>
+
+// Furthest a normalized value (at most 1) can move when it's rounded to float.
+static const double FLOAT_ROUNDING = std::numeric_limits<float>::epsilon() / 2.0;
+
+/**
+  * Checks that preprocessing into float gives the same uncertainty as preprocessing into double, to within rounding:
+  * the background (zeros) is identical, and thresholding (in double, like the thresholder) only differs for values that
+  * are within rounding of the threshold.
+  */
+static bool checkSinglePrecision(const unsigned int size[3], bool invert) {
+  // Uncertainty isn't normalized to begin with, so scale it up.
+  std::vector<double> values = PreprocessorTesting::randomUncertainty(size, 20, 300);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] *= 37.0;
+  }
+  mitk::Image::Pointer uncertainty = PreprocessorTesting::makeImage(values, size);
+
+  UncertaintyPreprocessor preprocessor;
+  preprocessor.setUncertainty(uncertainty);
+  preprocessor.setNormalizationParams(0.0, 1.0);
+  mitk::Image::Pointer doubleImage = preprocessor.preprocessUncertainty(invert, false, false);
+  std::vector<double> doubles = PreprocessorTesting::readImage(doubleImage);
+
+  preprocessor.setSinglePrecision(true);
+  mitk::Image::Pointer floatImage = preprocessor.preprocessUncertainty(invert, false, false);
+  std::vector<double> floats = PreprocessorTesting::readImage(floatImage);
+
+  if (floatImage->GetPixelType().GetComponentType() != itk::ImageIOBase::FLOAT ||
+      doubleImage->GetPixelType().GetComponentType() != itk::ImageIOBase::DOUBLE) {
+    std::cerr << "Preprocessing (invert " << invert << ") didn't give float and double images" << std::endl;
+    return false;
+  }
+
+  bool passed = true;
+  size_t backgroundDifferences = 0;
+  double largestDifference = 0.0;
+  for (size_t i = 0; i < doubles.size(); i++) {
+    backgroundDifferences += ((doubles[i] == 0.0) != (floats[i] == 0.0)) ? 1 : 0;
+    largestDifference = std::max(largestDifference, std::abs(doubles[i] - floats[i]));
+  }
+  if (backgroundDifferences > 0) {
+    std::cerr << "Float and double background (invert " << invert << ") differ at " << backgroundDifferences << " voxels" << std::endl;
+    passed = false;
+  }
+  if (largestDifference > FLOAT_ROUNDING) {
+    std::cerr << "Float and double uncertainty (invert " << invert << ") differ by up to " << largestDifference << std::endl;
+    passed = false;
+  }
+
+  for (unsigned int step = 1; step <= 9; step++) {
+    double threshold = step / 10.0;
+    size_t maskDifferences = 0;
+    for (size_t i = 0; i < doubles.size(); i++) {
+      bool inDoubleMask = doubles[i] >= threshold && doubles[i] <= 1.0;
+      bool inFloatMask = floats[i] >= threshold && floats[i] <= 1.0;
+      if (inDoubleMask != inFloatMask && std::abs(doubles[i] - threshold) > FLOAT_ROUNDING) {
+        maskDifferences++;
+      }
+    }
+    if (maskDifferences > 0) {
+      std::cerr << "Float and double masks (invert " << invert << ", threshold " << threshold << ") differ at "
+        << maskDifferences << " voxels that aren't within rounding of the threshold" << std::endl;
+      passed = false;
+    }
+  }
+  return passed;
+}
+
+/**
+  * Checks the single precision (float) preprocessing against double precision, inverted and not.
+  */
+int SinglePrecisionTest(int /*argc*/, char * /*argv*/[]) {
+  bool passed = true;
+
+  unsigned int size[3] = { 64, 64, 64 };
+  passed = checkSinglePrecision(size, false) && passed;
+  passed = checkSinglePrecision(size, true) && passed;
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
\ No newline at end of file
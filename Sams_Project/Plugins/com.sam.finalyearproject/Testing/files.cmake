@@ -0,0 +1,14 @@
+# Each test is a function named after its file, run by the generated test driver.
+set(TEST_CPP_FILES
+  DistanceTransformTest.cpp
+  BorderBackgroundTest.cpp
+  SinglePrecisionTest.cpp
+)
+
+# Plugin sources the tests need (relative to src).
+set(TESTED_CPP_FILES
+  DistanceTransform.cpp
+  UncertaintyPreprocessor.cpp
+  UncertaintyStatistics.cpp
+  MappedFile.cpp
+)
\ No newline at end of file
@@ -1,9 +1,21 @@
 set(SRC_CPP_FILES
 	Util.cpp
   UncertaintyPreprocessor.cpp
+  MappedFile.cpp
+  DistanceTransform.cpp
   UncertaintyThresholder.cpp
   UncertaintySampler.cpp
+  UncertaintyBrickIndex.cpp
+  UncertaintyValueIndex.cpp
+  UncertaintyBitMask.cpp
+  UncertaintyStatistics.cpp
+  UncertaintyTimeSeries.cpp
+  UncertaintyIsoSurfaceGenerator.cpp
+  UncertaintyComponentLabeller.cpp
   UncertaintyTextureGenerator.cpp
+  UncertaintyTextureJob.cpp
+  UncertaintyThresholdJob.cpp
+  SphereParametrization.cpp
   SurfaceGenerator.cpp
   UncertaintySurfaceMapper.cpp
   UncertaintyGenerator.cpp
@@ -29,6 +41,8 @@ set(UI_FILES
 )
 
 set(MOC_H_FILES  
+  src/UncertaintyTextureJob.h
+  src/UncertaintyThresholdJob.h
   src/QmitkCmdLineModuleFactoryGui.h
   src/QmitkCmdLineModuleGui.h
   src/QmitkDataStorageComboBoxWithSelectNone.h
@@ -0,0 +1,121 @@
+#include "DistanceTransform.h"
+
+#include "ParallelFor.h"
+
+const float DistanceTransform::INFINITE_DISTANCE = 1e20f;
+
+/**
+  * Transforms every line along one axis. Each item is a slice (for x and y) or a row of the volume (for z), so the
+  * lines of an item are next to each other in memory. Each thread has its own scratch space.
+  */
+struct DistanceTransform::LineTransformer {
+  float * values;
+  const unsigned int * size;
+  unsigned int axis;
+
+  std::vector<std::vector<float> > lines;
+  std::vector<std::vector<unsigned int> > parabolas;
+  std::vector<std::vector<double> > boundaries;
+
+  void operator()(unsigned int item, unsigned int threadID) {
+    size_t sliceSize = (size_t) size[0] * size[1];
+    if (axis == 0) {
+      // Item is z, each line is a row.
+      for (unsigned int y = 0; y < size[1]; y++) {
+        float * start = values + item * sliceSize + (size_t) y * size[0];
+        transformLine(start, 1, size[0], lines[threadID], parabolas[threadID], boundaries[threadID]);
+      }
+    }
+    else if (axis == 1) {
+      // Item is z, each line is a column.
+      for (unsigned int x = 0; x < size[0]; x++) {
+        float * start = values + item * sliceSize + x;
+        transformLine(start, size[0], size[1], lines[threadID], parabolas[threadID], boundaries[threadID]);
+      }
+    }
+    else {
+      // Item is y, each line runs through the slices.
+      for (unsigned int x = 0; x < size[0]; x++) {
+        float * start = values + (size_t) item * size[0] + x;
+        transformLine(start, sliceSize, size[2], lines[threadID], parabolas[threadID], boundaries[threadID]);
+      }
+    }
+  }
+};
+
+/**
+  * Squared distance from each voxel to the nearest voxel where features is non-zero.
+  * Voxels are assumed to be cubes (distances are in voxels). Voxels outside the volume are never features.
+  */
+void DistanceTransform::computeSquaredDistances(const unsigned char * features, const unsigned int size[3], std::vector<float> & squaredDistances) {
+  size_t numberOfVoxels = (size_t) size[0] * size[1] * size[2];
+  squaredDistances.resize(numberOfVoxels);
+  for (size_t i = 0; i < numberOfVoxels; i++) {
+    squaredDistances[i] = features[i] ? 0.0f : INFINITE_DISTANCE;
+  }
+  if (numberOfVoxels == 0) {
+    return;
+  }
+
+  unsigned int numberOfThreads = ParallelFor::getNumberOfThreads();
+  unsigned int longestLine = std::max(size[0], std::max(size[1], size[2]));
+  LineTransformer transformer;
+  transformer.values = &squaredDistances[0];
+  transformer.size = size;
+  transformer.lines.resize(numberOfThreads, std::vector<float>(longestLine));
+  transformer.parabolas.resize(numberOfThreads, std::vector<unsigned int>(longestLine));
+  transformer.boundaries.resize(numberOfThreads, std::vector<double>(longestLine + 1));
+
+  transformer.axis = 0;
+  ParallelFor::run(size[2], transformer);
+  transformer.axis = 1;
+  ParallelFor::run(size[2], transformer);
+  transformer.axis = 2;
+  ParallelFor::run(size[1], transformer);
+}
+
+/**
+  * 1D squared distance transform of a line (in place): values[q] = min over p of (q - p)^2 + values[p].
+  * Finds the lower envelope of the parabolas rooted at each (finite) value, then reads it off.
+  * line, parabolas and boundaries are scratch space, at least length (+ 1 for boundaries) long.
+  */
+void DistanceTransform::transformLine(float * values, size_t stride, unsigned int length, std::vector<float> & line,
+                                      std::vector<unsigned int> & parabolas, std::vector<double> & boundaries) {
+  // Copy the line out (it might be strided) and skip the parabolas that can't be the lowest.
+  int k = -1;
+  for (unsigned int q = 0; q < length; q++) {
+    float value = values[q * stride];
+    line[q] = value;
+    if (value >= INFINITE_DISTANCE) {
+      continue;
+    }
+
+    double s = 0;
+    while (k >= 0) {
+      unsigned int p = parabolas[k];
+      s = ((line[q] + (double) q * q) - (line[p] + (double) p * p)) / (2.0 * q - 2.0 * p);
+      if (s > boundaries[k]) {
+        break;
+      }
+      k--;
+    }
+    k++;
+    parabolas[k] = q;
+    boundaries[k] = (k == 0) ? -INFINITE_DISTANCE : s;
+    boundaries[k + 1] = INFINITE_DISTANCE;
+  }
+
+  // Nothing to be near.
+  if (k < 0) {
+    return;
+  }
+
+  k = 0;
+  for (unsigned int q = 0; q < length; q++) {
+    while (boundaries[k + 1] < q) {
+      k++;
+    }
+    double d = (double) q - parabolas[k];
+    values[q * stride] = (float) (d * d + line[parabolas[k]]);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#ifndef Distance_Transform_h
+#define Distance_Transform_h
+
+#include <cstddef> // for size_t
+#include <vector>
+
+/**
+  * Exact Euclidean distance transform of a binary volume (x fastest, then y, then z).
+  * Finds the squared distance (in voxels) from every voxel to the nearest feature voxel.
+  *
+  * This is Felzenszwalb and Huttenlocher's separable algorithm: a 1D transform (the lower envelope of parabolas) along
+  * x, then y, then z. Each pass is linear in the number of voxels and the lines of a pass are independent, so they're
+  * done in parallel. The cost doesn't depend on how far the distances reach.
+  */
+class DistanceTransform {
+  public:
+    static void computeSquaredDistances(const unsigned char * features, const unsigned int size[3], std::vector<float> & squaredDistances);
+
+    // Squared distance of voxels with no feature voxel anywhere (i.e. an empty volume).
+    static const float INFINITE_DISTANCE;
+
+  private:
+    struct LineTransformer;
+
+    static void transformLine(float * values, size_t stride, unsigned int length, std::vector<float> & line,
+                              std::vector<unsigned int> & parabolas, std::vector<double> & boundaries);
+};
+
+#endif
\ No newline at end of file
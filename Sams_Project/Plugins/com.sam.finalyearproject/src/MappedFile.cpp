@@ -0,0 +1,133 @@
+#include "MappedFile.h"
+
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() {
+  this->data = NULL;
+  this->size = 0;
+  this->fileDescriptor = -1;
+  this->fileHandle = NULL;
+  this->mappingHandle = NULL;
+}
+
+MappedFile::~MappedFile() {
+  close();
+}
+
+/**
+  * Creates (or overwrites) a file of the given size and maps it into memory.
+  * If temporary, the file is deleted once it's unmapped (it's only there to page the memory out to).
+  * Returns false if it can't be created or mapped.
+  */
+bool MappedFile::create(const std::string & fileName, size_t size, bool temporary) {
+  close();
+  if (size == 0) {
+    return false;
+  }
+  this->fileName = fileName;
+
+#ifdef _WIN32
+  DWORD flags = temporary ? (FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE) : FILE_ATTRIBUTE_NORMAL;
+  HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, flags, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    std::cerr << "Hmmm... it appears we can't create " << fileName << std::endl;
+    return false;
+  }
+  fileHandle = file;
+
+  ULARGE_INTEGER mappingSize;
+  mappingSize.QuadPart = size;
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, mappingSize.HighPart, mappingSize.LowPart, NULL);
+  if (mapping == NULL) {
+    std::cerr << "Hmmm... it appears we can't map " << fileName << " (" << size << " bytes)" << std::endl;
+    close();
+    return false;
+  }
+  mappingHandle = mapping;
+
+  data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+  fileDescriptor = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fileDescriptor < 0) {
+    std::cerr << "Hmmm... it appears we can't create " << fileName << std::endl;
+    return false;
+  }
+
+  // The open file keeps it alive without a name.
+  if (temporary) {
+    unlink(fileName.c_str());
+  }
+
+  if (ftruncate(fileDescriptor, size) != 0) {
+    std::cerr << "Hmmm... it appears we can't make " << fileName << " " << size << " bytes" << std::endl;
+    close();
+    return false;
+  }
+
+  data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+  if (data == MAP_FAILED) {
+    data = NULL;
+  }
+#endif
+
+  if (data == NULL) {
+    std::cerr << "Hmmm... it appears we can't map " << fileName << " (" << size << " bytes)" << std::endl;
+    close();
+    return false;
+  }
+  this->size = size;
+  return true;
+}
+
+/**
+  * The mapped memory. NULL if nothing's mapped.
+  */
+void * MappedFile::getData() {
+  return data;
+}
+
+size_t MappedFile::getSize() const {
+  return size;
+}
+
+const std::string & MappedFile::getFileName() const {
+  return fileName;
+}
+
+/**
+  * Unmaps and closes the file. (the file itself is left on disk)
+  */
+void MappedFile::close() {
+#ifdef _WIN32
+  if (data != NULL) {
+    UnmapViewOfFile(data);
+  }
+  if (mappingHandle != NULL) {
+    CloseHandle((HANDLE) mappingHandle);
+  }
+  if (fileHandle != NULL) {
+    CloseHandle((HANDLE) fileHandle);
+  }
+#else
+  if (data != NULL) {
+    munmap(data, size);
+  }
+  if (fileDescriptor >= 0) {
+    ::close(fileDescriptor);
+  }
+#endif
+  data = NULL;
+  size = 0;
+  fileDescriptor = -1;
+  fileHandle = NULL;
+  mappingHandle = NULL;
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#ifndef Mapped_File_h
+#define Mapped_File_h
+
+#include <itkObject.h>
+#include <string>
+
+/**
+  * A file mapped into memory (read/write), so a large buffer can live on disk and only be paged in as it's used.
+  * The file is unmapped (and closed) when the object is deleted. It's an itk::Object so it can be kept alive alongside
+  * whatever is using the memory (e.g. in a mitk::SmartPointerProperty on an image that references it).
+  */
+class MappedFile : public itk::Object {
+  public:
+    typedef MappedFile                      Self;
+    typedef itk::Object                     Superclass;
+    typedef itk::SmartPointer<Self>         Pointer;
+    typedef itk::SmartPointer<const Self>   ConstPointer;
+    itkNewMacro(MappedFile);
+    itkTypeMacro(MappedFile, itk::Object)
+
+  public:
+    bool create(const std::string & fileName, size_t size, bool temporary = false);
+    void * getData();
+    size_t getSize() const;
+    const std::string & getFileName() const;
+
+  protected:
+    MappedFile();
+    virtual ~MappedFile();
+
+  private:
+    void close();
+
+    std::string fileName;
+    void * data;
+    size_t size;
+
+    // Platform handles. (file descriptor, or file and mapping handles on Windows)
+    int fileDescriptor;
+    void * fileHandle;
+    void * mappingHandle;
+};
+
+#endif
\ No newline at end of file
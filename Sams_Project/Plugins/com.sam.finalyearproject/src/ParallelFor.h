@@ -0,0 +1,123 @@
+#ifndef Parallel_For_h
+#define Parallel_For_h
+
+#include <algorithm> // for min
+
+#include <itkMultiThreader.h>
+#include <itkSimpleFastMutexLock.h>
+
+// Loading bar
+#include <mitkProgressBar.h>
+
+/**
+  * Runs a functor over a number of work items (tiles, slabs, rows...) using ITK's threads.
+  * Items are handed out one at a time so uneven items balance out across the threads.
+  *
+  * The functor must provide:
+  *   void operator()(unsigned int item, unsigned int threadID)
+  * and must be safe to call from several threads at once (i.e. only write to its own item).
+  *
+  * If reportProgress is true the loading bar is advanced by one step per item. The caller should
+  * have added numberOfItems steps beforehand. Only the calling thread touches the loading bar.
+  */
+class ParallelFor {
+  public:
+    /**
+      * The number of threads ITK would use by default (i.e. the number of cores).
+      */
+    static unsigned int getNumberOfThreads() {
+      return itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+    }
+
+    template <typename TFunctor>
+    static void run(unsigned int numberOfItems, TFunctor & functor, bool reportProgress = false) {
+      if (numberOfItems == 0) {
+        return;
+      }
+
+      Job<TFunctor> job;
+      job.functor = &functor;
+      job.numberOfItems = numberOfItems;
+      job.nextItem = 0;
+      job.itemsCompleted = 0;
+      job.itemsReported = 0;
+      job.reportProgress = reportProgress;
+
+      // No point starting more threads than there are items.
+      itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+      threader->SetNumberOfThreads(std::min(getNumberOfThreads(), numberOfItems));
+      threader->SetSingleMethod(&ParallelFor::threadCallback<TFunctor>, &job);
+      threader->SingleMethodExecute();
+
+      // Report anything the other threads finished after the calling thread ran out of items.
+      if (reportProgress) {
+        reportCompletedItems(job);
+      }
+    }
+
+  private:
+    template <typename TFunctor>
+    struct Job {
+      TFunctor * functor;
+      unsigned int numberOfItems;
+      unsigned int nextItem;
+      unsigned int itemsCompleted;
+      unsigned int itemsReported;
+      bool reportProgress;
+      itk::SimpleFastMutexLock lock;
+    };
+
+    /**
+      * Each thread keeps taking the next item until there are none left.
+      * NOTE: ITK runs thread 0 on the calling thread.
+      */
+    template <typename TFunctor>
+    static ITK_THREAD_RETURN_TYPE threadCallback(void * arg) {
+      itk::MultiThreader::ThreadInfoStruct * info = static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+      Job<TFunctor> * job = static_cast<Job<TFunctor> *>(info->UserData);
+      unsigned int threadID = info->ThreadID;
+
+      while (true) {
+        job->lock.Lock();
+        unsigned int item = job->nextItem;
+        if (item < job->numberOfItems) {
+          job->nextItem++;
+        }
+        job->lock.Unlock();
+
+        if (item >= job->numberOfItems) {
+          break;
+        }
+
+        (*job->functor)(item, threadID);
+
+        job->lock.Lock();
+        job->itemsCompleted++;
+        job->lock.Unlock();
+
+        // The loading bar belongs to the GUI thread, so only the calling thread updates it.
+        if (job->reportProgress && threadID == 0) {
+          reportCompletedItems(*job);
+        }
+      }
+
+      return ITK_THREAD_RETURN_VALUE;
+    }
+
+    /**
+      * Advances the loading bar by the number of items completed since we last reported.
+      */
+    template <typename TFunctor>
+    static void reportCompletedItems(Job<TFunctor> & job) {
+      job.lock.Lock();
+      unsigned int completed = job.itemsCompleted;
+      job.lock.Unlock();
+
+      if (completed > job.itemsReported) {
+        mitk::ProgressBar::GetInstance()->Progress(completed - job.itemsReported);
+        job.itemsReported = completed;
+      }
+    }
+};
+
+#endif
\ No newline at end of file
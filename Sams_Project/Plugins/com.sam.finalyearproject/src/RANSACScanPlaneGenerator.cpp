@@ -5,10 +5,9 @@
 
 #include <itkMultiplyImageFilter.h>
 #include <itkImportImageFilter.h>
-#include <itkStatisticsImageFilter.h>
 #include <itkChangeInformationImageFilter.h>
 
-#include <mitkImageCast.h>
+#include <mitkImageAccessByItk.h>
 
 // Loading bar
 #include <mitkProgressBar.h>
@@ -21,20 +20,23 @@ RANSACScanPlaneGenerator::RANSACScanPlaneGenerator() {
 
 /**
   * Set the uncertainty representing the volume to be scanned.
+  * If the statistics of the uncertainty have already been computed (e.g. cached on its node) pass them in
+  * to avoid computing them again.
   */
-void RANSACScanPlaneGenerator::setUncertainty(mitk::Image::Pointer uncertainty) {
+void RANSACScanPlaneGenerator::setUncertainty(mitk::Image::Pointer uncertainty, const UncertaintyStatistics * statistics) {
   this->uncertainty = uncertainty;
   this->uncertaintyHeight = uncertainty->GetDimension(0);
   this->uncertaintyWidth = uncertainty->GetDimension(1);
   this->uncertaintyDepth = uncertainty->GetDimension(2);
 
-  mitk::CastToItkImage(uncertainty, this->uncertaintyItk);
-
-  typedef itk::StatisticsImageFilter<itk::Image<double, 3> > StatisticsImageFilterType;
-  StatisticsImageFilterType::Pointer statisticsImageFilter = StatisticsImageFilterType::New();
-  statisticsImageFilter->SetInput(this->uncertaintyItk);
-  statisticsImageFilter->Update();
-  totalUncertainty = statisticsImageFilter->GetSum();
+  if (statistics != NULL && statistics->isFor(uncertainty)) {
+    totalUncertainty = statistics->getSum();
+  }
+  else {
+    UncertaintyStatistics computedStatistics;
+    computedStatistics.compute(uncertainty);
+    totalUncertainty = computedStatistics.getSum();
+  }
   if (DEBUGGING) {
     cout << "Total Uncertainty: " << totalUncertainty << endl;
   }
@@ -143,10 +145,28 @@ vtkSmartPointer<vtkPlane> RANSACScanPlaneGenerator::generatePotentialPlane() {
   * over the total uncertainty in the volume.
   */
 double RANSACScanPlaneGenerator::evaluateScanPlaneGoodness(vtkSmartPointer<vtkPlane> plane) {
+  double goodness = 0.0;
+  try {
+    AccessFixedTypeByItk_n(uncertainty, ItkEvaluateScanPlaneGoodness, MITK_ACCESSBYITK_FLOATING_PIXEL_TYPES_SEQ, (3), (plane, goodness));
+  }
+  catch (mitk::Exception & e) {
+    std::cerr << "Hmmm... it appears we can't get read access to the uncertainty image. Maybe it's type isn't double or float? (I've assumed it is)" << e << std::endl;
+  }
+  return goodness;
+}
+
+/**
+  * Evaluates a plane against the (double or float) uncertainty. The mask is the same type as the uncertainty, so it isn't
+  * converted.
+  */
+template <typename TPixel, unsigned int VImageDimension>
+void RANSACScanPlaneGenerator::ItkEvaluateScanPlaneGoodness(itk::Image<TPixel, VImageDimension>* itkImage, vtkSmartPointer<vtkPlane> plane, double & goodness) {
+  typedef itk::Image<TPixel, VImageDimension> UncertaintyImageType;
+
   // Create a volume (uncertainty mask) the same size as the uncertainty with each value set to zero.
-  double * uncertaintyMask = new double[uncertaintyHeight * uncertaintyWidth * uncertaintyDepth];
-  memset(uncertaintyMask, 0, sizeof(double) * uncertaintyHeight * uncertaintyWidth * uncertaintyDepth);
-  double * it = uncertaintyMask;
+  TPixel * uncertaintyMask = new TPixel[uncertaintyHeight * uncertaintyWidth * uncertaintyDepth];
+  memset(uncertaintyMask, 0, sizeof(TPixel) * uncertaintyHeight * uncertaintyWidth * uncertaintyDepth);
+  TPixel * it = uncertaintyMask;
 
   // For each point in the uncertainty mask set it's value to be proportional to the distance from the plane.
   for(unsigned int z = 0; z < uncertaintyDepth; z++) {
@@ -162,20 +182,20 @@ double RANSACScanPlaneGenerator::evaluateScanPlaneGoodness(vtkSmartPointer<vtkPl
   }
 
   // Bring the mask into ITK-land.
-  typedef itk::ImportImageFilter<double, 3> ImportFilterType;
-  ImportFilterType::Pointer importFilter = ImportFilterType::New(); 
+  typedef itk::ImportImageFilter<TPixel, VImageDimension> ImportFilterType;
+  typename ImportFilterType::Pointer importFilter = ImportFilterType::New(); 
   
-  ImportFilterType::SizeType  size; 
+  typename ImportFilterType::SizeType  size; 
   size[0] = uncertaintyHeight;
   size[1] = uncertaintyWidth;
   size[2] = uncertaintyDepth;
   
-  ImportFilterType::IndexType start;
+  typename ImportFilterType::IndexType start;
   start[0] = 0;
   start[1] = 0;
   start[2] = 0;
   
-  ImportFilterType::RegionType region;
+  typename ImportFilterType::RegionType region;
   region.SetIndex(start);
   region.SetSize(size);
   importFilter->SetRegion(region);
@@ -198,28 +218,28 @@ double RANSACScanPlaneGenerator::evaluateScanPlaneGoodness(vtkSmartPointer<vtkPl
 
   // Do pointwise product between the uncertainty mask and the uncertainty.
   // NOTE: the MultiplyImageFilter requires (for some reason) that the images are aligned (i.e. they have the same origin and spacing)
-  typedef itk::MultiplyImageFilter<itk::Image<double, 3> > MultiplyImageFilterType;
-  typedef itk::ChangeInformationImageFilter<itk::Image<double, 3> > ChangeInformationFilterType;
+  typedef itk::MultiplyImageFilter<UncertaintyImageType> MultiplyImageFilterType;
+  typedef itk::ChangeInformationImageFilter<UncertaintyImageType> ChangeInformationFilterType;
 
-  ChangeInformationFilterType::Pointer changeInformation = ChangeInformationFilterType::New();
+  typename ChangeInformationFilterType::Pointer changeInformation = ChangeInformationFilterType::New();
   changeInformation->UseReferenceImageOn();
-  changeInformation->SetReferenceImage(uncertaintyItk);
+  changeInformation->SetReferenceImage(itkImage);
   changeInformation->ChangeOriginOn();
   changeInformation->ChangeSpacingOn();
   changeInformation->ChangeDirectionOn();
   changeInformation->SetInput(importFilter->GetOutput());
   changeInformation->Update();
 
-  MultiplyImageFilterType::Pointer multiplyFilter = MultiplyImageFilterType::New();
-  multiplyFilter->SetInput1(uncertaintyItk);
+  typename MultiplyImageFilterType::Pointer multiplyFilter = MultiplyImageFilterType::New();
+  multiplyFilter->SetInput1(itkImage);
   multiplyFilter->SetInput2(changeInformation->GetOutput());
   multiplyFilter->Update();
 
   // The total amount of uncertainty covered by this plane is the sum of all values in this product.
-  typedef itk::StatisticsImageFilter<itk::Image<double, 3> > StatisticsImageFilterType;
-  StatisticsImageFilterType::Pointer statisticsImageFilter = StatisticsImageFilterType::New();
+  typedef itk::StatisticsImageFilter<UncertaintyImageType> StatisticsImageFilterType;
+  typename StatisticsImageFilterType::Pointer statisticsImageFilter = StatisticsImageFilterType::New();
   statisticsImageFilter->SetInput(multiplyFilter->GetOutput());
   statisticsImageFilter->Update();
 
-  return statisticsImageFilter->GetSum() / totalUncertainty;
+  goodness = statisticsImageFilter->GetSum() / totalUncertainty;
 }
\ No newline at end of file
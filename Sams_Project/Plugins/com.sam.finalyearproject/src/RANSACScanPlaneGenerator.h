@@ -5,6 +5,9 @@
 #include <vtkPlane.h>
 #include <vtkVector.h>
 #include <mitkImage.h>
+#include <itkImage.h>
+
+#include "UncertaintyStatistics.h"
 
 /**
   * Uses RANSAC to pick the next best plane.
@@ -13,7 +16,7 @@
 class RANSACScanPlaneGenerator {
   public:
     RANSACScanPlaneGenerator();
-    void setUncertainty(mitk::Image::Pointer uncertainty);
+    void setUncertainty(mitk::Image::Pointer uncertainty, const UncertaintyStatistics * statistics = NULL);
     void setGoodnessThreshold(double goodness);
     void setMaximumIterations(unsigned int iterations);
     void setPlaneThickness(double thickness);
@@ -22,9 +25,10 @@ class RANSACScanPlaneGenerator {
   private:
     mitk::Image::Pointer uncertainty;
     unsigned int uncertaintyHeight, uncertaintyWidth, uncertaintyDepth;
-    itk::Image<double, 3>::Pointer uncertaintyItk;
     vtkSmartPointer<vtkPlane> generatePotentialPlane();
     double evaluateScanPlaneGoodness(vtkSmartPointer<vtkPlane> plane);
+    template <typename TPixel, unsigned int VImageDimension>
+    void ItkEvaluateScanPlaneGoodness(itk::Image<TPixel, VImageDimension>* itkImage, vtkSmartPointer<vtkPlane> plane, double & goodness);
 
     static const bool DEBUGGING = true;
 
@@ -4,7 +4,7 @@
 #include "NoPointsException.h"
 
 #include <mitkVector.h>
-#include <mitkImagePixelReadAccessor.h>
+#include <mitkImageAccessByItk.h>
 #include <vnl/algo/vnl_svd.h>
 #include <vcl_iostream.h>
 
@@ -13,6 +13,8 @@
 
 SVDScanPlaneGenerator::SVDScanPlaneGenerator() {
   this->threshold = 0.5;
+  this->mask = NULL;
+  this->statistics = NULL;
 }
 
 /**
@@ -42,6 +44,26 @@ void SVDScanPlaneGenerator::setIgnoreZeros(bool ignoreZeros) {
   this->ignoreZeros = ignoreZeros;
 }
 
+/**
+  * Sets a mask of the points to use (e.g. the threshold being displayed) instead of thresholding the uncertainty again.
+  * The mask should select the same points as the threshold would (at or below it, without zeros if ignoring them).
+  *   region - where the mask is in the uncertainty, if it's been cropped (empty for the whole uncertainty).
+  * It's ignored if it's empty or the wrong size, or if it's cropped and the points outside could be in the threshold.
+  */
+void SVDScanPlaneGenerator::setMask(const UncertaintyBitMask * mask, const itk::ImageRegion<3> & region) {
+  this->mask = mask;
+  this->maskRegion = region;
+}
+
+/**
+  * Set the statistics of the uncertainty if they've already been computed (e.g. cached on its node).
+  * They let us skip the search for points when there can't be any, and only search the non-zero part of the volume
+  * when ignoring zeros.
+  */
+void SVDScanPlaneGenerator::setStatistics(const UncertaintyStatistics * statistics) {
+  this->statistics = statistics;
+}
+
 /**
   * Uses SVD to calculate the next best scan plane.
   */
@@ -49,7 +71,7 @@ vtkSmartPointer<vtkPlane> SVDScanPlaneGenerator::calculateBestScanPlane() {
   mitk::ProgressBar::GetInstance()->AddStepsToDo(3);
   
   // Get all points worse than specified threshold.
-  mitk::PointSet::Pointer pointSet = pointsBelowThreshold(threshold);
+  mitk::PointSet::Pointer pointSet = maskFits() ? pointsInMask() : pointsBelowThreshold(threshold);
 
   // If there are no points then throw an Exception.
   if (pointSet->GetSize() == 0) {
@@ -99,47 +121,105 @@ vtkSmartPointer<vtkPlane> SVDScanPlaneGenerator::calculateBestScanPlane() {
 }
 
 /**
-  * Get a list of all points in the uncertainty data that are below a given threshold.
+  * Get a list of all points in the uncertainty data that are at or below a given threshold.
   */
 mitk::PointSet::Pointer SVDScanPlaneGenerator::pointsBelowThreshold(double threshold) {
-  mitk::ProgressBar::GetInstance()->AddStepsToDo(uncertaintyHeight);
-
   mitk::PointSet::Pointer pointSet = mitk::PointSet::New();
 
+  // Work out which part of the volume to search.
+  unsigned int start[3] = {0, 0, 0};
+  unsigned int end[3] = {uncertaintyHeight, uncertaintyWidth, uncertaintyDepth};
+  if (statistics != NULL && statistics->isFor(this->uncertainty)) {
+    // Nothing can be at or below the threshold.
+    if (statistics->getMin() > threshold || (ignoreZeros && !statistics->hasNonZeros())) {
+      return pointSet;
+    }
+    // Everything outside the non-zero region is zero, so would be skipped anyway.
+    if (ignoreZeros) {
+      itk::ImageRegion<3> nonZeroRegion = statistics->getNonZeroRegion();
+      for (unsigned int i = 0; i < 3; i++) {
+        start[i] = nonZeroRegion.GetIndex()[i];
+        end[i] = start[i] + nonZeroRegion.GetSize()[i];
+      }
+    }
+  }
+
+  mitk::ProgressBar::GetInstance()->AddStepsToDo(end[0] - start[0]);
+
   try  {
     // See if the uncertainty data is available to be read.
-    mitk::ImagePixelReadAccessor<double, 3> readAccess(this->uncertainty);
-    unsigned int pointCount = 0;
-    for (unsigned int x = 0; x < uncertaintyHeight; x++) {
-      for (unsigned int y = 0; y < uncertaintyWidth; y++) {
-        for (unsigned int z = 0; z < uncertaintyDepth; z++) {
-          itk::Index<3> index;
-          index[0] = x;
-          index[1] = y;
-          index[2] = z;
-          double indexUncertainty = readAccess.GetPixelByIndex(index);
-
-          // If the value is below the threshold add it to the set.
-          if (indexUncertainty < threshold) {
-            // If we're ignoring zeros and it is zero then skip it.
-            if (ignoreZeros && indexUncertainty == 0.0) {
-              continue;
-            }
-            mitk::Point3D point;
-            point[0] = x;
-            point[1] = y;
-            point[2] = z;
-            pointSet->InsertPoint(pointCount, point);
-            pointCount++;
-          }
+    AccessFixedTypeByItk_n(this->uncertainty, ItkPointsBelowThreshold, MITK_ACCESSBYITK_FLOATING_PIXEL_TYPES_SEQ, (3), (threshold, start, end, pointSet));
+  }
+  catch (mitk::Exception & e) {
+    cerr << "Hmmm... it appears we can't get read access to the uncertainty image. Maybe it's gone? Maybe it's type isn't double or float? (I've assumed it is)" << e << endl;
+  }
+
+  return pointSet;
+}
+
+/**
+  * Whether the mask can be used instead of thresholding: it's the size of its region, which is inside the uncertainty.
+  * A cropped mask also needs everything outside it to be left out anyway, i.e. to be zero when we're ignoring zeros
+  * (the statistics tell us where the non-zeros are).
+  */
+bool SVDScanPlaneGenerator::maskFits() {
+  if (mask == NULL || mask->isEmpty()) {
+    return false;
+  }
+
+  itk::ImageRegion<3> wholeRegion;
+  itk::ImageRegion<3>::SizeType wholeSize;
+  wholeSize[0] = uncertaintyHeight;
+  wholeSize[1] = uncertaintyWidth;
+  wholeSize[2] = uncertaintyDepth;
+  wholeRegion.SetSize(wholeSize);
+
+  itk::ImageRegion<3> region = (maskRegion.GetNumberOfPixels() > 0) ? maskRegion : wholeRegion;
+  for (unsigned int i = 0; i < 3; i++) {
+    if (mask->getDimension(i) != region.GetSize(i)) {
+      return false;
+    }
+  }
+  if (region == wholeRegion) {
+    return true;
+  }
+  if (!wholeRegion.IsInside(region) || !ignoreZeros || statistics == NULL || !statistics->isFor(this->uncertainty)) {
+    return false;
+  }
+  return !statistics->hasNonZeros() || region.IsInside(statistics->getNonZeroRegion());
+}
+
+/**
+  * Get a list of all points in the mask (in the uncertainty's voxels, if it's cropped). Voxels are visited in memory order.
+  */
+mitk::PointSet::Pointer SVDScanPlaneGenerator::pointsInMask() {
+  mitk::PointSet::Pointer pointSet = mitk::PointSet::New();
+
+  // Where the mask starts in the uncertainty.
+  unsigned int offset[3] = {0, 0, 0};
+  if (maskRegion.GetNumberOfPixels() > 0) {
+    for (unsigned int i = 0; i < 3; i++) {
+      offset[i] = maskRegion.GetIndex(i);
+    }
+  }
+
+  unsigned int pointCount = 0;
+  size_t voxel = 0;
+  for (unsigned int z = 0; z < mask->getDimension(2); z++) {
+    for (unsigned int y = 0; y < mask->getDimension(1); y++) {
+      for (unsigned int x = 0; x < mask->getDimension(0); x++) {
+        if (mask->contains(voxel)) {
+          mitk::Point3D point;
+          point[0] = offset[0] + x;
+          point[1] = offset[1] + y;
+          point[2] = offset[2] + z;
+          pointSet->InsertPoint(pointCount, point);
+          pointCount++;
         }
+        voxel++;
       }
-      mitk::ProgressBar::GetInstance()->Progress();
     }
   }
-  catch (mitk::Exception & e) {
-    cerr << "Hmmm... it appears we can't get read access to the uncertainty image. Maybe it's gone? Maybe it's type isn't double? (I've assumed it is)" << e << endl;
-  }
 
   return pointSet;
 }
@@ -170,4 +250,38 @@ void SVDScanPlaneGenerator::calculateCentroid(mitk::PointSet::Pointer pointSet,
   centroid[0] /= pointTotal;
   centroid[1] /= pointTotal;
   centroid[2] /= pointTotal;
+}
+
+/**
+  * Adds the voxels of the (double or float) uncertainty in [start, end) that are at or below the threshold to the point set.
+  */
+template <typename TPixel, unsigned int VImageDimension>
+void SVDScanPlaneGenerator::ItkPointsBelowThreshold(itk::Image<TPixel, VImageDimension>* itkImage, double threshold, const unsigned int start[3], const unsigned int end[3], mitk::PointSet::Pointer pointSet) {
+  unsigned int pointCount = 0;
+  for (unsigned int x = start[0]; x < end[0]; x++) {
+    for (unsigned int y = start[1]; y < end[1]; y++) {
+      for (unsigned int z = start[2]; z < end[2]; z++) {
+        itk::Index<3> index;
+        index[0] = x;
+        index[1] = y;
+        index[2] = z;
+        double indexUncertainty = itkImage->GetPixel(index);
+
+        // If the value is at or below the threshold add it to the set. (as the thresholder does, so a mask from it matches)
+        if (indexUncertainty <= threshold) {
+          // If we're ignoring zeros and it is zero then skip it.
+          if (ignoreZeros && indexUncertainty == 0.0) {
+            continue;
+          }
+          mitk::Point3D point;
+          point[0] = x;
+          point[1] = y;
+          point[2] = z;
+          pointSet->InsertPoint(pointCount, point);
+          pointCount++;
+        }
+      }
+    }
+    mitk::ProgressBar::GetInstance()->Progress();
+  }
 }
\ No newline at end of file
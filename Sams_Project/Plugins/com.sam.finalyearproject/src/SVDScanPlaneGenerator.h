@@ -5,6 +5,11 @@
 #include <vtkPlane.h>
 #include <mitkImage.h>
 #include <mitkPointSet.h>
+#include <itkImage.h>
+#include <itkImageRegion.h>
+
+#include "UncertaintyBitMask.h"
+#include "UncertaintyStatistics.h"
 
 class SVDScanPlaneGenerator {
   public:
@@ -12,6 +17,8 @@ class SVDScanPlaneGenerator {
     void setUncertainty(mitk::Image::Pointer uncertainty);
     void setThreshold(double threshold);
     void setIgnoreZeros(bool ignoreZeros);
+    void setMask(const UncertaintyBitMask * mask, const itk::ImageRegion<3> & region = itk::ImageRegion<3>());
+    void setStatistics(const UncertaintyStatistics * statistics);
     vtkSmartPointer<vtkPlane> calculateBestScanPlane();
 
   private:
@@ -20,9 +27,18 @@ class SVDScanPlaneGenerator {
 
     double threshold;
     bool ignoreZeros;
+    const UncertaintyBitMask * mask;
+    itk::ImageRegion<3> maskRegion;
+    const UncertaintyStatistics * statistics;
 
     mitk::PointSet::Pointer pointsBelowThreshold(double threshold);
+    bool maskFits();
+    mitk::PointSet::Pointer pointsInMask();
     void calculateCentroid(mitk::PointSet::Pointer pointSet, mitk::Point3D & centroid);
+
+    // ITK Methods
+    template <typename TPixel, unsigned int VImageDimension>
+    void ItkPointsBelowThreshold(itk::Image<TPixel, VImageDimension>* itkImage, double threshold, const unsigned int start[3], const unsigned int end[3], mitk::PointSet::Pointer pointSet);
 };
 
 #endif
\ No newline at end of file
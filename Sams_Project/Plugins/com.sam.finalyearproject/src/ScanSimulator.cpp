@@ -7,6 +7,10 @@
 // Loading bar
 #include <mitkProgressBar.h>
 
+ScanSimulator::ScanSimulator() {
+  this->singlePrecision = false;
+}
+
 /**
   * Sets the volume to scan.
   */
@@ -116,18 +120,38 @@ vtkVector<float, 3> ScanSimulator::scanToVolumePosition(unsigned int w, unsigned
   return position;
 }
 
+/**
+  * Sets whether the scan is float rather than double (to halve its memory).
+  */
+void ScanSimulator::setSinglePrecision(bool singlePrecision) {
+  this->singlePrecision = singlePrecision;
+}
+
 /**
   * Scans the volume.
   */
 mitk::Image::Pointer ScanSimulator::scan() {
+  if (singlePrecision) {
+    return scanImage<float>();
+  }
+  return scanImage<double>();
+}
+
+/**
+  * Scans the volume into an image of TPixel (double or float).
+  */
+template <typename TPixel>
+mitk::Image::Pointer ScanSimulator::scanImage() {
+  typedef itk::Image<TPixel, 3> ScanImageType;
+
   // Create a blank ITK image.
-  ScanImageType::RegionType region;
-  ScanImageType::IndexType start;
+  typename ScanImageType::RegionType region;
+  typename ScanImageType::IndexType start;
   start[0] = 0;
   start[1] = 0;
   start[2] = 0;
 
-  ScanImageType::SizeType scanSize;
+  typename ScanImageType::SizeType scanSize;
   scanSize[0] = scanWidth;
   scanSize[1] = scanHeight;
   scanSize[2] = numSlices;
@@ -137,7 +161,7 @@ mitk::Image::Pointer ScanSimulator::scan() {
   region.SetSize(scanSize);
   region.SetIndex(start);
 
-  ScanImageType::Pointer scan = ScanImageType::New();
+  typename ScanImageType::Pointer scan = ScanImageType::New();
   scan->SetRegions(region);
   scan->Allocate();
   mitk::ProgressBar::GetInstance()->Progress();
@@ -185,7 +209,7 @@ mitk::Image::Pointer ScanSimulator::scan() {
           AccessByItk_2(this->volume, Util::ItkInterpolateValue, volumePosition, volumeValue);
         }
 
-        ScanImageType::IndexType pixelIndex;
+        typename ScanImageType::IndexType pixelIndex;
         pixelIndex[0] = w;
         pixelIndex[1] = h;
         pixelIndex[2] = s;
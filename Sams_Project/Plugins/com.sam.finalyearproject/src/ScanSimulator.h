@@ -7,10 +7,9 @@
 #include <vtkVector.h>
 #include <list>
 
-typedef itk::Image<double, 3>  ScanImageType;
-
 class ScanSimulator {
   public:
+    ScanSimulator();
     void setVolume(mitk::Image::Pointer volume);
     void setScanOrigin(vtkVector<float, 3> origin);
     void setScanCenter(vtkVector<float, 3> center);
@@ -19,6 +18,7 @@ class ScanSimulator {
     void setScanSize(unsigned int width, unsigned int height, unsigned int slices);
     void setMotionCorruption(bool corruption);
     void setMotionCorruptionMaxAngle(double angle);
+    void setSinglePrecision(bool singlePrecision);
     mitk::Image::Pointer scan();
 
   private:
@@ -33,6 +33,10 @@ class ScanSimulator {
     bool motionCorruptionOn;
     double motionCorruptionMaxAngle;
 
+    bool singlePrecision;
+
+    template <typename TPixel>
+    mitk::Image::Pointer scanImage();
     vtkVector<float, 3> scanToVolumePosition(unsigned int w, unsigned int h, unsigned int s);
     vtkSmartPointer<vtkTransform> generateRandomMotion();
     std::list<vtkSmartPointer<vtkTransform> > * generateRandomMotionSequence(unsigned int steps);
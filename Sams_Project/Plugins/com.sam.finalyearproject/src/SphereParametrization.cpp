@@ -0,0 +1,180 @@
+#include "SphereParametrization.h"
+
+#include <cmath>
+#include <algorithm> // for min/max
+
+namespace {
+  // Sign where 0 counts as positive (so the octahedral fold is well defined on the axes).
+  double signNotZero(double value) {
+    return (value >= 0.0) ? 1.0 : -1.0;
+  }
+}
+
+/**
+  * The (unit) direction from the center of the sphere for texture coordinates (s, t).
+  */
+vtkVector<float, 3> SphereParametrization::direction(TYPE type, double s, double t) {
+  vtkVector<float, 3> direction;
+  switch (type) {
+    // Same convention as vtkTextureMapToSphere. t is the angle down from +z, s is the angle around from +x.
+    case EQUIRECTANGULAR:
+    {
+      double theta = t * M_PI;
+      double phi = s * 2 * M_PI;
+      direction[0] = cos(phi) * sin(theta);
+      direction[1] = sin(phi) * sin(theta);
+      direction[2] = cos(theta);
+    }
+    break;
+
+    // The square is the octahedron unfolded. The center is +z, the corners are -z.
+    case OCTAHEDRAL:
+    {
+      double u = s * 2 - 1;
+      double v = t * 2 - 1;
+      double z = 1 - fabs(u) - fabs(v);
+      // Lower half is folded over the diagonals.
+      if (z < 0) {
+        double foldedU = (1 - fabs(v)) * signNotZero(u);
+        double foldedV = (1 - fabs(u)) * signNotZero(v);
+        u = foldedU;
+        v = foldedV;
+      }
+      direction[0] = u;
+      direction[1] = v;
+      direction[2] = z;
+      direction.Normalize();
+    }
+    break;
+
+    // Pick the face from the 3 x 2 grid, then the position within it.
+    case CUBE_MAP:
+    {
+      unsigned int column = std::min(2.0, std::max(0.0, floor(s * 3)));
+      unsigned int row = std::min(1.0, std::max(0.0, floor(t * 2)));
+      double a = (s * 3 - column) * 2 - 1;
+      double b = (t * 2 - row) * 2 - 1;
+      direction = cubeFaceDirection(row * 3 + column, a, b);
+    }
+    break;
+  }
+  return direction;
+}
+
+/**
+  * The texture coordinates (s, t) for a direction from the center of the sphere. Inverse of direction().
+  */
+void SphereParametrization::textureCoordinates(TYPE type, vtkVector<float, 3> direction, double & s, double & t) {
+  switch (type) {
+    case EQUIRECTANGULAR:
+    {
+      double length = direction.Norm();
+      double theta = acos(std::min(1.0, std::max(-1.0, direction[2] / length)));
+      double phi = atan2((double) direction[1], (double) direction[0]);
+      if (phi < 0) {
+        phi += 2 * M_PI;
+      }
+      s = phi / (2 * M_PI);
+      t = theta / M_PI;
+    }
+    break;
+
+    case OCTAHEDRAL:
+    {
+      double length = fabs(direction[0]) + fabs(direction[1]) + fabs(direction[2]);
+      double u = direction[0] / length;
+      double v = direction[1] / length;
+      // Fold the lower half out over the diagonals.
+      if (direction[2] < 0) {
+        double foldedU = (1 - fabs(v)) * signNotZero(u);
+        double foldedV = (1 - fabs(u)) * signNotZero(v);
+        u = foldedU;
+        v = foldedV;
+      }
+      s = (u + 1) / 2;
+      t = (v + 1) / 2;
+    }
+    break;
+
+    case CUBE_MAP:
+    {
+      // The face is the one the largest component points at.
+      unsigned int axis = 0;
+      for (unsigned int i = 1; i < 3; i++) {
+        if (fabs(direction[i]) > fabs(direction[axis])) {
+          axis = i;
+        }
+      }
+      unsigned int face = axis * 2 + ((direction[axis] < 0) ? 1 : 0);
+      double major = fabs(direction[axis]);
+
+      // Undo the equi-angular warp.
+      double a = atan(direction[(axis + 1) % 3] / major) * 4 / M_PI;
+      double b = atan(direction[(axis + 2) % 3] / major) * 4 / M_PI;
+      cubeFaceTextureCoordinates(face, a, b, s, t);
+    }
+    break;
+  }
+}
+
+/**
+  * The size of texture needed to give roughly the same resolution as an equirectangular texture
+  * that has equatorTexels texels around its equator (i.e. its width).
+  *   EQUIRECTANGULAR is equatorTexels x equatorTexels / 2.
+  *   OCTAHEDRAL is square with the same area per texel as the equator. About 36% fewer texels.
+  *   CUBE_MAP faces are a quarter of the equator across. About 25% fewer texels.
+  * Sizes are kept even so opposite texels line up exactly.
+  */
+void SphereParametrization::textureSize(TYPE type, unsigned int equatorTexels, unsigned int & width, unsigned int & height) {
+  switch (type) {
+    case EQUIRECTANGULAR:
+    {
+      width = equatorTexels;
+      height = std::max(1u, equatorTexels / 2);
+    }
+    break;
+
+    case OCTAHEDRAL:
+    {
+      unsigned int size = ceil(equatorTexels / sqrt(M_PI) / 2) * 2;
+      width = std::max(2u, size);
+      height = width;
+    }
+    break;
+
+    case CUBE_MAP:
+    {
+      unsigned int faceSize = std::max(1.0, ceil(equatorTexels / 4.0));
+      width = faceSize * 3;
+      height = faceSize * 2;
+    }
+    break;
+  }
+}
+
+/**
+  * The (unit) direction of position (a, b) on a cube map face.
+  * The face's axis is the major axis, (a, b) run along the next two axes (wrapping around x, y, z).
+  */
+vtkVector<float, 3> SphereParametrization::cubeFaceDirection(unsigned int face, double a, double b) {
+  unsigned int axis = face / 2;
+  double sign = (face % 2 == 0) ? 1.0 : -1.0;
+
+  vtkVector<float, 3> direction;
+  direction[axis] = sign;
+  direction[(axis + 1) % 3] = tan(a * M_PI / 4);
+  direction[(axis + 2) % 3] = tan(b * M_PI / 4);
+  direction.Normalize();
+  return direction;
+}
+
+/**
+  * The texture coordinates for position (a, b) on a cube map face.
+  * Faces are laid out +x, -x, +y along the top and -y, +z, -z along the bottom.
+  */
+void SphereParametrization::cubeFaceTextureCoordinates(unsigned int face, double a, double b, double & s, double & t) {
+  unsigned int column = face % 3;
+  unsigned int row = face / 3;
+  s = (column + (a + 1) / 2) / 3;
+  t = (row + (b + 1) / 2) / 2;
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#ifndef Sphere_Parametrization_h
+#define Sphere_Parametrization_h
+
+#include <vtkVector.h>
+
+/**
+  * Ways of laying out the directions on a sphere in a 2D texture (s, t in [0, 1]).
+  *   EQUIRECTANGULAR is the (theta, phi) mapping used by vtkTextureMapToSphere. Simple, but rows near the poles
+  *     squash thousands of texels into tiny areas.
+  *   OCTAHEDRAL projects the sphere onto an octahedron and unfolds it into a square.
+  *   CUBE_MAP projects the sphere onto the six faces of a cube (laid out 3 x 2). Faces are warped
+  *     (equi-angular) so texels cover roughly the same angle across the face.
+  * The last two spread texels much more evenly over the sphere.
+  */
+class SphereParametrization {
+  public:
+    enum TYPE {EQUIRECTANGULAR, OCTAHEDRAL, CUBE_MAP};
+
+    static vtkVector<float, 3> direction(TYPE type, double s, double t);
+    static void textureCoordinates(TYPE type, vtkVector<float, 3> direction, double & s, double & t);
+    static void textureSize(TYPE type, unsigned int equatorTexels, unsigned int & width, unsigned int & height);
+
+    // Cube map faces are +x, -x, +y, -y, +z, -z. (a, b) are positions on the face in [-1, 1].
+    static const unsigned int CUBE_FACES = 6;
+    static vtkVector<float, 3> cubeFaceDirection(unsigned int face, double a, double b);
+    static void cubeFaceTextureCoordinates(unsigned int face, double a, double b, double & s, double & t);
+};
+
+#endif
\ No newline at end of file
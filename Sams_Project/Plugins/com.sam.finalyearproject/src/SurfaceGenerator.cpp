@@ -13,6 +13,14 @@
 #include <vtkLineSource.h>
 #include <vtkPolyDataMapper.h>
 #include <vtkTubeFilter.h>
+#include <vtkPolyData.h>
+#include <vtkPoints.h>
+#include <vtkCellArray.h>
+#include <vtkFloatArray.h>
+#include <vtkPointData.h>
+#include <vtkMath.h>
+
+#include <algorithm> // for max
 
 // Loading bar
 #include <mitkProgressBar.h>
@@ -22,8 +30,14 @@
   *   thetaResolution - the number of points used horizontally to create the sphere.
   *   phiResolution - the number of points used vertically to create the sphere.
   *   radius - the width of the sphere.
+  *   parametrization - the texture coordinates to give the sphere (see SphereParametrization).
+  *     For anything but EQUIRECTANGULAR the sphere is built from a grid over the texture instead (see generateParametrizedSphere).
   */
-mitk::Surface::Pointer SurfaceGenerator::generateSphere(unsigned int thetaResolution, unsigned int phiResolution, unsigned int radius) {
+mitk::Surface::Pointer SurfaceGenerator::generateSphere(unsigned int thetaResolution, unsigned int phiResolution, unsigned int radius, SphereParametrization::TYPE parametrization) {
+  if (parametrization != SphereParametrization::EQUIRECTANGULAR) {
+    return generateParametrizedSphere(parametrization, phiResolution, radius);
+  }
+
   mitk::ProgressBar::GetInstance()->AddStepsToDo(1);
   
   // Create a sphere.
@@ -46,6 +60,107 @@ mitk::Surface::Pointer SurfaceGenerator::generateSphere(unsigned int thetaResolu
   return surface;
 }
 
+/**
+  * Generates a sphere by wrapping a grid over its texture around it, so the texture coordinates match exactly
+  * and no triangle crosses a seam in the texture.
+  *   OCTAHEDRAL is one square grid with resolution (rounded up to even) squares across.
+  *     Triangles are split along the octahedron's folds.
+  *   CUBE_MAP is a grid per face with resolution / 2 squares across.
+  */
+mitk::Surface::Pointer SurfaceGenerator::generateParametrizedSphere(SphereParametrization::TYPE parametrization, unsigned int resolution, unsigned int radius) {
+  mitk::ProgressBar::GetInstance()->AddStepsToDo(1);
+
+  bool cubeMap = (parametrization == SphereParametrization::CUBE_MAP);
+  unsigned int faces = cubeMap ? SphereParametrization::CUBE_FACES : 1;
+  unsigned int segments = cubeMap ? std::max(1u, resolution / 2) : std::max(2u, ((resolution + 1) / 2) * 2);
+
+  vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+  vtkSmartPointer<vtkCellArray> triangles = vtkSmartPointer<vtkCellArray>::New();
+  vtkSmartPointer<vtkFloatArray> normals = vtkSmartPointer<vtkFloatArray>::New();
+  normals->SetNumberOfComponents(3);
+  vtkSmartPointer<vtkFloatArray> textureCoordinates = vtkSmartPointer<vtkFloatArray>::New();
+  textureCoordinates->SetNumberOfComponents(2);
+
+  for (unsigned int face = 0; face < faces; face++) {
+    vtkIdType firstPoint = points->GetNumberOfPoints();
+
+    // Points. (segments + 1) x (segments + 1) per grid.
+    for (unsigned int j = 0; j <= segments; j++) {
+      for (unsigned int i = 0; i <= segments; i++) {
+        double a = (double) i / segments;
+        double b = (double) j / segments;
+
+        vtkVector<float, 3> direction;
+        double s, t;
+        if (cubeMap) {
+          direction = SphereParametrization::cubeFaceDirection(face, a * 2 - 1, b * 2 - 1);
+          SphereParametrization::cubeFaceTextureCoordinates(face, a * 2 - 1, b * 2 - 1, s, t);
+        }
+        else {
+          direction = SphereParametrization::direction(parametrization, a, b);
+          s = a;
+          t = b;
+        }
+
+        points->InsertNextPoint(direction[0] * radius, direction[1] * radius, direction[2] * radius);
+        normals->InsertNextTuple3(direction[0], direction[1], direction[2]);
+        textureCoordinates->InsertNextTuple2(s, t);
+      }
+    }
+
+    // Two triangles per square.
+    for (unsigned int j = 0; j < segments; j++) {
+      for (unsigned int i = 0; i < segments; i++) {
+        vtkIdType p00 = firstPoint + j * (segments + 1) + i;
+        vtkIdType p10 = p00 + 1;
+        vtkIdType p01 = p00 + (segments + 1);
+        vtkIdType p11 = p01 + 1;
+
+        // Octahedral folds run along the anti-diagonal where u and v have the same sign, and the diagonal otherwise.
+        double u = (i + 0.5) / segments * 2 - 1;
+        double v = (j + 0.5) / segments * 2 - 1;
+        vtkIdType triangle[2][3];
+        if (!cubeMap && u * v > 0) {
+          triangle[0][0] = p00; triangle[0][1] = p10; triangle[0][2] = p01;
+          triangle[1][0] = p10; triangle[1][1] = p11; triangle[1][2] = p01;
+        }
+        else {
+          triangle[0][0] = p00; triangle[0][1] = p10; triangle[0][2] = p11;
+          triangle[1][0] = p00; triangle[1][1] = p11; triangle[1][2] = p01;
+        }
+
+        for (unsigned int k = 0; k < 2; k++) {
+          // Make sure the triangle faces outwards.
+          double p0[3], p1[3], p2[3];
+          points->GetPoint(triangle[k][0], p0);
+          points->GetPoint(triangle[k][1], p1);
+          points->GetPoint(triangle[k][2], p2);
+          double edge1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+          double edge2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+          double triangleNormal[3];
+          vtkMath::Cross(edge1, edge2, triangleNormal);
+          double centroid[3] = {p0[0] + p1[0] + p2[0], p0[1] + p1[1] + p2[1], p0[2] + p1[2] + p2[2]};
+          if (vtkMath::Dot(triangleNormal, centroid) < 0) {
+            std::swap(triangle[k][1], triangle[k][2]);
+          }
+          triangles->InsertNextCell(3, triangle[k]);
+        }
+      }
+    }
+  }
+
+  vtkSmartPointer<vtkPolyData> sphere = vtkSmartPointer<vtkPolyData>::New();
+  sphere->SetPoints(points);
+  sphere->SetPolys(triangles);
+  sphere->GetPointData()->SetNormals(normals);
+  sphere->GetPointData()->SetTCoords(textureCoordinates);
+
+  mitk::Surface::Pointer surface = mitk::Surface::New();
+  surface->SetVtkPolyData(sphere);
+  mitk::ProgressBar::GetInstance()->Progress();
+  return surface;
+}
+
 /**
   * Creates a cube, centered at (0, 0, 0) with specified side length.
   */
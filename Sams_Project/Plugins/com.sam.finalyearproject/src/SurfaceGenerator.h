@@ -4,9 +4,16 @@
 #include <vtkVector.h>
 #include <mitkSurface.h>
 
+#include "SphereParametrization.h"
+
 class SurfaceGenerator {
   public:
-    static mitk::Surface::Pointer generateSphere(unsigned int thetaResolution = 100, unsigned int phiResolution = 50, unsigned int radius = 20);
+    static mitk::Surface::Pointer generateSphere(
+      unsigned int thetaResolution = 100,
+      unsigned int phiResolution = 50,
+      unsigned int radius = 20,
+      SphereParametrization::TYPE parametrization = SphereParametrization::EQUIRECTANGULAR
+    );
     static mitk::Surface::Pointer generateCube(unsigned int length = 20);
     static mitk::Surface::Pointer generateCylinder(unsigned int radius = 20, unsigned int height = 20, unsigned int resolution = 10);
     static mitk::Surface::Pointer generatePlane(
@@ -38,6 +45,7 @@ class SurfaceGenerator {
 
   private:
     static const bool DEBUGGING = false;
+    static mitk::Surface::Pointer generateParametrizedSphere(SphereParametrization::TYPE parametrization, unsigned int resolution, unsigned int radius);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,161 @@
+#include "UncertaintyBitMask.h"
+
+#include "ParallelFor.h"
+
+#include <algorithm> // for min
+
+#include <mitkImageCast.h>
+#include <mitkImagePixelReadAccessor.h>
+
+UncertaintyBitMask::UncertaintyBitMask() {
+  for (unsigned int i = 0; i < 3; i++) {
+    size[i] = 0;
+  }
+}
+
+/**
+  * Packs a block of words. Each block only writes its own words.
+  */
+struct UncertaintyBitMask::Packer {
+  const unsigned char * mask;
+  size_t numberOfVoxels;
+  std::vector<itk::uint64_t> * words;
+
+  void operator()(unsigned int block, unsigned int /*threadID*/) {
+    size_t firstWord = (size_t) block * WORDS_PER_BLOCK;
+    size_t lastWord = std::min(firstWord + WORDS_PER_BLOCK, words->size());
+    for (size_t word = firstWord; word < lastWord; word++) {
+      size_t firstVoxel = word * BITS_PER_WORD;
+      unsigned int bits = std::min((size_t) BITS_PER_WORD, numberOfVoxels - firstVoxel);
+      itk::uint64_t packed = 0;
+      for (unsigned int bit = 0; bit < bits; bit++) {
+        if (mask[firstVoxel + bit]) {
+          packed |= ((itk::uint64_t) 1) << bit;
+        }
+      }
+      (*words)[word] = packed;
+    }
+  }
+};
+
+/**
+  * Unpacks a block of words into an unsigned char buffer (0 or 1 per voxel).
+  */
+struct UncertaintyBitMask::Unpacker {
+  const std::vector<itk::uint64_t> * words;
+  size_t numberOfVoxels;
+  unsigned char * mask;
+
+  void operator()(unsigned int block, unsigned int /*threadID*/) {
+    size_t firstWord = (size_t) block * WORDS_PER_BLOCK;
+    size_t lastWord = std::min(firstWord + WORDS_PER_BLOCK, words->size());
+    for (size_t word = firstWord; word < lastWord; word++) {
+      size_t firstVoxel = word * BITS_PER_WORD;
+      unsigned int bits = std::min((size_t) BITS_PER_WORD, numberOfVoxels - firstVoxel);
+      itk::uint64_t packed = (*words)[word];
+      for (unsigned int bit = 0; bit < bits; bit++) {
+        mask[firstVoxel + bit] = (packed >> bit) & 1;
+      }
+    }
+  }
+};
+
+/**
+  * Packs an unsigned char mask (anything non-zero is in the mask).
+  */
+void UncertaintyBitMask::pack(mitk::Image::Pointer mask) {
+  clear();
+  for (unsigned int i = 0; i < 3; i++) {
+    size[i] = mask->GetDimension(i);
+  }
+  words.assign((getNumberOfVoxels() + BITS_PER_WORD - 1) / BITS_PER_WORD, 0);
+  origin = mask->GetGeometry()->GetOrigin();
+  transform = mask->GetGeometry()->GetIndexToWorldTransform();
+
+  try {
+    mitk::ImagePixelReadAccessor<unsigned char, 3> readAccess(mask);
+    Packer packer;
+    packer.mask = readAccess.GetData();
+    packer.numberOfVoxels = getNumberOfVoxels();
+    packer.words = &words;
+    ParallelFor::run(getNumberOfBlocks(), packer);
+  }
+  catch (mitk::Exception & e) {
+    std::cerr << "Hmmm... it appears we can't get read access to the mask. Maybe it's type isn't unsigned char? (I've assumed it is)" << e << std::endl;
+    clear();
+  }
+}
+
+/**
+  * Converts the mask back to an unsigned char image (for display).
+  */
+mitk::Image::Pointer UncertaintyBitMask::unpack() const {
+  typedef itk::Image<unsigned char, 3> MaskImageType;
+  MaskImageType::RegionType region;
+  MaskImageType::SizeType regionSize;
+  for (unsigned int i = 0; i < 3; i++) {
+    regionSize[i] = size[i];
+  }
+  region.SetSize(regionSize);
+
+  MaskImageType::Pointer maskImage = MaskImageType::New();
+  maskImage->SetRegions(region);
+  maskImage->Allocate();
+
+  Unpacker unpacker;
+  unpacker.words = &words;
+  unpacker.numberOfVoxels = getNumberOfVoxels();
+  unpacker.mask = maskImage->GetBufferPointer();
+  ParallelFor::run(getNumberOfBlocks(), unpacker);
+
+  mitk::Image::Pointer result;
+  mitk::CastToMitkImage(maskImage, result);
+  if (transform.IsNotNull()) {
+    result->GetGeometry()->SetOrigin(origin);
+    result->GetGeometry()->SetIndexToWorldTransform(transform);
+  }
+  return result;
+}
+
+/**
+  * Throws the mask away (e.g. to free the memory).
+  */
+void UncertaintyBitMask::clear() {
+  std::vector<itk::uint64_t>().swap(words);
+  for (unsigned int i = 0; i < 3; i++) {
+    size[i] = 0;
+  }
+  transform = NULL;
+}
+
+bool UncertaintyBitMask::isEmpty() const {
+  return words.empty();
+}
+
+unsigned int UncertaintyBitMask::getDimension(unsigned int i) const {
+  return size[i];
+}
+
+size_t UncertaintyBitMask::getNumberOfVoxels() const {
+  return (size_t) size[0] * size[1] * size[2];
+}
+
+/**
+  * The number of voxels in the mask.
+  */
+size_t UncertaintyBitMask::count() const {
+  size_t total = 0;
+  for (size_t word = 0; word < words.size(); word++) {
+    itk::uint64_t packed = words[word];
+    // Clear the lowest set bit until there are none left.
+    while (packed) {
+      packed &= packed - 1;
+      total++;
+    }
+  }
+  return total;
+}
+
+unsigned int UncertaintyBitMask::getNumberOfBlocks() const {
+  return (words.size() + WORDS_PER_BLOCK - 1) / WORDS_PER_BLOCK;
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef Uncertainty_Bit_Mask_h
+#define Uncertainty_Bit_Mask_h
+
+#include <vector>
+
+#include <mitkImage.h>
+#include <itkIntTypes.h>
+
+/**
+  * A binary mask (e.g. a thresholded uncertainty) packed one bit per voxel, in memory order (x fastest).
+  * 8x smaller than an unsigned char mask and 64x smaller than a double one, so it's cheap to keep around and
+  * hand to anything that only needs to know which voxels are in the mask.
+  * unpack() converts it back to an unsigned char image (with the original geometry) for display.
+  */
+class UncertaintyBitMask {
+  public:
+    UncertaintyBitMask();
+    void pack(mitk::Image::Pointer mask);
+    mitk::Image::Pointer unpack() const;
+    void clear();
+
+    bool isEmpty() const;
+    unsigned int getDimension(unsigned int i) const;
+    size_t getNumberOfVoxels() const;
+    size_t count() const;
+
+    /**
+      * Whether the voxel at offset (x + y * width + z * width * height) is in the mask.
+      */
+    bool contains(size_t voxel) const {
+      return (words[voxel / BITS_PER_WORD] >> (voxel % BITS_PER_WORD)) & 1;
+    }
+
+  private:
+    static const unsigned int BITS_PER_WORD = 64;
+    // Work is split into blocks of whole words so threads never share a word.
+    static const unsigned int WORDS_PER_BLOCK = 1024;
+
+    std::vector<itk::uint64_t> words;
+    unsigned int size[3];
+
+    // Geometry of the mask (so unpacking puts it back in the same place).
+    mitk::Point3D origin;
+    mitk::AffineTransform3D::Pointer transform;
+
+    unsigned int getNumberOfBlocks() const;
+
+    struct Packer;
+    struct Unpacker;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,225 @@
+#include "UncertaintyBrickIndex.h"
+
+#include "ParallelFor.h"
+
+#include <algorithm> // for min/max, sort, unique
+
+#include <mitkImageReadAccessor.h>
+
+UncertaintyBrickIndex::UncertaintyBrickIndex() {
+  for (unsigned int i = 0; i < 3; i++) {
+    size[i] = 0;
+    bricksAcross[i] = 0;
+  }
+}
+
+/**
+  * Hashes one brick (FNV-1a over the raw values, so it doesn't matter what type they are).
+  * Each item only writes its own hash so bricks can be hashed in parallel.
+  */
+struct UncertaintyBrickIndex::BrickHasher {
+  const unsigned char * data;
+  size_t bytesPerVoxel;
+  unsigned int size[3];
+  unsigned int bricksAcross[3];
+  std::vector<itk::uint64_t> * hashes;
+
+  void operator()(unsigned int brick, unsigned int /*threadID*/) {
+    unsigned int bx = brick % bricksAcross[0];
+    unsigned int by = (brick / bricksAcross[0]) % bricksAcross[1];
+    unsigned int bz = brick / (bricksAcross[0] * bricksAcross[1]);
+
+    unsigned int xEnd = std::min((bx + 1) * BRICK_SIZE, size[0]);
+    unsigned int yEnd = std::min((by + 1) * BRICK_SIZE, size[1]);
+    unsigned int zEnd = std::min((bz + 1) * BRICK_SIZE, size[2]);
+
+    itk::uint64_t hash = 14695981039346656037ULL;
+    for (unsigned int z = bz * BRICK_SIZE; z < zEnd; z++) {
+      for (unsigned int y = by * BRICK_SIZE; y < yEnd; y++) {
+        // Rows of a brick are contiguous in memory (x is fastest).
+        const unsigned char * bytes = data + (((size_t) z * size[1] + y) * size[0] + bx * BRICK_SIZE) * bytesPerVoxel;
+        size_t numberOfBytes = (xEnd - bx * BRICK_SIZE) * bytesPerVoxel;
+        for (size_t i = 0; i < numberOfBytes; i++) {
+          hash ^= bytes[i];
+          hash *= 1099511628211ULL;
+        }
+      }
+    }
+    (*hashes)[brick] = hash;
+  }
+};
+
+/**
+  * Hashes the bricks of (a new version of) the uncertainty and returns which bricks have changed since the last update
+  * (or were marked dirty). If there was no previous update, or the size has changed, every brick is dirty.
+  * Works on the raw bytes, so the uncertainty can be any type.
+  */
+std::vector<bool> UncertaintyBrickIndex::updateBricks(mitk::Image::Pointer uncertainty) {
+  unsigned int newSize[3];
+  bool sizeChanged = false;
+  for (unsigned int i = 0; i < 3; i++) {
+    newSize[i] = uncertainty->GetDimension(i);
+    sizeChanged = sizeChanged || (newSize[i] != size[i]);
+  }
+
+  // A new size means new bricks and the ray index is meaningless.
+  if (sizeChanged) {
+    for (unsigned int i = 0; i < 3; i++) {
+      size[i] = newSize[i];
+      bricksAcross[i] = (size[i] + BRICK_SIZE - 1) / BRICK_SIZE;
+    }
+    brickHashes.clear();
+    markedDirty.assign(getNumberOfBricks(), false);
+    rayBricks.clear();
+    brickRays.clear();
+  }
+
+  std::vector<itk::uint64_t> newHashes(getNumberOfBricks(), 0);
+  try {
+    mitk::ImageReadAccessor readAccess(uncertainty);
+
+    BrickHasher hasher;
+    hasher.data = static_cast<const unsigned char *>(readAccess.GetData());
+    hasher.bytesPerVoxel = uncertainty->GetPixelType().GetSize();
+    for (unsigned int i = 0; i < 3; i++) {
+      hasher.size[i] = size[i];
+      hasher.bricksAcross[i] = bricksAcross[i];
+    }
+    hasher.hashes = &newHashes;
+    ParallelFor::run(getNumberOfBricks(), hasher);
+  }
+  catch (mitk::Exception & e) {
+    std::cerr << "Hmmm... it appears we can't get read access to the uncertainty image." << e << std::endl;
+    std::cerr << "Treating every brick as dirty." << std::endl;
+    brickHashes.clear();
+    return std::vector<bool>(getNumberOfBricks(), true);
+  }
+
+  std::vector<bool> dirty(getNumberOfBricks(), true);
+  if (brickHashes.size() == newHashes.size()) {
+    for (unsigned int i = 0; i < dirty.size(); i++) {
+      dirty[i] = markedDirty[i] || (brickHashes[i] != newHashes[i]);
+    }
+  }
+
+  brickHashes = newHashes;
+  markedDirty.assign(getNumberOfBricks(), false);
+  return dirty;
+}
+
+/**
+  * Marks every brick overlapping region as dirty for the next update (whether or not its hash changes).
+  */
+void UncertaintyBrickIndex::markDirty(itk::ImageRegion<3> region) {
+  if (markedDirty.empty()) {
+    return;
+  }
+
+  unsigned int first[3], last[3];
+  for (unsigned int i = 0; i < 3; i++) {
+    if (region.GetSize()[i] == 0) {
+      return;
+    }
+    long start = std::max(0L, (long) region.GetIndex()[i]);
+    long end = std::min((long) size[i] - 1, (long) (region.GetIndex()[i] + region.GetSize()[i] - 1));
+    if (start > end) {
+      return;
+    }
+    first[i] = start / BRICK_SIZE;
+    last[i] = end / BRICK_SIZE;
+  }
+
+  for (unsigned int z = first[2]; z <= last[2]; z++) {
+    for (unsigned int y = first[1]; y <= last[1]; y++) {
+      for (unsigned int x = first[0]; x <= last[0]; x++) {
+        markedDirty[(z * bricksAcross[1] + y) * bricksAcross[0] + x] = true;
+      }
+    }
+  }
+}
+
+unsigned int UncertaintyBrickIndex::getNumberOfBricks() const {
+  return bricksAcross[0] * bricksAcross[1] * bricksAcross[2];
+}
+
+/**
+  * The brick containing voxel (x, y, z).
+  */
+unsigned int UncertaintyBrickIndex::brickContaining(unsigned int x, unsigned int y, unsigned int z) const {
+  return ((z / BRICK_SIZE) * bricksAcross[1] + (y / BRICK_SIZE)) * bricksAcross[0] + (x / BRICK_SIZE);
+}
+
+/**
+  * Clears the ray index ready to record numberOfRays rays.
+  */
+void UncertaintyBrickIndex::resetRays(unsigned int numberOfRays) {
+  rayBricks.assign(numberOfRays, std::vector<unsigned int>());
+  brickRays.clear();
+}
+
+/**
+  * Swaps ray indexes with another brick index (without copying them). The bricks themselves aren't swapped.
+  */
+void UncertaintyBrickIndex::swapRays(UncertaintyBrickIndex & other) {
+  rayBricks.swap(other.rayBricks);
+  brickRays.swap(other.brickRays);
+}
+
+/**
+  * Whether there's a ray index for numberOfRays rays (i.e. whether the last sampling can be updated incrementally).
+  */
+bool UncertaintyBrickIndex::hasRays(unsigned int numberOfRays) const {
+  return !brickHashes.empty() && rayBricks.size() == numberOfRays && brickRays.size() == getNumberOfBricks();
+}
+
+/**
+  * Records the bricks a ray read. Duplicates are removed.
+  * Different rays can be recorded from different threads at once (but not the same ray).
+  */
+void UncertaintyBrickIndex::setRayBricks(unsigned int ray, std::vector<unsigned int> & bricks) {
+  std::sort(bricks.begin(), bricks.end());
+  bricks.erase(std::unique(bricks.begin(), bricks.end()), bricks.end());
+  rayBricks[ray] = bricks;
+}
+
+/**
+  * The bricks a ray read.
+  */
+const std::vector<unsigned int> & UncertaintyBrickIndex::getRayBricks(unsigned int ray) const {
+  return rayBricks[ray];
+}
+
+/**
+  * Builds the list of rays through each brick. Call once all the rays have been recorded.
+  */
+void UncertaintyBrickIndex::finishRays() {
+  brickRays.assign(getNumberOfBricks(), std::vector<unsigned int>());
+  for (unsigned int ray = 0; ray < rayBricks.size(); ray++) {
+    for (unsigned int i = 0; i < rayBricks[ray].size(); i++) {
+      brickRays[rayBricks[ray][i]].push_back(ray);
+    }
+  }
+}
+
+/**
+  * The rays that read any of the dirty bricks, in order.
+  */
+std::vector<unsigned int> UncertaintyBrickIndex::findDirtyRays(const std::vector<bool> & dirtyBricks) const {
+  std::vector<bool> rayIsDirty(rayBricks.size(), false);
+  for (unsigned int brick = 0; brick < dirtyBricks.size() && brick < brickRays.size(); brick++) {
+    if (!dirtyBricks[brick]) {
+      continue;
+    }
+    for (unsigned int i = 0; i < brickRays[brick].size(); i++) {
+      rayIsDirty[brickRays[brick][i]] = true;
+    }
+  }
+
+  std::vector<unsigned int> dirtyRays;
+  for (unsigned int ray = 0; ray < rayIsDirty.size(); ray++) {
+    if (rayIsDirty[ray]) {
+      dirtyRays.push_back(ray);
+    }
+  }
+  return dirtyRays;
+}
\ No newline at end of file
@@ -0,0 +1,51 @@
+#ifndef Uncertainty_Brick_Index_h
+#define Uncertainty_Brick_Index_h
+
+#include <vector>
+
+#include <mitkImage.h>
+#include <itkImageRegion.h>
+#include <itkIntTypes.h>
+
+/**
+  * Splits the uncertainty into bricks (BRICK_SIZE voxels across) to work out what needs resampling when it changes.
+  *   Dirty Bricks - each brick is hashed, so updating with a new version of the uncertainty tells us which bricks changed.
+  *                  Regions can also be marked dirty explicitly (e.g. if something is known to have changed them).
+  *   Ray Index - which bricks each ray (a surface point, a texel...) read when it was sampled. Inverted into a list of
+  *               rays per brick so the rays crossing the dirty bricks can be found without looking at every ray.
+  */
+class UncertaintyBrickIndex {
+  public:
+    static const unsigned int BRICK_SIZE = 16;
+
+    UncertaintyBrickIndex();
+
+    // ---- Dirty Bricks ---- //
+    std::vector<bool> updateBricks(mitk::Image::Pointer uncertainty);
+    void markDirty(itk::ImageRegion<3> region);
+    unsigned int getNumberOfBricks() const;
+    unsigned int brickContaining(unsigned int x, unsigned int y, unsigned int z) const;
+
+    // ---- Ray Index ---- //
+    void resetRays(unsigned int numberOfRays);
+    void swapRays(UncertaintyBrickIndex & other);
+    bool hasRays(unsigned int numberOfRays) const;
+    void setRayBricks(unsigned int ray, std::vector<unsigned int> & bricks);
+    const std::vector<unsigned int> & getRayBricks(unsigned int ray) const;
+    void finishRays();
+    std::vector<unsigned int> findDirtyRays(const std::vector<bool> & dirtyBricks) const;
+
+  private:
+    unsigned int size[3];
+    unsigned int bricksAcross[3];
+
+    std::vector<itk::uint64_t> brickHashes;
+    std::vector<bool> markedDirty;
+
+    std::vector<std::vector<unsigned int> > rayBricks;
+    std::vector<std::vector<unsigned int> > brickRays;
+
+    struct BrickHasher;
+};
+
+#endif
\ No newline at end of file
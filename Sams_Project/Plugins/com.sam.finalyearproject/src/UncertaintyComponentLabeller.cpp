@@ -0,0 +1,281 @@
+#include "UncertaintyComponentLabeller.h"
+
+#include "ParallelFor.h"
+
+#include <algorithm> // for min/max
+#include <climits> // for UINT_MAX
+
+#include <mitkImageCast.h>
+#include <mitkImagePixelReadAccessor.h>
+#include <mitkImageAccessByItk.h>
+
+UncertaintyComponentLabeller::UncertaintyComponentLabeller() {
+  for (unsigned int i = 0; i < 3; i++) {
+    size[i] = 0;
+  }
+}
+
+/**
+  * Sets the uncertainty the mask was thresholded from (used to weight the centroids).
+  * NOTE: Assumes the uncertainty is double or float (as the samplers do).
+  */
+void UncertaintyComponentLabeller::setUncertainty(mitk::Image::Pointer uncertainty) {
+  this->uncertainty = uncertainty;
+}
+
+/**
+  * Sets the (unsigned char) mask to find the components of.
+  */
+void UncertaintyComponentLabeller::setMask(mitk::Image::Pointer mask) {
+  this->mask = mask;
+}
+
+/**
+  * Joins each voxel in a slab to the neighbours before it (in x, y and z) that are also in the mask.
+  * Only neighbours in the same slab are joined, so slabs never touch each other's voxels.
+  */
+struct UncertaintyComponentLabeller::SlabJoiner {
+  UncertaintyComponentLabeller * labeller;
+  const unsigned char * maskValues;
+
+  void operator()(unsigned int slab, unsigned int /*threadID*/) {
+    const unsigned int * size = labeller->size;
+    unsigned int sliceSize = size[0] * size[1];
+    unsigned int zStart = slab * SLAB_THICKNESS;
+    unsigned int zEnd = std::min(zStart + SLAB_THICKNESS, size[2]);
+
+    for (unsigned int z = zStart; z < zEnd; z++) {
+      for (unsigned int y = 0; y < size[1]; y++) {
+        unsigned int voxel = (z * size[1] + y) * size[0];
+        for (unsigned int x = 0; x < size[0]; x++, voxel++) {
+          if (!maskValues[voxel]) {
+            continue;
+          }
+          labeller->parents[voxel] = voxel;
+          if (x > 0 && maskValues[voxel - 1]) {
+            labeller->join(voxel, voxel - 1);
+          }
+          if (y > 0 && maskValues[voxel - size[0]]) {
+            labeller->join(voxel, voxel - size[0]);
+          }
+          if (z > zStart && maskValues[voxel - sliceSize]) {
+            labeller->join(voxel, voxel - sliceSize);
+          }
+        }
+      }
+    }
+  }
+};
+
+/**
+  * Finds the components of the mask.
+  */
+void UncertaintyComponentLabeller::labelComponents() {
+  components.clear();
+  labels = NULL;
+
+  for (unsigned int i = 0; i < 3; i++) {
+    size[i] = mask->GetDimension(i);
+  }
+  size_t numberOfVoxels = (size_t) size[0] * size[1] * size[2];
+  // Voxels are referred to by unsigned int offsets.
+  if (numberOfVoxels == 0 || numberOfVoxels >= UINT_MAX) {
+    std::cerr << "Hmmm... the mask is too big (or empty) to find the components of." << std::endl;
+    return;
+  }
+
+  // Labels go in an unsigned int image (with the same geometry as the mask).
+  typedef itk::Image<unsigned int, 3> LabelImageType;
+  LabelImageType::RegionType region;
+  LabelImageType::SizeType regionSize;
+  for (unsigned int i = 0; i < 3; i++) {
+    regionSize[i] = size[i];
+  }
+  region.SetSize(regionSize);
+  LabelImageType::Pointer labelImage = LabelImageType::New();
+  labelImage->SetRegions(region);
+  labelImage->Allocate();
+
+  try {
+    mitk::ImagePixelReadAccessor<unsigned char, 3> maskAccess(mask);
+
+    // Join up each slab, then the slabs.
+    parents.resize(numberOfVoxels);
+    SlabJoiner joiner;
+    joiner.labeller = this;
+    joiner.maskValues = maskAccess.GetData();
+    ParallelFor::run(getNumberOfSlabs(), joiner);
+    mergeSlabs(maskAccess.GetData());
+
+    AccessFixedTypeByItk_n(uncertainty, ItkNumberComponents, MITK_ACCESSBYITK_FLOATING_PIXEL_TYPES_SEQ, (3), (maskAccess.GetData(), labelImage->GetBufferPointer()));
+  }
+  catch (mitk::Exception & e) {
+    std::cerr << "Hmmm... it appears we can't get read access to the mask or uncertainty. Maybe they aren't unsigned char and double (or float)? (I've assumed they are)" << e << std::endl;
+    components.clear();
+    return;
+  }
+  std::vector<unsigned int>().swap(parents);
+
+  mitk::CastToMitkImage(labelImage, labels);
+  labels->GetGeometry()->SetOrigin(mask->GetGeometry()->GetOrigin());
+  labels->GetGeometry()->SetIndexToWorldTransform(mask->GetGeometry()->GetIndexToWorldTransform());
+
+  if (DEBUGGING) {
+    std::cout << "Found " << components.size() << " components" << std::endl;
+  }
+}
+
+/**
+  * The label of each voxel. 0 is outside the mask, components are numbered from 1.
+  */
+mitk::Image::Pointer UncertaintyComponentLabeller::getLabels() const {
+  return labels;
+}
+
+/**
+  * The components. Component i has label i + 1.
+  */
+const std::vector<UncertaintyComponentLabeller::Component> & UncertaintyComponentLabeller::getComponents() const {
+  return components;
+}
+
+/**
+  * The index (in getComponents()) of the component with the most voxels. Only valid if there are components.
+  */
+unsigned int UncertaintyComponentLabeller::getLargestComponent() const {
+  unsigned int largest = 0;
+  for (unsigned int i = 1; i < components.size(); i++) {
+    if (components[i].numberOfVoxels > components[largest].numberOfVoxels) {
+      largest = i;
+    }
+  }
+  return largest;
+}
+
+unsigned int UncertaintyComponentLabeller::getNumberOfSlabs() const {
+  return (size[2] + SLAB_THICKNESS - 1) / SLAB_THICKNESS;
+}
+
+/**
+  * The root of the component containing voxel. Halves the path on the way up to keep the trees flat.
+  */
+unsigned int UncertaintyComponentLabeller::findRoot(unsigned int voxel) {
+  while (parents[voxel] != voxel) {
+    parents[voxel] = parents[parents[voxel]];
+    voxel = parents[voxel];
+  }
+  return voxel;
+}
+
+/**
+  * Joins the components containing a and b. The root is always the voxel with the smallest offset.
+  */
+void UncertaintyComponentLabeller::join(unsigned int a, unsigned int b) {
+  unsigned int rootA = findRoot(a);
+  unsigned int rootB = findRoot(b);
+  if (rootA < rootB) {
+    parents[rootB] = rootA;
+  }
+  else if (rootB < rootA) {
+    parents[rootA] = rootB;
+  }
+}
+
+/**
+  * Joins the voxels on the first slice of each slab to those on the last slice of the slab before.
+  */
+void UncertaintyComponentLabeller::mergeSlabs(const unsigned char * maskValues) {
+  unsigned int sliceSize = size[0] * size[1];
+  for (unsigned int slab = 1; slab < getNumberOfSlabs(); slab++) {
+    unsigned int firstVoxel = slab * SLAB_THICKNESS * sliceSize;
+    for (unsigned int voxel = firstVoxel; voxel < firstVoxel + sliceSize; voxel++) {
+      if (maskValues[voxel] && maskValues[voxel - sliceSize]) {
+        join(voxel, voxel - sliceSize);
+      }
+    }
+  }
+}
+
+/**
+  * Numbers the components in memory order, writes the labels and measures each component.
+  * Roots are the first voxel of their component, and every voxel's parent comes before it, so by the time a voxel is
+  * reached its parent already points straight at the root (and the root has its label).
+  */
+template <typename TPixel>
+void UncertaintyComponentLabeller::numberComponents(const unsigned char * maskValues, const TPixel * values, unsigned int * labelValues) {
+  std::vector<double> weights;
+  std::vector<double> weightedSums;
+  std::vector<double> sums;
+  std::vector<unsigned int> mins;
+  std::vector<unsigned int> maxs;
+
+  unsigned int voxel = 0;
+  for (unsigned int z = 0; z < size[2]; z++) {
+    for (unsigned int y = 0; y < size[1]; y++) {
+      for (unsigned int x = 0; x < size[0]; x++, voxel++) {
+        if (!maskValues[voxel]) {
+          labelValues[voxel] = 0;
+          continue;
+        }
+
+        unsigned int parent = parents[voxel];
+        unsigned int root = (parent == voxel) ? voxel : parents[parent];
+        parents[voxel] = root;
+
+        unsigned int label;
+        if (root == voxel) {
+          Component component;
+          component.numberOfVoxels = 0;
+          components.push_back(component);
+          weights.push_back(0.0);
+          weightedSums.resize(weightedSums.size() + 3, 0.0);
+          sums.resize(sums.size() + 3, 0.0);
+          unsigned int position[3] = {x, y, z};
+          mins.insert(mins.end(), position, position + 3);
+          maxs.insert(maxs.end(), position, position + 3);
+          label = components.size();
+        }
+        else {
+          label = labelValues[root];
+        }
+        labelValues[voxel] = label;
+
+        // Measure it.
+        unsigned int i = label - 1;
+        unsigned int position[3] = {x, y, z};
+        double weight = std::max(0.0, 1.0 - values[voxel]);
+        components[i].numberOfVoxels++;
+        weights[i] += weight;
+        for (unsigned int axis = 0; axis < 3; axis++) {
+          weightedSums[i * 3 + axis] += weight * position[axis];
+          sums[i * 3 + axis] += position[axis];
+          mins[i * 3 + axis] = std::min(mins[i * 3 + axis], position[axis]);
+          maxs[i * 3 + axis] = std::max(maxs[i * 3 + axis], position[axis]);
+        }
+      }
+    }
+  }
+
+  for (unsigned int i = 0; i < components.size(); i++) {
+    itk::ImageRegion<3>::IndexType index;
+    itk::ImageRegion<3>::SizeType regionSize;
+    for (unsigned int axis = 0; axis < 3; axis++) {
+      index[axis] = mins[i * 3 + axis];
+      regionSize[axis] = maxs[i * 3 + axis] - mins[i * 3 + axis] + 1;
+      // If nothing in it is uncertain at all, just use the middle.
+      components[i].centroid[axis] = (weights[i] > 0.0) ?
+        weightedSums[i * 3 + axis] / weights[i] :
+        sums[i * 3 + axis] / components[i].numberOfVoxels;
+    }
+    components[i].boundingBox.SetIndex(index);
+    components[i].boundingBox.SetSize(regionSize);
+  }
+}
+
+/**
+  * Numbers the components, weighting the centroids by the (double or float) uncertainty.
+  */
+template <typename TPixel, unsigned int VImageDimension>
+void UncertaintyComponentLabeller::ItkNumberComponents(itk::Image<TPixel, VImageDimension>* itkImage, const unsigned char * maskValues, unsigned int * labelValues) {
+  numberComponents(maskValues, itkImage->GetBufferPointer(), labelValues);
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef Uncertainty_Component_Labeller_h
+#define Uncertainty_Component_Labeller_h
+
+#include <vector>
+
+#include <mitkImage.h>
+#include <mitkPoint.h>
+#include <itkImage.h>
+#include <itkImageRegion.h>
+#include <itkIntTypes.h>
+
+/**
+  * Finds the separate regions (6-connected components) of a thresholded uncertainty (the unsigned char mask from
+  * UncertaintyThresholder), so we can tell which blobs of high uncertainty there are, how big they are and where.
+  *
+  * Labelling is a block-parallel union-find: slabs of the volume are joined up in parallel, then the slabs are
+  * merged along their shared faces and the components numbered (1, 2, ...) in memory order.
+  */
+class UncertaintyComponentLabeller {
+  public:
+    /**
+      * A component. Voxel positions are indexes into the volume.
+      * The centroid is weighted by how uncertain each voxel is (lower values are worse, as with the thresholds).
+      */
+    struct Component {
+      itk::uint64_t numberOfVoxels;
+      itk::ImageRegion<3> boundingBox;
+      mitk::Point3D centroid;
+    };
+
+    UncertaintyComponentLabeller();
+    void setUncertainty(mitk::Image::Pointer uncertainty);
+    void setMask(mitk::Image::Pointer mask);
+    void labelComponents();
+
+    mitk::Image::Pointer getLabels() const;
+    const std::vector<Component> & getComponents() const;
+    unsigned int getLargestComponent() const;
+
+  private:
+    mitk::Image::Pointer uncertainty;
+    mitk::Image::Pointer mask;
+
+    unsigned int size[3];
+    std::vector<unsigned int> parents;
+
+    mitk::Image::Pointer labels;
+    std::vector<Component> components;
+
+    static const unsigned int SLAB_THICKNESS = 8;
+    static const bool DEBUGGING = false;
+
+    unsigned int getNumberOfSlabs() const;
+    unsigned int findRoot(unsigned int voxel);
+    void join(unsigned int a, unsigned int b);
+    void mergeSlabs(const unsigned char * maskValues);
+    template <typename TPixel>
+    void numberComponents(const unsigned char * maskValues, const TPixel * values, unsigned int * labelValues);
+
+    struct SlabJoiner;
+
+    // ITK Methods
+    template <typename TPixel, unsigned int VImageDimension>
+    void ItkNumberComponents(itk::Image<TPixel, VImageDimension>* itkImage, const unsigned char * maskValues, unsigned int * labelValues);
+};
+
+#endif
\ No newline at end of file
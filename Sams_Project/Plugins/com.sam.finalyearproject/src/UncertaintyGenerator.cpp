@@ -1,18 +1,20 @@
 #include "UncertaintyGenerator.h"
-#include "Util.h"
-#include <mitkImageCast.h>
+#include "ParallelFor.h"
+
+#include <algorithm> // for max, fill
+#include <cmath> // for sqrt
+#include <cstdlib> // for rand
+#include <random> // for mt19937
+
+#include <mitkITKImageImport.h>
 
 // Loading bar
 #include <mitkProgressBar.h>
 
 /**
-  * Generates uncertainty data (height * width * depth).
-  * Each voxel is a random uncertainty value between 0 and 255.
+  * Creates a blank ITK image (imageSize[0] * imageSize[1] * imageSize[2]) to fill.
   */
-mitk::Image::Pointer UncertaintyGenerator::generateRandomUncertainty(vtkVector<float, 3> imageSize) {
-  mitk::ProgressBar::GetInstance()->AddStepsToDo(1);
-  
-  // Create a blank ITK image.
+UncertaintyImageType::Pointer UncertaintyGenerator::allocateUncertainty(vtkVector<float, 3> imageSize) {
   UncertaintyImageType::RegionType region;
   UncertaintyImageType::IndexType start;
   start[0] = 0;
@@ -27,55 +29,89 @@ mitk::Image::Pointer UncertaintyGenerator::generateRandomUncertainty(vtkVector<f
   region.SetSize(uncertaintySize);
   region.SetIndex(start);
 
-  UncertaintyImageType::Pointer randomUncertainty = UncertaintyImageType::New();
-  randomUncertainty->SetRegions(region);
-  randomUncertainty->Allocate();
-
-  // Go through each voxel and set a random value.
-  for (unsigned int r = 0; r < imageSize[0]; r++) {
-    for (unsigned int c = 0; c < imageSize[1]; c++) {
-      for (unsigned int d = 0; d < imageSize[2]; d++) {
-        UncertaintyImageType::IndexType pixelIndex;
-        pixelIndex[0] = r;
-        pixelIndex[1] = c;
-        pixelIndex[2] = d;
+  UncertaintyImageType::Pointer uncertainty = UncertaintyImageType::New();
+  uncertainty->SetRegions(region);
+  uncertainty->Allocate();
+  return uncertainty;
+}
 
-        randomUncertainty->SetPixel(pixelIndex, rand() % 256);
-      }
+/**
+  * Fills a z slice with random values. Each slice has its own generator, seeded from the slice, so the threads don't
+  * share any state and the result doesn't depend on which thread did which slice.
+  */
+struct UncertaintyGenerator::RandomFiller {
+  unsigned char * values;
+  size_t sliceSize;
+  unsigned long seed;
+
+  void operator()(unsigned int slice, unsigned int /*threadID*/) {
+    std::mt19937 generator(seed + slice);
+    unsigned char * sliceValues = values + slice * sliceSize;
+
+    // Four voxels from each 32 random bits.
+    size_t i = 0;
+    for (; i + 4 <= sliceSize; i += 4) {
+      unsigned long bits = generator();
+      sliceValues[i] = bits & 0xFF;
+      sliceValues[i + 1] = (bits >> 8) & 0xFF;
+      sliceValues[i + 2] = (bits >> 16) & 0xFF;
+      sliceValues[i + 3] = (bits >> 24) & 0xFF;
+    }
+    for (; i < sliceSize; i++) {
+      sliceValues[i] = generator() & 0xFF;
     }
   }
+};
+
+/**
+  * Generates uncertainty data (height * width * depth).
+  * Each voxel is a random uncertainty value between 0 and 255.
+  */
+mitk::Image::Pointer UncertaintyGenerator::generateRandomUncertainty(vtkVector<float, 3> imageSize) {
+  mitk::ProgressBar::GetInstance()->AddStepsToDo(1);
+  UncertaintyImageType::Pointer randomUncertainty = allocateUncertainty(imageSize);
+
+  // Go through each voxel and set a random value. (still seeded from rand(), so srand() controls it)
+  RandomFiller filler;
+  filler.values = randomUncertainty->GetBufferPointer();
+  filler.sliceSize = (size_t) imageSize[0] * (size_t) imageSize[1];
+  filler.seed = rand();
+  ParallelFor::run(imageSize[2], filler);
 
   // Convert from ITK to MITK.
-  mitk::Image::Pointer result;
-  mitk::CastToMitkImage(randomUncertainty, result);
+  mitk::Image::Pointer result = mitk::GrabItkImageMemory(randomUncertainty.GetPointer());
   mitk::ProgressBar::GetInstance()->Progress();
   return result;
 }
 
+/**
+  * Fills a z slice, a row at a time: rows through the cube are inside it between the start and end columns.
+  */
+struct UncertaintyGenerator::CubeFiller {
+  unsigned char * values;
+  unsigned int size[3];
+  unsigned int start[3];
+  unsigned int end[3];
+
+  void operator()(unsigned int d, unsigned int /*threadID*/) {
+    unsigned char * row = values + (size_t) d * size[0] * size[1];
+    bool sliceInCube = (start[2] <= d) && (d <= end[2]);
+    for (unsigned int c = 0; c < size[1]; c++, row += size[0]) {
+      std::fill(row, row + size[0], 255);
+      if (sliceInCube && (start[1] <= c) && (c <= end[1]) && start[0] <= end[0] && start[0] < size[0]) {
+        std::fill(row + start[0], row + std::min(end[0] + 1, size[0]), 1);
+      }
+    }
+  }
+};
+
 /**
   * Generates uncertainty data (height * width * depth).
   * The cube, placed at the center with side length cubeSize, is totally uncertain (1) and everywhere else is completely certain (255).
   */
 mitk::Image::Pointer UncertaintyGenerator::generateCubeUncertainty(vtkVector<float, 3> imageSize, unsigned int cubeSize) {
   mitk::ProgressBar::GetInstance()->AddStepsToDo(1);
-  // Create a blank ITK image.
-  UncertaintyImageType::RegionType region;
-  UncertaintyImageType::IndexType start;
-  start[0] = 0;
-  start[1] = 0;
-  start[2] = 0;
- 
-  UncertaintyImageType::SizeType uncertaintySize;
-  uncertaintySize[0] = imageSize[0];
-  uncertaintySize[1] = imageSize[1];
-  uncertaintySize[2] = imageSize[2];
- 
-  region.SetSize(uncertaintySize);
-  region.SetIndex(start);
-
-  UncertaintyImageType::Pointer cubeUncertainty = UncertaintyImageType::New();
-  cubeUncertainty->SetRegions(region);
-  cubeUncertainty->Allocate();
+  UncertaintyImageType::Pointer cubeUncertainty = allocateUncertainty(imageSize);
 
   // Compute the cube center point.
   float cubeCenter0 = (imageSize[0] - 1) / 2.0f;
@@ -84,68 +120,64 @@ mitk::Image::Pointer UncertaintyGenerator::generateCubeUncertainty(vtkVector<flo
 
   // Work out which columns/rows/depths the cube is in.
   float halfCube = cubeSize / 2.0f;
-  unsigned int cubeRowStart = cubeCenter0 - halfCube;
-  unsigned int cubeRowEnd = cubeCenter0 + halfCube;
-  unsigned int cubeColStart = cubeCenter1 - halfCube;
-  unsigned int cubeColEnd = cubeCenter1 + halfCube;
-  unsigned int cubeDepthStart = cubeCenter2 - halfCube;
-  unsigned int cubeDepthEnd = cubeCenter2 + halfCube;
+  CubeFiller filler;
+  filler.start[0] = cubeCenter0 - halfCube;
+  filler.end[0] = cubeCenter0 + halfCube;
+  filler.start[1] = cubeCenter1 - halfCube;
+  filler.end[1] = cubeCenter1 + halfCube;
+  filler.start[2] = cubeCenter2 - halfCube;
+  filler.end[2] = cubeCenter2 + halfCube;
 
   // Go through each voxel and set uncertainty according to whether it's in the cube.
-  for (unsigned int r = 0; r < imageSize[0]; r++) {
-    for (unsigned int c = 0; c < imageSize[1]; c++) {
-      for (unsigned int d = 0; d < imageSize[2]; d++) {
-        UncertaintyImageType::IndexType pixelIndex;
-        pixelIndex[0] = r;
-        pixelIndex[1] = c;
-        pixelIndex[2] = d;
-
-        // If this pixel is in the cube.
-        if ((cubeRowStart <= r) && (r <= cubeRowEnd) &&
-            (cubeColStart <= c) && (c <= cubeColEnd) &&
-            (cubeDepthStart <= d) && (d <= cubeDepthEnd)) {
-          cubeUncertainty->SetPixel(pixelIndex, 1);
-        }
-        // If it's not.
-        else {
-          cubeUncertainty->SetPixel(pixelIndex, 255);
-        }
-      }
-    }
+  filler.values = cubeUncertainty->GetBufferPointer();
+  for (unsigned int i = 0; i < 3; i++) {
+    filler.size[i] = imageSize[i];
   }
+  ParallelFor::run(filler.size[2], filler);
 
   // Convert from ITK to MITK.
-  mitk::Image::Pointer result;
-  mitk::CastToMitkImage(cubeUncertainty, result);
+  mitk::Image::Pointer result = mitk::GrabItkImageMemory(cubeUncertainty.GetPointer());
   mitk::ProgressBar::GetInstance()->Progress();
   return result;
 }
 
+/**
+  * Fills a z slice with the uncertainty of the sphere. Only the x part of the distance changes along a row.
+  */
+struct UncertaintyGenerator::SphereFiller {
+  unsigned char * values;
+  unsigned int size[3];
+  float center[3];
+  float radius;
+
+  void operator()(unsigned int d, unsigned int /*threadID*/) {
+    unsigned char * out = values + (size_t) d * size[0] * size[1];
+    float dz = d - center[2];
+    for (unsigned int c = 0; c < size[1]; c++) {
+      float dy = c - center[1];
+      for (unsigned int r = 0; r < size[0]; r++, out++) {
+        float dx = r - center[0];
+
+        // Compute distance from center.
+        float distanceFromCenter = std::sqrt((double) (dx * dx + dy * dy + dz * dz));
+
+        // Get normalized 0-1 weighting.
+        float uncertaintyValue = 1 - std::max(0.0f, (radius - distanceFromCenter) / radius);
+
+        // Scale by 255. Don't allow 0 (undefined uncertainty).
+        *out = uncertaintyValue * 255;
+      }
+    }
+  }
+};
+
 /**
   * Generates uncertainty data (imageSize[0] * imageSize[1] * imageSize[2]).
   * It's zero everywhere, apart from a sphere of radius sphereRadius that has uncertainty 255 at the center and fades linearly to the edges.
   */
 mitk::Image::Pointer UncertaintyGenerator::generateSphereUncertainty(vtkVector<float, 3> imageSize, unsigned int sphereRadius, vtkVector<float, 3> sphereCenter) {
   mitk::ProgressBar::GetInstance()->AddStepsToDo(1);
-
-  // Create a blank ITK image.
-  UncertaintyImageType::RegionType region;
-  UncertaintyImageType::IndexType start;
-  start[0] = 0;
-  start[1] = 0;
-  start[2] = 0;
- 
-  UncertaintyImageType::SizeType uncertaintySize;
-  uncertaintySize[0] = imageSize[0];
-  uncertaintySize[1] = imageSize[1];
-  uncertaintySize[2] = imageSize[2];
- 
-  region.SetSize(uncertaintySize);
-  region.SetIndex(start);
-
-  UncertaintyImageType::Pointer sphereUncertainty = UncertaintyImageType::New();
-  sphereUncertainty->SetRegions(region);
-  sphereUncertainty->Allocate();
+  UncertaintyImageType::Pointer sphereUncertainty = allocateUncertainty(imageSize);
 
   // If the center is not specified (-1) in any dimension, make it the center.
   for (unsigned int i = 0; i < 3; i++) {
@@ -155,35 +187,17 @@ mitk::Image::Pointer UncertaintyGenerator::generateSphereUncertainty(vtkVector<f
   }
 
   // Go through each voxel and weight uncertainty by distance from center of sphere.
-  for (unsigned int r = 0; r < imageSize[0]; r++) {
-    for (unsigned int c = 0; c < imageSize[1]; c++) {
-      for (unsigned int d = 0; d < imageSize[2]; d++) {
-        UncertaintyImageType::IndexType pixelIndex;
-        pixelIndex[0] = r;
-        pixelIndex[1] = c;
-        pixelIndex[2] = d;
-
-        vtkVector<float, 3> position = vtkVector<float, 3>();
-        position[0] = r;
-        position[1] = c;
-        position[2] = d;
-
-        // Compute distance from center.
-        vtkVector<float, 3> difference = Util::vectorSubtract(position, sphereCenter);
-        float distanceFromCenter = difference.Norm();
-
-        // Get normalized 0-1 weighting.
-        float uncertaintyValue = 1 - std::max(0.0f, ((float) sphereRadius - distanceFromCenter) / (float) sphereRadius);
-
-        // Scale by 255. Don't allow 0 (undefined uncertainty).
-        sphereUncertainty->SetPixel(pixelIndex, uncertaintyValue * 255);
-      }
-    }
+  SphereFiller filler;
+  filler.values = sphereUncertainty->GetBufferPointer();
+  for (unsigned int i = 0; i < 3; i++) {
+    filler.size[i] = imageSize[i];
+    filler.center[i] = sphereCenter[i];
   }
+  filler.radius = sphereRadius;
+  ParallelFor::run(filler.size[2], filler);
 
   // Convert from ITK to MITK.
-  mitk::Image::Pointer result;
-  mitk::CastToMitkImage(sphereUncertainty, result);
+  mitk::Image::Pointer result = mitk::GrabItkImageMemory(sphereUncertainty.GetPointer());
   mitk::ProgressBar::GetInstance()->Progress();
   return result;
 }
\ No newline at end of file
@@ -7,11 +7,22 @@
 
 typedef itk::Image<unsigned char, 3>  UncertaintyImageType;
 
+/**
+  * Generates demo uncertainties. The voxels are filled straight into the buffer in memory order (x fastest), a z slice
+  * per work item across all the threads.
+  */
 class UncertaintyGenerator {
   public:
     static mitk::Image::Pointer generateRandomUncertainty(vtkVector<float, 3> imageSize);
     static mitk::Image::Pointer generateCubeUncertainty(vtkVector<float, 3> imageSize, unsigned int cubeSize);
     static mitk::Image::Pointer generateSphereUncertainty(vtkVector<float, 3> imageSize, unsigned int sphereRadius, vtkVector<float, 3> sphereCenter = vtkVector<float, 3>(-1.0f));
+
+  private:
+    static UncertaintyImageType::Pointer allocateUncertainty(vtkVector<float, 3> imageSize);
+
+    struct RandomFiller;
+    struct CubeFiller;
+    struct SphereFiller;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,310 @@
+#include "UncertaintyIsoSurfaceGenerator.h"
+
+#include "ParallelFor.h"
+
+#include <algorithm> // for min/max, copy
+#include <cfloat> // for DBL_MAX
+
+#include <vtkImageData.h>
+#include <vtkMarchingCubes.h>
+#include <vtkAppendPolyData.h>
+#include <vtkCleanPolyData.h>
+#include <vtkPolyDataNormals.h>
+
+#include <mitkImageAccessByItk.h>
+
+UncertaintyIsoSurfaceGenerator::UncertaintyIsoSurfaceGenerator() {
+  this->uncertaintyMTime = 0;
+  this->haveSurfaces = false;
+  this->surfaceMin = 0.0;
+  this->surfaceMax = 0.0;
+  for (unsigned int i = 0; i < 3; i++) {
+    size[i] = 0;
+    bricksAcross[i] = 0;
+  }
+}
+
+/**
+  * Sets the uncertainty the mask was thresholded from. Its values tell us which bricks a threshold can affect.
+  * NOTE: Assumes the uncertainty is double or float (as the samplers do).
+  */
+void UncertaintyIsoSurfaceGenerator::setUncertainty(mitk::Image::Pointer uncertainty) {
+  if (this->uncertainty == uncertainty && uncertainty->GetMTime() == uncertaintyMTime) {
+    return;
+  }
+  this->uncertainty = uncertainty;
+  this->uncertaintyMTime = uncertainty->GetMTime();
+  updateMacrocells();
+  haveSurfaces = false;
+}
+
+/**
+  * Sets the (unsigned char) mask to extract the surface of.
+  * The mask may be updated in place between calls to generateSurface, or swapped for another of the same size (e.g. when
+  * the thresholder is double buffered), as long as it's thresholded from the same uncertainty.
+  */
+void UncertaintyIsoSurfaceGenerator::setMask(mitk::Image::Pointer mask) {
+  if (this->mask.IsNull() || mask.IsNull() || this->mask->GetDimension(0) != mask->GetDimension(0) ||
+      this->mask->GetDimension(1) != mask->GetDimension(1) || this->mask->GetDimension(2) != mask->GetDimension(2)) {
+    haveSurfaces = false;
+  }
+  this->mask = mask;
+}
+
+/**
+  * Finds the range of values in each brick.
+  */
+template <typename TPixel>
+struct UncertaintyIsoSurfaceGenerator::MacrocellFinder {
+  const UncertaintyIsoSurfaceGenerator * generator;
+  const TPixel * values;
+  std::vector<double> * brickMins;
+  std::vector<double> * brickMaxs;
+
+  void operator()(unsigned int brick, unsigned int /*threadID*/) {
+    unsigned int start[3], end[3];
+    generator->brickExtent(brick, start, end);
+    const unsigned int * size = generator->size;
+
+    TPixel min = values[((size_t) start[2] * size[1] + start[1]) * size[0] + start[0]];
+    TPixel max = min;
+    for (unsigned int z = start[2]; z <= end[2]; z++) {
+      for (unsigned int y = start[1]; y <= end[1]; y++) {
+        const TPixel * row = values + ((size_t) z * size[1] + y) * size[0];
+        for (unsigned int x = start[0]; x <= end[0]; x++) {
+          min = std::min(min, row[x]);
+          max = std::max(max, row[x]);
+        }
+      }
+    }
+    (*brickMins)[brick] = min;
+    (*brickMaxs)[brick] = max;
+  }
+};
+
+/**
+  * Runs marching cubes on a brick of the mask. The filters are created beforehand (on the calling thread),
+  * each brick only touches its own. Normals are left until the bricks are joined (see generateSurface).
+  */
+struct UncertaintyIsoSurfaceGenerator::BrickExtractor {
+  const UncertaintyIsoSurfaceGenerator * generator;
+  const unsigned char * mask;
+  std::vector<unsigned int> bricks;
+  std::vector<vtkSmartPointer<vtkImageData> > images;
+  std::vector<vtkSmartPointer<vtkMarchingCubes> > marchingCubes;
+
+  void operator()(unsigned int item, unsigned int /*threadID*/) {
+    unsigned int start[3], end[3];
+    generator->brickExtent(bricks[item], start, end);
+    const unsigned int * size = generator->size;
+
+    // Copy the brick out of the mask.
+    unsigned char * brickValues = static_cast<unsigned char *>(images[item]->GetScalarPointer());
+    unsigned int rowLength = end[0] - start[0] + 1;
+    for (unsigned int z = start[2]; z <= end[2]; z++) {
+      for (unsigned int y = start[1]; y <= end[1]; y++) {
+        const unsigned char * row = mask + ((size_t) z * size[1] + y) * size[0] + start[0];
+        std::copy(row, row + rowLength, brickValues);
+        brickValues += rowLength;
+      }
+    }
+
+    marchingCubes[item]->Update();
+  }
+};
+
+/**
+  * Extracts the surface of the mask, which must have been thresholded (from the uncertainty) with the range [min, max].
+  * The same mitk::Surface is returned each time (with new poly data).
+  */
+mitk::Surface::Pointer UncertaintyIsoSurfaceGenerator::generateSurface(double min, double max) {
+  if (surface.IsNull()) {
+    surface = mitk::Surface::New();
+  }
+
+  // Work out which bricks need (re)extracting.
+  std::vector<unsigned int> bricksToExtract;
+  unsigned int bricksSkipped = 0;
+  if (!haveSurfaces) {
+    brickSurfaces.assign(getNumberOfBricks(), vtkSmartPointer<vtkPolyData>());
+  }
+  for (unsigned int brick = 0; brick < getNumberOfBricks(); brick++) {
+    if (haveSurfaces && !brickMightChange(brick, min, max)) {
+      continue;
+    }
+    if (brickIsUniform(brick, min, max)) {
+      brickSurfaces[brick] = vtkSmartPointer<vtkPolyData>();
+      bricksSkipped++;
+      continue;
+    }
+    bricksToExtract.push_back(brick);
+  }
+
+  if (DEBUGGING) {
+    std::cout << "Extracting " << bricksToExtract.size() << " of " << getNumberOfBricks() << " bricks (" <<
+                 bricksSkipped << " empty)" << std::endl;
+  }
+
+  try {
+    mitk::ImagePixelReadAccessor<unsigned char, 3> readAccess(mask);
+
+    // Set up the filters for each brick.
+    BrickExtractor extractor;
+    extractor.generator = this;
+    extractor.mask = readAccess.GetData();
+    extractor.bricks = bricksToExtract;
+    for (unsigned int i = 0; i < bricksToExtract.size(); i++) {
+      unsigned int start[3], end[3];
+      brickExtent(bricksToExtract[i], start, end);
+
+      // Voxels are placed at their index, the surface's geometry takes them to world coordinates.
+      vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
+      image->SetExtent(start[0], end[0], start[1], end[1], start[2], end[2]);
+      image->SetOrigin(0, 0, 0);
+      image->SetSpacing(1, 1, 1);
+      image->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
+
+      vtkSmartPointer<vtkMarchingCubes> marchingCubes = vtkSmartPointer<vtkMarchingCubes>::New();
+      marchingCubes->SetInputData(image);
+      marchingCubes->SetValue(0, 0.5);
+      // The gradient is one sided at the faces of a brick, so the normals are computed once the bricks are joined.
+      marchingCubes->ComputeNormalsOff();
+      marchingCubes->ComputeGradientsOff();
+      marchingCubes->ComputeScalarsOff();
+
+      extractor.images.push_back(image);
+      extractor.marchingCubes.push_back(marchingCubes);
+    }
+
+    ParallelFor::run(bricksToExtract.size(), extractor);
+
+    for (unsigned int i = 0; i < bricksToExtract.size(); i++) {
+      vtkSmartPointer<vtkPolyData> brickSurface = extractor.marchingCubes[i]->GetOutput();
+      if (brickSurface->GetNumberOfCells() == 0) {
+        brickSurface = vtkSmartPointer<vtkPolyData>();
+      }
+      brickSurfaces[bricksToExtract[i]] = brickSurface;
+    }
+  }
+  catch (mitk::Exception & e) {
+    std::cerr << "Hmmm... it appears we can't get read access to the mask. Maybe it's type isn't unsigned char? (I've assumed it is)" << e << std::endl;
+    haveSurfaces = false;
+    return surface;
+  }
+
+  haveSurfaces = true;
+  surfaceMin = min;
+  surfaceMax = max;
+
+  // Join the bricks together. Neighbouring bricks both have the vertices on the face between them (at exactly the same
+  // place), so merge them, then compute the normals over the whole mesh so they're smooth across the seams.
+  vtkSmartPointer<vtkAppendPolyData> append = vtkSmartPointer<vtkAppendPolyData>::New();
+  for (unsigned int brick = 0; brick < brickSurfaces.size(); brick++) {
+    if (brickSurfaces[brick].GetPointer() != NULL) {
+      append->AddInputData(brickSurfaces[brick]);
+    }
+  }
+  vtkSmartPointer<vtkPolyData> polyData = vtkSmartPointer<vtkPolyData>::New();
+  if (append->GetNumberOfInputConnections(0) > 0) {
+    vtkSmartPointer<vtkCleanPolyData> clean = vtkSmartPointer<vtkCleanPolyData>::New();
+    clean->SetInputConnection(append->GetOutputPort());
+    clean->PointMergingOn();
+    clean->SetTolerance(0.0);
+
+    vtkSmartPointer<vtkPolyDataNormals> normals = vtkSmartPointer<vtkPolyDataNormals>::New();
+    normals->SetInputConnection(clean->GetOutputPort());
+    normals->ComputePointNormalsOn();
+    normals->ComputeCellNormalsOff();
+    // Don't split at sharp edges (every voxel step would be one).
+    normals->SplittingOff();
+    normals->ConsistencyOn();
+    normals->Update();
+    polyData = normals->GetOutput();
+  }
+  surface->SetVtkPolyData(polyData);
+
+  // Put it in the same place as the mask.
+  mitk::BaseGeometry * maskGeometry = mask->GetGeometry();
+  surface->GetGeometry()->SetOrigin(maskGeometry->GetOrigin());
+  surface->GetGeometry()->SetIndexToWorldTransform(maskGeometry->GetIndexToWorldTransform());
+
+  return surface;
+}
+
+unsigned int UncertaintyIsoSurfaceGenerator::getNumberOfBricks() const {
+  return bricksAcross[0] * bricksAcross[1] * bricksAcross[2];
+}
+
+/**
+  * The voxels (inclusive) of a brick. Bricks overlap by one voxel so every cell between voxels is in a brick.
+  */
+void UncertaintyIsoSurfaceGenerator::brickExtent(unsigned int brick, unsigned int start[3], unsigned int end[3]) const {
+  unsigned int brickIndex[3];
+  brickIndex[0] = brick % bricksAcross[0];
+  brickIndex[1] = (brick / bricksAcross[0]) % bricksAcross[1];
+  brickIndex[2] = brick / (bricksAcross[0] * bricksAcross[1]);
+  for (unsigned int i = 0; i < 3; i++) {
+    start[i] = brickIndex[i] * BRICK_SIZE;
+    end[i] = std::min((brickIndex[i] + 1) * BRICK_SIZE, size[i] - 1);
+  }
+}
+
+/**
+  * Splits the uncertainty into bricks and finds the range of values in each.
+  */
+void UncertaintyIsoSurfaceGenerator::updateMacrocells() {
+  for (unsigned int i = 0; i < 3; i++) {
+    size[i] = uncertainty->GetDimension(i);
+    // Bricks cover the cells, of which there's one fewer than voxels.
+    bricksAcross[i] = (size[i] > 1) ? (size[i] - 2) / BRICK_SIZE + 1 : 0;
+  }
+  brickMins.assign(getNumberOfBricks(), 0.0);
+  brickMaxs.assign(getNumberOfBricks(), 0.0);
+  brickSurfaces.clear();
+
+  try {
+    AccessFixedTypeByItk(uncertainty, ItkFindMacrocells, MITK_ACCESSBYITK_FLOATING_PIXEL_TYPES_SEQ, (3));
+  }
+  catch (mitk::Exception & e) {
+    std::cerr << "Hmmm... it appears we can't get read access to the uncertainty image. Maybe it's type isn't double or float? (I've assumed it is)" << e << std::endl;
+    // Nothing can be skipped.
+    brickMins.assign(getNumberOfBricks(), -DBL_MAX);
+    brickMaxs.assign(getNumberOfBricks(), DBL_MAX);
+  }
+}
+
+/**
+  * Whether any voxel in the brick can be in a different side of [min, max] than the last extracted range.
+  * Only values between the old and new lower cuts, or the old and new upper cuts, can have changed sides.
+  */
+bool UncertaintyIsoSurfaceGenerator::brickMightChange(unsigned int brick, double min, double max) const {
+  double lowerFrom = std::min(min, surfaceMin);
+  double lowerTo = std::max(min, surfaceMin);
+  double upperFrom = std::min(max, surfaceMax);
+  double upperTo = std::max(max, surfaceMax);
+  bool overlapsLower = (lowerFrom != lowerTo) && brickMaxs[brick] >= lowerFrom && brickMins[brick] <= lowerTo;
+  bool overlapsUpper = (upperFrom != upperTo) && brickMaxs[brick] >= upperFrom && brickMins[brick] <= upperTo;
+  return overlapsLower || overlapsUpper;
+}
+
+/**
+  * Whether every voxel in the brick is on the same side of [min, max] (so there's no surface in it).
+  */
+bool UncertaintyIsoSurfaceGenerator::brickIsUniform(unsigned int brick, double min, double max) const {
+  bool allInside = brickMins[brick] >= min && brickMaxs[brick] <= max;
+  bool allOutside = brickMaxs[brick] < min || brickMins[brick] > max;
+  return allInside || allOutside;
+}
+
+/**
+  * Finds the range of values in each brick of the (double or float) uncertainty.
+  */
+template <typename TPixel, unsigned int VImageDimension>
+void UncertaintyIsoSurfaceGenerator::ItkFindMacrocells(itk::Image<TPixel, VImageDimension>* itkImage) {
+  MacrocellFinder<TPixel> finder;
+  finder.generator = this;
+  finder.values = itkImage->GetBufferPointer();
+  finder.brickMins = &brickMins;
+  finder.brickMaxs = &brickMaxs;
+  ParallelFor::run(getNumberOfBricks(), finder);
+}
\ No newline at end of file
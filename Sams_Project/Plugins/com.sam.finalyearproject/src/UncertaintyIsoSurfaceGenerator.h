@@ -0,0 +1,68 @@
+#ifndef Uncertainty_Iso_Surface_Generator_h
+#define Uncertainty_Iso_Surface_Generator_h
+
+#include <vector>
+
+#include <mitkImage.h>
+#include <itkImage.h>
+#include <mitkSurface.h>
+#include <vtkSmartPointer.h>
+#include <vtkPolyData.h>
+
+/**
+  * Extracts the surface of a thresholded uncertainty (the unsigned char mask from UncertaintyThresholder) as a triangle
+  * mesh, so it can be shown without volume rendering the whole mask.
+  *
+  * The volume is split into bricks (BRICK_SIZE voxels across) and marching cubes is run on the bricks in parallel.
+  * The range of uncertainty values in each brick (its macrocell) is kept, so:
+  *   - bricks entirely inside or outside the threshold have no surface and are skipped.
+  *   - when the threshold moves, only bricks with values between the old and new cuts are re-extracted.
+  * The bricks are joined into one mesh (with the vertices they share merged) and the normals are computed on that,
+  * so there are no seams between them.
+  */
+class UncertaintyIsoSurfaceGenerator {
+  public:
+    static const unsigned int BRICK_SIZE = 32;
+
+    UncertaintyIsoSurfaceGenerator();
+    void setUncertainty(mitk::Image::Pointer uncertainty);
+    void setMask(mitk::Image::Pointer mask);
+    mitk::Surface::Pointer generateSurface(double min, double max);
+
+  private:
+    mitk::Image::Pointer uncertainty;
+    unsigned long uncertaintyMTime;
+    mitk::Image::Pointer mask;
+
+    // Bricks
+    unsigned int size[3];
+    unsigned int bricksAcross[3];
+    std::vector<double> brickMins;
+    std::vector<double> brickMaxs;
+    std::vector<vtkSmartPointer<vtkPolyData> > brickSurfaces;
+
+    // The range the brick surfaces were extracted for.
+    bool haveSurfaces;
+    double surfaceMin;
+    double surfaceMax;
+
+    mitk::Surface::Pointer surface;
+
+    static const bool DEBUGGING = false;
+
+    unsigned int getNumberOfBricks() const;
+    void brickExtent(unsigned int brick, unsigned int start[3], unsigned int end[3]) const;
+    void updateMacrocells();
+    bool brickMightChange(unsigned int brick, double min, double max) const;
+    bool brickIsUniform(unsigned int brick, double min, double max) const;
+
+    template <typename TPixel>
+    struct MacrocellFinder;
+    struct BrickExtractor;
+
+    // ITK Methods
+    template <typename TPixel, unsigned int VImageDimension>
+    void ItkFindMacrocells(itk::Image<TPixel, VImageDimension>* itkImage);
+};
+
+#endif
\ No newline at end of file
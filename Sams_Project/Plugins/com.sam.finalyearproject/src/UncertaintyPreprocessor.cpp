@@ -2,29 +2,36 @@
 
 #include <mitkImageAccessByItk.h>
 #include <mitkImageCast.h>
+#include <mitkITKImageImport.h>
+#include <mitkSmartPointerProperty.h>
+#include <mitkImagePixelWriteAccessor.h>
 
-// Normalize
-#include <itkRescaleIntensityImageFilter.h>
-#include <itkIntensityWindowingImageFilter.h>
+#include <algorithm> // for find
+#include <cmath> // for abs
 
-// Invert
-#include <itkInvertIntensityImageFilter.h>
-
-// Erode
-#include <itkBinaryBallStructuringElement.h>
-#include <itkGrayscaleErodeImageFilter.h>
-#include <itkSubtractImageFilter.h>
-#include <itkBinaryThresholdImageFilter.h>
-#include <itkGrayscaleDilateImageFilter.h>
-#include <itkMaskImageFilter.h>
+#include "ParallelFor.h"
+#include "DistanceTransform.h"
+#include "MappedFile.h"
 
 // Loading bar
-#include "MitkLoadingBarCommand.h"
 #include <mitkProgressBar.h>
 
+const double UncertaintyPreprocessor::GRID_TOLERANCE = 1e-6;
+
+UncertaintyPreprocessor::UncertaintyPreprocessor() {
+  this->uncertaintyStatistics = NULL;
+  this->streamingSlabThickness = 0;
+  this->normalizedSource = NULL;
+  this->normalizedSourceMTime = 0;
+  this->erodeOnlyBorderBackground = false;
+  this->backgroundDistancesOnlyBorder = false;
+  this->singlePrecision = false;
+  this->normalizedSinglePrecision = false;
+}
+
 /**
   * Set the scan corresponding to the uncertainty.
-  * This is used to align the uncertainty to it (if enabled).
+  * This is used to align the uncertainty to it (if enabled), by resampling the uncertainty onto the scan's grid.
   */
 void UncertaintyPreprocessor::setScan(mitk::Image::Pointer scan) {
   this->scan = scan;
@@ -37,6 +44,14 @@ void UncertaintyPreprocessor::setUncertainty(mitk::Image::Pointer uncertainty) {
   this->uncertainty = uncertainty;
 }
 
+/**
+  * Set the statistics of the uncertainty if they've already been computed (e.g. cached on its node).
+  * Normalizing uses their min and max instead of finding them again.
+  */
+void UncertaintyPreprocessor::setUncertaintyStatistics(const UncertaintyStatistics * statistics) {
+  this->uncertaintyStatistics = statistics;
+}
+
 /**
   * Set the range to normalize the uncertainty to.
   */
@@ -48,48 +63,106 @@ void UncertaintyPreprocessor::setNormalizationParams(double min, double max) {
 /**
   * Configure the erosion. 
   * erodeThickness - number of pixels to erode.
+  * onlyBorderBackground - only erode from the background that's connected to the edge of the volume (so zeros inside
+  *                        the brain, where there's legitimately no uncertainty, aren't eroded around).
   */
-void UncertaintyPreprocessor::setErodeParams(int erodeThickness) {
+void UncertaintyPreprocessor::setErodeParams(int erodeThickness, bool onlyBorderBackground) {
   this->erodeErodeThickness = erodeThickness;
+  this->erodeOnlyBorderBackground = onlyBorderBackground;
+}
+
+/**
+  * Set whether to preprocess into float rather than double. This halves the memory of the preprocessed uncertainty
+  * (and everything downstream of it, which all follows its type) at the cost of precision no one will see.
+  */
+void UncertaintyPreprocessor::setSinglePrecision(bool singlePrecision) {
+  this->singlePrecision = singlePrecision;
 }
 
+/**
+  * Configure streaming, for volumes too big to preprocess all at once.
+  * slabThickness - number of slices to preprocess at a time (0 to do the whole volume at once).
+  * outputFileName - a file to page the output out to (it's mapped into memory, and deleted once the output has gone).
+  *                  Empty to keep the output in memory.
+  */
+void UncertaintyPreprocessor::setStreamingParams(unsigned int slabThickness, const std::string & outputFileName) {
+  this->streamingSlabThickness = slabThickness;
+  this->streamingFileName = outputFileName;
+}
+
+/**
+  * Normalizes, inverts (if enabled) and finds the background (if eroding) in one pass over the uncertainty, straight into
+  * the output. Only the erosion needs a second pass.
+  * The normalized uncertainty and the distances to its background are kept, so if only the erode thickness or aligning
+  * changes they aren't computed again.
+  * If streaming, this is done a slab of slices at a time, so only one slab's worth of working memory is needed (and
+  * nothing is kept).
+  */
 mitk::Image::Pointer UncertaintyPreprocessor::preprocessUncertainty(bool invert, bool erode, bool align) {
-  // We always normalize, everything else is optional.
-  unsigned int stepsToDo = 100;
-  if (invert) {
-    stepsToDo += 100;
+  bool streaming = streamingSlabThickness > 0;
+  bool normalize = streaming || !isNormalizedCached(invert);
+
+  // One step per slab, everything else is optional.
+  unsigned int depth = this->uncertainty->GetDimension(2);
+  unsigned int slabThickness = streaming ? std::min(streamingSlabThickness, depth) : depth;
+  unsigned int stepsToDo = 0;
+  if (normalize) {
+    stepsToDo += (depth + slabThickness - 1) / slabThickness;
+  }
+  bool findDistances = erode && !streaming && !normalize &&
+    (backgroundDistances.empty() || backgroundDistancesOnlyBorder != erodeOnlyBorderBackground);
+  if (erode && !streaming) {
+    stepsToDo += 1;
   }
-  if (erode) {
-    stepsToDo += 100;
+  if (findDistances) {
+    stepsToDo += 1;
   }
   if (align) {
     stepsToDo += 1;
   }
   mitk::ProgressBar::GetInstance()->AddStepsToDo(stepsToDo);
 
-  // ------------------- //
-  // ---- Normalize ---- //
-  // ------------------- //
-  mitk::Image::Pointer normalizedMitkImage;
-  AccessByItk_1(this->uncertainty, ItkNormalizeUncertainty, normalizedMitkImage);
-
-  // ------------------- //
-  // ------ Invert ----- //
-  // ------------------- //
-  // (if enabled)
-  mitk::Image::Pointer invertedMitkImage = normalizedMitkImage;
-  if (invert) {
-    AccessByItk_1(normalizedMitkImage, ItkInvertUncertainty, invertedMitkImage);
+  mitk::Image::Pointer erodedMitkImage;
+  if (streaming) {
+    // -------------------------------------- //
+    // ---- Normalize, Invert and Erode ---- //
+    // -------------------------------------- //
+    // (invert and erode if enabled)
+    clearCache();
+    AccessFixedDimensionByItk_n(this->uncertainty, ItkPreprocessUncertainty, 3, (invert, erode, erodedMitkImage));
+    std::vector<float>().swap(backgroundDistances);
   }
-  
-  // ------------------- //
-  // ------ Erode ------ //
-  // ------------------- //
-  // (if enabled)
-  mitk::Image::Pointer erodedMitkImage = invertedMitkImage;
-  if (erode) {
-    AccessByItk_1(invertedMitkImage, ItkErodeUncertainty, erodedMitkImage);
+  else {
+    // ------------------------------ //
+    // ---- Normalize and Invert ---- //
+    // ------------------------------ //
+    // (invert if enabled, and find the distances to the background if eroding)
+    if (normalize) {
+      clearCache();
+      AccessFixedDimensionByItk_n(this->uncertainty, ItkPreprocessUncertainty, 3, (invert, erode, normalizedUncertainty));
+      normalizedSource = this->uncertainty.GetPointer();
+      normalizedSourceMTime = this->uncertainty->GetMTime();
+      normalizedMin = normalizationMin;
+      normalizedMax = normalizationMax;
+      normalizedInverted = invert;
+      normalizedSinglePrecision = singlePrecision;
+    }
+
+    // ------------------- //
+    // ------ Erode ------ //
+    // ------------------- //
+    // (if enabled)
+    erodedMitkImage = normalizedUncertainty;
+    if (erode) {
+      if (findDistances) {
+        updateBackgroundDistances();
+        mitk::ProgressBar::GetInstance()->Progress();
+      }
+      erodedMitkImage = erodeNormalized();
+      mitk::ProgressBar::GetInstance()->Progress();
+    }
   }
+  std::vector<unsigned char>().swap(background);
 
   // ------------------- //
   // ------ Align ------ //
@@ -97,18 +170,7 @@ mitk::Image::Pointer UncertaintyPreprocessor::preprocessUncertainty(bool invert,
   // (if enabled)
   mitk::Image::Pointer fullyProcessedMitkImage = erodedMitkImage;
   if (align) {
-    // Align the scan and uncertainty.
-    // Get the origin and index to world transform of the scan.
-    mitk::SlicedGeometry3D * scanSlicedGeometry = this->scan->GetSlicedGeometry();
-    mitk::Point3D scanOrigin = scanSlicedGeometry->GetOrigin();
-    mitk::AffineTransform3D * scanTransform = scanSlicedGeometry->GetIndexToWorldTransform();
-
-    // Set the origin and index to world transform of the uncertainty to be the same.
-    // This effectively lines up pixel (x, y, z) in the scan with pixel (x, y, z) in the uncertainty.
-    mitk::SlicedGeometry3D * uncertaintySlicedGeometry = fullyProcessedMitkImage->GetSlicedGeometry();
-    uncertaintySlicedGeometry->SetOrigin(scanOrigin);
-    uncertaintySlicedGeometry->SetIndexToWorldTransform(scanTransform);
-
+    fullyProcessedMitkImage = resampleToScan(erodedMitkImage);
     mitk::ProgressBar::GetInstance()->Progress();
   }
 
@@ -116,135 +178,738 @@ mitk::Image::Pointer UncertaintyPreprocessor::preprocessUncertainty(bool invert,
 }
 
 /**
-  * Case 1: If itkImage contains characters (0-255) then map the range (0-255) to (0.0-1.0).
-  * Case 2: If itkImage contains anything else just map (min-max) to (0.0-1.0).
+  * Whether the kept normalized uncertainty is of the current uncertainty (unchanged since), with the same parameters.
   */
-template <typename TPixel, unsigned int VImageDimension>
-void UncertaintyPreprocessor::ItkNormalizeUncertainty(itk::Image<TPixel, VImageDimension>* itkImage, mitk::Image::Pointer & result) {
-  typedef itk::Image<TPixel, VImageDimension> ImageType;
-  typedef itk::Image<double, 3> ResultType;
-  
-  itk::Image<unsigned char, 3> * charImage = dynamic_cast<itk::Image<unsigned char, 3>* >(itkImage);
+bool UncertaintyPreprocessor::isNormalizedCached(bool invert) const {
+  return normalizedUncertainty.IsNotNull() &&
+    normalizedSource == this->uncertainty.GetPointer() &&
+    normalizedSourceMTime == this->uncertainty->GetMTime() &&
+    normalizedMin == normalizationMin &&
+    normalizedMax == normalizationMax &&
+    normalizedInverted == invert &&
+    normalizedSinglePrecision == singlePrecision;
+}
+
+/**
+  * Forgets the kept stages.
+  */
+void UncertaintyPreprocessor::clearCache() {
+  normalizedUncertainty = NULL;
+  normalizedSource = NULL;
+  std::vector<float>().swap(backgroundDistances);
+}
+
+/**
+  * The window of uncertainty values that's mapped to the output range when normalizing.
+  * Case 1: If the uncertainty contains characters (0-255) then map the range (0-255) to (0.0-1.0).
+  * Case 2: If it contains anything else just map (min-max) to the normalization range.
+  *         (using the min and max from the statistics, if we have them)
+  */
+void UncertaintyPreprocessor::getNormalizationWindow(bool isUnsignedChar, double & windowMin, double & windowMax, double & outputMin, double & outputMax) {
   // Case 1
-  if (charImage) {
-    typedef itk::IntensityWindowingImageFilter< ImageType, ResultType> IntensityWindowingFilterType;
-
-    typename IntensityWindowingFilterType::Pointer windowFilter = IntensityWindowingFilterType::New();
-    windowFilter->SetInput(itkImage);
-    windowFilter->SetOutputMinimum(0.0);
-    windowFilter->SetOutputMaximum(1.0);
-    windowFilter->SetWindowMinimum(0);
-    windowFilter->SetWindowMaximum(255);
-    MitkLoadingBarCommand::Pointer command = MitkLoadingBarCommand::New();
-    command->Initialize(100, false);
-    windowFilter->AddObserver(itk::ProgressEvent(), command);
-    windowFilter->Update();
-
-    // Convert to MITK
-    ResultType * scaledImage = windowFilter->GetOutput();
-    mitk::CastToMitkImage(scaledImage, result);
+  if (isUnsignedChar) {
+    windowMin = 0;
+    windowMax = 255;
+    outputMin = 0.0;
+    outputMax = 1.0;
+    return;
   }
+
   // Case 2
+  outputMin = normalizationMin;
+  outputMax = normalizationMax;
+  if (uncertaintyStatistics != NULL && uncertaintyStatistics->isFor(this->uncertainty)) {
+    windowMin = uncertaintyStatistics->getMin();
+    windowMax = uncertaintyStatistics->getMax();
+  }
   else {
-    typedef itk::RescaleIntensityImageFilter<ImageType, ResultType> RescaleFilterType;
+    UncertaintyStatistics statistics;
+    statistics.compute(this->uncertainty);
+    windowMin = statistics.getMin();
+    windowMax = statistics.getMax();
+  }
+}
 
-    // Scale all the values.
-    typename RescaleFilterType::Pointer rescaleFilter = RescaleFilterType::New();
-    rescaleFilter->SetInput(itkImage);
-    rescaleFilter->SetOutputMinimum(normalizationMin);
-    rescaleFilter->SetOutputMaximum(normalizationMax);
-    MitkLoadingBarCommand::Pointer command = MitkLoadingBarCommand::New();
-    command->Initialize(100, false);
-    rescaleFilter->AddObserver(itk::ProgressEvent(), command);
-    rescaleFilter->Update();
+/**
+  * Maps a slice of the uncertainty to the normalized range (clamping to the window, as IntensityWindowingImageFilter
+  * does), inverts it, and marks the background (exactly zero afterwards).
+  * Each item is a z slice of the slab and its halo (starting at firstSlice). Only the slab itself (outputStart to
+  * outputEnd) is written to the output, the halo is only needed for the background.
+  * The output is TOutput (double, or float in single precision), and the background is what's zero once it's stored.
+  */
+template <typename TPixel, typename TOutput>
+struct UncertaintyPreprocessor::NormalizeInverter {
+  const TPixel * values;
+  TOutput * output;
+  unsigned char * background;
+  size_t sliceSize;
+  unsigned int firstSlice;
+  unsigned int outputStart, outputEnd;
+
+  double windowMin, windowMax;
+  double outputMin, outputMax;
+  double scale;
+  bool invert;
+  double invertMaximum;
+
+  void operator()(unsigned int item, unsigned int /*threadID*/) {
+    unsigned int slice = firstSlice + item;
+    bool inSlab = (slice >= outputStart && slice < outputEnd);
+    if (!inSlab && background == NULL) {
+      return;
+    }
+
+    const TPixel * sliceValues = values + slice * sliceSize;
+    TOutput * sliceOutput = output + slice * sliceSize;
+    unsigned char * sliceBackground = (background != NULL) ? background + item * sliceSize : NULL;
+    for (size_t i = 0; i < sliceSize; i++) {
+      double value = sliceValues[i];
+      double normalized;
+      if (value <= windowMin) {
+        normalized = outputMin;
+      }
+      else if (value >= windowMax) {
+        normalized = outputMax;
+      }
+      else {
+        normalized = (value - windowMin) * scale + outputMin;
+      }
+
+      if (invert) {
+        normalized = invertMaximum - normalized;
+      }
 
-    // Convert to MITK
-    ResultType * scaledImage = rescaleFilter->GetOutput();
-    mitk::CastToMitkImage(scaledImage, result);
+      TOutput stored = static_cast<TOutput>(normalized);
+      if (inSlab) {
+        sliceOutput[i] = stored;
+      }
+      if (sliceBackground != NULL) {
+        sliceBackground[i] = (stored == 0) ? 1 : 0;
+      }
+    }
   }
-}
+};
 
 /**
-  * Inverts an ITK Image.
+  * Normalizes, inverts (if enabled) and erodes (if enabled) the uncertainty, a slab at a time.
+  * Each slab is normalized and inverted in one multithreaded pass, along with enough slices either side of it (the halo)
+  * to erode it exactly as if the whole volume was done at once.
+  * If not streaming, the whole volume is one slab and it isn't eroded, only the distances to the background are found.
+  * The output is kept in memory, or in a mapped file if streaming to one.
   */
 template <typename TPixel, unsigned int VImageDimension>
-void UncertaintyPreprocessor::ItkInvertUncertainty(itk::Image<TPixel, VImageDimension>* itkImage, mitk::Image::Pointer & result) {
-  typedef itk::Image<TPixel, VImageDimension> ImageType;
-  typedef itk::InvertIntensityImageFilter <ImageType> InvertIntensityImageFilterType;
- 
-  // Invert the image.
-  typename InvertIntensityImageFilterType::Pointer invertIntensityFilter = InvertIntensityImageFilterType::New();
-  invertIntensityFilter->SetInput(itkImage);
-  invertIntensityFilter->SetMaximum(normalizationMax);
-  MitkLoadingBarCommand::Pointer command = MitkLoadingBarCommand::New();
-  command->Initialize(100, false);
-  invertIntensityFilter->AddObserver(itk::ProgressEvent(), command);
-  invertIntensityFilter->Update();
+void UncertaintyPreprocessor::ItkPreprocessUncertainty(itk::Image<TPixel, VImageDimension>* itkImage, bool invert, bool erode, mitk::Image::Pointer & result) {
+  if (singlePrecision) {
+    preprocessInto<float>(itkImage, invert, erode, result);
+  }
+  else {
+    preprocessInto<double>(itkImage, invert, erode, result);
+  }
+}
+
+/**
+  * Preprocesses the uncertainty (see ItkPreprocessUncertainty) into an image of TOutput (double or float).
+  */
+template <typename TOutput, typename TPixel, unsigned int VImageDimension>
+void UncertaintyPreprocessor::preprocessInto(itk::Image<TPixel, VImageDimension>* itkImage, bool invert, bool erode, mitk::Image::Pointer & result) {
+  typedef itk::Image<TOutput, VImageDimension> ResultType;
+
+  NormalizeInverter<TPixel, TOutput> normalizeInverter;
+  bool isUnsignedChar = dynamic_cast<itk::Image<unsigned char, 3>* >(itkImage) != NULL;
+  getNormalizationWindow(isUnsignedChar, normalizeInverter.windowMin, normalizeInverter.windowMax, normalizeInverter.outputMin, normalizeInverter.outputMax);
+  normalizeInverter.scale = (normalizeInverter.windowMax > normalizeInverter.windowMin) ?
+    (normalizeInverter.outputMax - normalizeInverter.outputMin) / (normalizeInverter.windowMax - normalizeInverter.windowMin) : 0.0;
+  normalizeInverter.invert = invert;
+  normalizeInverter.invertMaximum = normalizationMax;
+
+  typename ResultType::SizeType size = itkImage->GetLargestPossibleRegion().GetSize();
+  unsigned int depth = size[2];
+  size_t sliceSize = (size_t) size[0] * size[1];
+
+  // The output, in a mapped file if streaming to one, otherwise in memory.
+  bool streaming = streamingSlabThickness > 0;
+  typename ResultType::Pointer resultImage = NULL;
+  MappedFile::Pointer mappedFile = NULL;
+  TOutput * output = NULL;
+  if (streaming && !streamingFileName.empty()) {
+    mappedFile = MappedFile::New();
+    if (mappedFile->create(streamingFileName, sliceSize * depth * sizeof(TOutput), true)) {
+      output = (TOutput *) mappedFile->getData();
+    }
+  }
+  if (output == NULL) {
+    resultImage = ResultType::New();
+    resultImage->CopyInformation(itkImage);
+    resultImage->SetRegions(itkImage->GetLargestPossibleRegion());
+    resultImage->Allocate();
+    output = resultImage->GetBufferPointer();
+  }
+
+  normalizeInverter.values = itkImage->GetBufferPointer();
+  normalizeInverter.output = output;
+  normalizeInverter.sliceSize = sliceSize;
+
+  // Erosion reaches erodeErodeThickness slices into the neighbouring slabs.
+  unsigned int slabThickness = streaming ? std::min(streamingSlabThickness, depth) : depth;
+  unsigned int halo = erode ? erodeErodeThickness : 0;
+
+  // Whether background is connected to the edge can depend on any slab, so (if streaming) it's found for the whole
+  // volume first. It's only a byte per voxel, but it's the one thing that isn't bounded by the slab.
+  bool wholeBackground = erode && erodeOnlyBorderBackground && streaming && slabThickness < depth;
+  unsigned int wholeSize[3] = { (unsigned int) size[0], (unsigned int) size[1], depth };
+  if (wholeBackground) {
+    background.resize(sliceSize * depth);
+    normalizeInverter.background = &background[0];
+    normalizeInverter.firstSlice = 0;
+    normalizeInverter.outputStart = 0;
+    normalizeInverter.outputEnd = 0;
+    ParallelFor::run(depth, normalizeInverter);
+    keepBorderBackground(&background[0], wholeSize);
+  }
+
+  for (unsigned int slabStart = 0; slabStart < depth; slabStart += slabThickness) {
+    unsigned int slabEnd = std::min(depth, slabStart + slabThickness);
+    unsigned int haloStart = (slabStart > halo) ? slabStart - halo : 0;
+    unsigned int haloEnd = std::min(depth, slabEnd + halo);
+
+    unsigned int backgroundSize[3] = { (unsigned int) size[0], (unsigned int) size[1], haloEnd - haloStart };
+    if (erode && !wholeBackground) {
+      background.resize(sliceSize * backgroundSize[2]);
+    }
+
+    normalizeInverter.background = (erode && !wholeBackground) ? &background[0] : NULL;
+    normalizeInverter.firstSlice = haloStart;
+    normalizeInverter.outputStart = slabStart;
+    normalizeInverter.outputEnd = slabEnd;
+    ParallelFor::run(haloEnd - haloStart, normalizeInverter);
+
+    if (erode && erodeOnlyBorderBackground && !wholeBackground) {
+      keepBorderBackground(&background[0], backgroundSize);
+    }
+
+    // If we're not streaming the erosion is done later (from the kept distances).
+    // (The background is only filled in when eroding, otherwise it's empty.)
+    if (erode) {
+      const unsigned char * slabBackground = wholeBackground ? &background[haloStart * sliceSize] : &background[0];
+      if (streaming) {
+        erodeSlab(output + slabStart * sliceSize, slabBackground, backgroundSize, slabEnd - slabStart, slabStart - haloStart);
+      }
+      else {
+        DistanceTransform::computeSquaredDistances(slabBackground, backgroundSize, backgroundDistances);
+        backgroundDistancesOnlyBorder = erodeOnlyBorderBackground;
+      }
+    }
+    mitk::ProgressBar::GetInstance()->Progress();
+  }
 
   // Convert to MITK
-  ImageType * invertedImage = invertIntensityFilter->GetOutput();
-  mitk::CastToMitkImage(invertedImage, result);
+  if (resultImage.IsNotNull()) {
+    result = mitk::GrabItkImageMemory(resultImage.GetPointer());
+    return;
+  }
+
+  // Reference the mapped file, which is kept (mapped) for as long as the image is.
+  unsigned int dimensions[3] = { (unsigned int) size[0], (unsigned int) size[1], depth };
+  result = mitk::Image::New();
+  result->Initialize(mitk::MakeScalarPixelType<TOutput>(), 3, dimensions);
+  result->SetImportVolume(output, 0, 0, mitk::Image::ReferenceMemory);
+  result->GetGeometry()->SetOrigin(this->uncertainty->GetGeometry()->GetOrigin());
+  result->GetGeometry()->SetIndexToWorldTransform(this->uncertainty->GetGeometry()->GetIndexToWorldTransform());
+  result->SetProperty("Preprocessing.MappedFile", mitk::SmartPointerProperty::New(mappedFile));
 }
 
 /**
-  * Erodes an ITK Image.
+  * Marks the background (exactly zero) of the normalized uncertainty. Each item is a z slice.
+  */
+template <typename TPixel>
+struct UncertaintyPreprocessor::BackgroundFinder {
+  const TPixel * values;
+  unsigned char * background;
+  size_t sliceSize;
+
+  void operator()(unsigned int slice, unsigned int /*threadID*/) {
+    size_t start = slice * sliceSize;
+    size_t end = start + sliceSize;
+    for (size_t i = start; i < end; i++) {
+      background[i] = (values[i] == 0) ? 1 : 0;
+    }
+  }
+};
+
+/**
+  * Copies the uncertainty to the output (which can be the same), zeroing it within the erosion distance of the
+  * background. Each item is a z slice of the slab.
+  */
+template <typename TPixel>
+struct UncertaintyPreprocessor::BackgroundMasker {
+  const TPixel * values;
+  TPixel * output;
+  const float * squaredDistances;
+  float maxSquaredDistance;
+  size_t sliceSize;
+
+  void operator()(unsigned int slice, unsigned int /*threadID*/) {
+    size_t start = slice * sliceSize;
+    size_t end = start + sliceSize;
+    for (size_t i = start; i < end; i++) {
+      output[i] = (squaredDistances[i] <= maxSquaredDistance) ? 0 : values[i];
+    }
+  }
+};
+
+/**
+  * Finds the distances to the background of the kept normalized uncertainty (if they weren't found while normalizing).
+  */
+void UncertaintyPreprocessor::updateBackgroundDistances() {
+  unsigned int size[3] = { normalizedUncertainty->GetDimension(0), normalizedUncertainty->GetDimension(1), normalizedUncertainty->GetDimension(2) };
+  try {
+    AccessFixedTypeByItk(normalizedUncertainty, ItkFindBackground, MITK_ACCESSBYITK_FLOATING_PIXEL_TYPES_SEQ, (3));
+  }
+  catch (mitk::Exception & e) {
+    std::cerr << "Hmmm... it appears we can't get read access to the normalized uncertainty. Maybe it's type isn't double or float? (I've assumed it is)" << e << std::endl;
+    return;
+  }
+
+  if (erodeOnlyBorderBackground) {
+    keepBorderBackground(&background[0], size);
+  }
+  DistanceTransform::computeSquaredDistances(&background[0], size, backgroundDistances);
+  backgroundDistancesOnlyBorder = erodeOnlyBorderBackground;
+  std::vector<unsigned char>().swap(background);
+}
+
+/**
+  * Erodes a copy of the kept normalized uncertainty, using the kept distances to its background.
+  */
+mitk::Image::Pointer UncertaintyPreprocessor::erodeNormalized() {
+  if (backgroundDistances.empty()) {
+    return normalizedUncertainty;
+  }
+  mitk::Image::Pointer eroded = mitk::Image::New();
+  eroded->Initialize(normalizedUncertainty);
+
+  try {
+    AccessFixedTypeByItk_n(normalizedUncertainty, ItkErodeNormalized, MITK_ACCESSBYITK_FLOATING_PIXEL_TYPES_SEQ, (3), (eroded));
+  }
+  catch (mitk::Exception & e) {
+    std::cerr << "Hmmm... it appears we can't get access to the normalized uncertainty. Maybe it's type isn't double or float? (I've assumed it is)" << e << std::endl;
+  }
+  return eroded;
+}
+
+/**
+  * Marks the background of the kept (double or float) normalized uncertainty.
+  */
+template <typename TPixel, unsigned int VImageDimension>
+void UncertaintyPreprocessor::ItkFindBackground(itk::Image<TPixel, VImageDimension>* itkImage) {
+  typename itk::Image<TPixel, VImageDimension>::SizeType size = itkImage->GetLargestPossibleRegion().GetSize();
+  BackgroundFinder<TPixel> finder;
+  finder.sliceSize = (size_t) size[0] * size[1];
+  background.resize(finder.sliceSize * size[2]);
+  finder.values = itkImage->GetBufferPointer();
+  finder.background = &background[0];
+  ParallelFor::run(size[2], finder);
+}
+
+/**
+  * Copies the kept (double or float) normalized uncertainty to eroded, zeroing it near the background.
+  */
+template <typename TPixel, unsigned int VImageDimension>
+void UncertaintyPreprocessor::ItkErodeNormalized(itk::Image<TPixel, VImageDimension>* itkImage, mitk::Image::Pointer eroded) {
+  mitk::ImagePixelWriteAccessor<TPixel, 3> writeAccess(eroded);
+
+  double radius = erodeErodeThickness;
+  BackgroundMasker<TPixel> masker;
+  masker.values = itkImage->GetBufferPointer();
+  masker.output = writeAccess.GetData();
+  masker.sliceSize = (size_t) eroded->GetDimension(0) * eroded->GetDimension(1);
+  masker.squaredDistances = &backgroundDistances[0];
+  masker.maxSquaredDistance = (float) (radius * radius + radius);
+  ParallelFor::run(eroded->GetDimension(2), masker);
+}
+
+/**
+  * Erodes a slab of the (normalized) uncertainty in place, by zeroing everything within erodeErodeThickness pixels of
+  * the background found while normalizing. Uses an exact distance transform of the background, so the cost doesn't
+  * depend on the thickness.
+  * The background includes the halo (haloBefore slices before the slab, and however many after).
   * See setErodeParams for explanation of parameters.
   */
+template <typename TPixel>
+void UncertaintyPreprocessor::erodeSlab(TPixel * slabValues, const unsigned char * slabBackground, const unsigned int backgroundSize[3], unsigned int slabThickness, unsigned int haloBefore) {
+  DistanceTransform::computeSquaredDistances(slabBackground, backgroundSize, backgroundDistances);
+
+  // Same voxels as dilating the background by a ball of radius r (which covers distances up to r + 0.5).
+  double radius = erodeErodeThickness;
+  BackgroundMasker<TPixel> masker;
+  masker.values = slabValues;
+  masker.output = slabValues;
+  masker.sliceSize = (size_t) backgroundSize[0] * backgroundSize[1];
+  masker.squaredDistances = &backgroundDistances[0] + haloBefore * masker.sliceSize;
+  masker.maxSquaredDistance = (float) (radius * radius + radius);
+  ParallelFor::run(slabThickness, masker);
+}
+
+// Background states while flood filling from the edge.
+static const unsigned char NOT_BACKGROUND = 0;
+static const unsigned char ZERO = 1;
+static const unsigned char BORDER_BACKGROUND = 2;
+
+/**
+  * Flood fills the border background through each z slice (rows forwards and backwards, then columns forwards and
+  * backwards, until nothing changes). Each item is a slice, so threads never share voxels.
+  * On the first pass the edges of the volume are seeded, and on the last the background is set to 1 only where it
+  * was reached (so it's ready for the distance transform).
+  */
+struct UncertaintyPreprocessor::SliceFiller {
+  unsigned char * background;
+  const unsigned int * size;
+  bool seed;
+  bool finish;
+
+  void operator()(unsigned int z, unsigned int /*threadID*/) {
+    unsigned int width = size[0];
+    unsigned int height = size[1];
+    size_t sliceSize = (size_t) width * height;
+    unsigned char * slice = background + z * sliceSize;
+
+    if (finish) {
+      for (size_t i = 0; i < sliceSize; i++) {
+        slice[i] = (slice[i] == BORDER_BACKGROUND) ? 1 : 0;
+      }
+      return;
+    }
+
+    if (seed) {
+      bool edgeSlice = (z == 0 || z == size[2] - 1);
+      for (unsigned int y = 0; y < height; y++) {
+        unsigned char * row = slice + y * width;
+        bool edgeRow = edgeSlice || y == 0 || y == height - 1;
+        for (unsigned int x = 0; x < width; x++) {
+          if (row[x] == ZERO && (edgeRow || x == 0 || x == width - 1)) {
+            row[x] = BORDER_BACKGROUND;
+          }
+        }
+      }
+    }
+
+    bool passChanged = true;
+    while (passChanged) {
+      passChanged = false;
+
+      // Along rows.
+      for (unsigned int y = 0; y < height; y++) {
+        unsigned char * row = slice + y * width;
+        for (unsigned int x = 1; x < width; x++) {
+          if (row[x] == ZERO && row[x - 1] == BORDER_BACKGROUND) {
+            row[x] = BORDER_BACKGROUND;
+            passChanged = true;
+          }
+        }
+        for (unsigned int x = width - 1; x > 0; x--) {
+          if (row[x - 1] == ZERO && row[x] == BORDER_BACKGROUND) {
+            row[x - 1] = BORDER_BACKGROUND;
+            passChanged = true;
+          }
+        }
+      }
+
+      // Along columns (a row at a time, to stay in memory order).
+      for (unsigned int y = 1; y < height; y++) {
+        unsigned char * row = slice + y * width;
+        unsigned char * previous = row - width;
+        for (unsigned int x = 0; x < width; x++) {
+          if (row[x] == ZERO && previous[x] == BORDER_BACKGROUND) {
+            row[x] = BORDER_BACKGROUND;
+            passChanged = true;
+          }
+        }
+      }
+      for (unsigned int y = height - 1; y > 0; y--) {
+        unsigned char * row = slice + y * width;
+        unsigned char * previous = row - width;
+        for (unsigned int x = 0; x < width; x++) {
+          if (previous[x] == ZERO && row[x] == BORDER_BACKGROUND) {
+            previous[x] = BORDER_BACKGROUND;
+            passChanged = true;
+          }
+        }
+      }
+    }
+  }
+};
+
+/**
+  * Flood fills the border background between slices (forwards then backwards through z). Each item is a row (y), so
+  * threads never share voxels.
+  */
+struct UncertaintyPreprocessor::DepthFiller {
+  unsigned char * background;
+  const unsigned int * size;
+  std::vector<unsigned char> changed;
+
+  void operator()(unsigned int y, unsigned int /*threadID*/) {
+    unsigned int width = size[0];
+    size_t sliceSize = (size_t) width * size[1];
+    unsigned char * column = background + (size_t) y * width;
+
+    bool rowChanged = false;
+    for (unsigned int z = 1; z < size[2]; z++) {
+      unsigned char * row = column + z * sliceSize;
+      unsigned char * previous = row - sliceSize;
+      for (unsigned int x = 0; x < width; x++) {
+        if (row[x] == ZERO && previous[x] == BORDER_BACKGROUND) {
+          row[x] = BORDER_BACKGROUND;
+          rowChanged = true;
+        }
+      }
+    }
+    for (unsigned int z = size[2] - 1; z > 0; z--) {
+      unsigned char * row = column + z * sliceSize;
+      unsigned char * previous = row - sliceSize;
+      for (unsigned int x = 0; x < width; x++) {
+        if (previous[x] == ZERO && row[x] == BORDER_BACKGROUND) {
+          previous[x] = BORDER_BACKGROUND;
+          rowChanged = true;
+        }
+      }
+    }
+    changed[y] = rowChanged;
+  }
+};
+
+/**
+  * Keeps only the background (1) that's 6-connected to the edge of the volume, in place.
+  * A parallel wavefront: fill within every slice at once, then between slices along every row at once, and repeat until
+  * filling between slices reaches nothing new.
+  */
+void UncertaintyPreprocessor::keepBorderBackground(unsigned char * background, const unsigned int size[3]) {
+  if (size[0] == 0 || size[1] == 0 || size[2] == 0) {
+    return;
+  }
+
+  SliceFiller sliceFiller;
+  sliceFiller.background = background;
+  sliceFiller.size = size;
+  sliceFiller.seed = true;
+  sliceFiller.finish = false;
+
+  DepthFiller depthFiller;
+  depthFiller.background = background;
+  depthFiller.size = size;
+  depthFiller.changed.resize(size[1]);
+
+  while (true) {
+    ParallelFor::run(size[2], sliceFiller);
+    sliceFiller.seed = false;
+
+    ParallelFor::run(size[1], depthFiller);
+    if (std::find(depthFiller.changed.begin(), depthFiller.changed.end(), 1) == depthFiller.changed.end()) {
+      break;
+    }
+  }
+
+  sliceFiller.finish = true;
+  ParallelFor::run(size[2], sliceFiller);
+}
+
+/**
+  * Finds the voxels either side of a (continuous) index along one axis and how far it is between them.
+  * Anything within half a voxel of the edge takes the edge value, anything further out is outside (returns false).
+  */
+static bool getLinearSample(double index, unsigned int size, unsigned int & before, unsigned int & after, double & weight) {
+  if (index < -0.5 || index > size - 0.5) {
+    return false;
+  }
+  if (index <= 0.0) {
+    before = after = 0;
+    weight = 0.0;
+    return true;
+  }
+  if (index >= size - 1.0) {
+    before = after = size - 1;
+    weight = 0.0;
+    return true;
+  }
+  before = (unsigned int) index;
+  after = before + 1;
+  weight = index - before;
+  return true;
+}
+
+/**
+  * Trilinearly samples the uncertainty at each voxel of the scan. Each item is a z slice of the scan.
+  * The index of a scan voxel in the uncertainty is matrix * scanIndex + offset.
+  * If the grids' axes are parallel (the matrix is diagonal) the samples along each axis only depend on that axis, so
+  * they're looked up (separably) from tables worked out once. Otherwise each voxel's index is stepped along x.
+  */
+template <typename TPixel>
+struct UncertaintyPreprocessor::Resampler {
+  const TPixel * values;
+  unsigned int size[3];
+  TPixel * output;
+  unsigned int outputSize[3];
+
+  double matrix[3][3];
+  double offset[3];
+
+  // Per axis tables, if the axes are parallel.
+  bool separable;
+  std::vector<unsigned int> before[3], after[3];
+  std::vector<double> weight[3];
+  std::vector<bool> inside[3];
+
+  void buildTables() {
+    for (unsigned int axis = 0; axis < 3; axis++) {
+      before[axis].resize(outputSize[axis]);
+      after[axis].resize(outputSize[axis]);
+      weight[axis].resize(outputSize[axis]);
+      inside[axis].resize(outputSize[axis]);
+      for (unsigned int i = 0; i < outputSize[axis]; i++) {
+        double index = matrix[axis][axis] * i + offset[axis];
+        unsigned int b, a;
+        double w;
+        inside[axis][i] = getLinearSample(index, size[axis], b, a, w);
+        before[axis][i] = b;
+        after[axis][i] = a;
+        weight[axis][i] = w;
+      }
+    }
+  }
+
+  inline double sample(unsigned int x0, unsigned int x1, double wx, unsigned int y0, unsigned int y1, double wy,
+                       unsigned int z0, unsigned int z1, double wz) const {
+    size_t rowSize = size[0];
+    size_t sliceSize = (size_t) size[0] * size[1];
+    const TPixel * v00 = values + z0 * sliceSize + y0 * rowSize;
+    const TPixel * v01 = values + z0 * sliceSize + y1 * rowSize;
+    const TPixel * v10 = values + z1 * sliceSize + y0 * rowSize;
+    const TPixel * v11 = values + z1 * sliceSize + y1 * rowSize;
+    double c00 = v00[x0] + (v00[x1] - v00[x0]) * wx;
+    double c01 = v01[x0] + (v01[x1] - v01[x0]) * wx;
+    double c10 = v10[x0] + (v10[x1] - v10[x0]) * wx;
+    double c11 = v11[x0] + (v11[x1] - v11[x0]) * wx;
+    double c0 = c00 + (c01 - c00) * wy;
+    double c1 = c10 + (c11 - c10) * wy;
+    return c0 + (c1 - c0) * wz;
+  }
+
+  void operator()(unsigned int z, unsigned int /*threadID*/) {
+    TPixel * out = output + (size_t) z * outputSize[0] * outputSize[1];
+
+    if (separable) {
+      for (unsigned int y = 0; y < outputSize[1]; y++) {
+        for (unsigned int x = 0; x < outputSize[0]; x++, out++) {
+          if (!inside[0][x] || !inside[1][y] || !inside[2][z]) {
+            *out = 0.0;
+            continue;
+          }
+          *out = sample(before[0][x], after[0][x], weight[0][x], before[1][y], after[1][y], weight[1][y],
+                        before[2][z], after[2][z], weight[2][z]);
+        }
+      }
+      return;
+    }
+
+    for (unsigned int y = 0; y < outputSize[1]; y++) {
+      // Index of (0, y, z), then step along x.
+      double index[3];
+      for (unsigned int axis = 0; axis < 3; axis++) {
+        index[axis] = matrix[axis][1] * y + matrix[axis][2] * z + offset[axis];
+      }
+      for (unsigned int x = 0; x < outputSize[0]; x++, out++) {
+        unsigned int x0, x1, y0, y1, z0, z1;
+        double wx, wy, wz;
+        if (getLinearSample(index[0], size[0], x0, x1, wx) &&
+            getLinearSample(index[1], size[1], y0, y1, wy) &&
+            getLinearSample(index[2], size[2], z0, z1, wz)) {
+          *out = sample(x0, x1, wx, y0, y1, wy, z0, z1, wz);
+        }
+        else {
+          *out = 0.0;
+        }
+        for (unsigned int axis = 0; axis < 3; axis++) {
+          index[axis] += matrix[axis][0];
+        }
+      }
+    }
+  }
+};
+
+/**
+  * Resamples the (preprocessed) uncertainty onto the scan's grid, so voxel (x, y, z) of each covers the same place.
+  * Anything outside the uncertainty is zero (background).
+  * If the grids are already the same the image is returned as it is (no copy).
+  */
+mitk::Image::Pointer UncertaintyPreprocessor::resampleToScan(mitk::Image::Pointer image) {
+  // Scan index -> world -> uncertainty index.
+  mitk::AffineTransform3D * scanTransform = this->scan->GetGeometry()->GetIndexToWorldTransform();
+  mitk::AffineTransform3D * imageTransform = image->GetGeometry()->GetIndexToWorldTransform();
+  vnl_matrix_fixed<mitk::ScalarType, 3, 3> worldToImage = imageTransform->GetMatrix().GetInverse();
+  vnl_matrix_fixed<mitk::ScalarType, 3, 3> scanToImage = worldToImage * scanTransform->GetMatrix().GetVnlMatrix();
+  mitk::Vector3D offsetDifference = scanTransform->GetOffset() - imageTransform->GetOffset();
+  double offset[3];
+  for (unsigned int i = 0; i < 3; i++) {
+    offset[i] = worldToImage(i, 0) * offsetDifference[0] + worldToImage(i, 1) * offsetDifference[1] + worldToImage(i, 2) * offsetDifference[2];
+  }
+
+  double matrix[3][3];
+  bool sameGrid = true;
+  bool separable = true;
+  for (unsigned int i = 0; i < 3; i++) {
+    sameGrid = sameGrid && image->GetDimension(i) == this->scan->GetDimension(i) && std::abs(offset[i]) < GRID_TOLERANCE;
+    for (unsigned int j = 0; j < 3; j++) {
+      matrix[i][j] = scanToImage(i, j);
+      double identity = (i == j) ? 1.0 : 0.0;
+      sameGrid = sameGrid && std::abs(scanToImage(i, j) - identity) < GRID_TOLERANCE;
+      if (i != j && std::abs(scanToImage(i, j)) >= GRID_TOLERANCE) {
+        separable = false;
+      }
+    }
+  }
+
+  // ---- Same grid ---- //
+  if (sameGrid) {
+    return image;
+  }
+
+  mitk::Image::Pointer resampled;
+  try {
+    AccessFixedTypeByItk_n(image, ItkResampleToScan, MITK_ACCESSBYITK_FLOATING_PIXEL_TYPES_SEQ, (3), (matrix, offset, separable, resampled));
+  }
+  catch (mitk::Exception & e) {
+    std::cerr << "Hmmm... it appears we can't get access to the uncertainty to resample it. Maybe it's type isn't double or float? (I've assumed it is)" << e << std::endl;
+    return image;
+  }
+  resampled->GetGeometry()->SetOrigin(this->scan->GetGeometry()->GetOrigin());
+  resampled->GetGeometry()->SetIndexToWorldTransform(scanTransform);
+  return resampled;
+}
+
+/**
+  * Resamples the (double or float) uncertainty onto the scan's grid, keeping its type.
+  * The index of a scan voxel in the uncertainty is matrix * scanIndex + offset.
+  */
 template <typename TPixel, unsigned int VImageDimension>
-void UncertaintyPreprocessor::ItkErodeUncertainty(itk::Image<TPixel, VImageDimension>* itkImage, mitk::Image::Pointer & result) {
-  typedef itk::Image<TPixel, VImageDimension> ImageType;
-
-  // -------------------------------------- //
-  // ---- Threshold to find background ---- //
-  // -------------------------------------- //
-  // Create a thresholder.
-  typedef itk::BinaryThresholdImageFilter<ImageType, ImageType> BinaryThresholdImageFilterType;
-  typename BinaryThresholdImageFilterType::Pointer thresholdFilter = BinaryThresholdImageFilterType::New();
-  thresholdFilter->SetInput(itkImage);
-  thresholdFilter->SetInsideValue(1);
-  thresholdFilter->SetOutsideValue(0);
-  thresholdFilter->SetLowerThreshold(0.0);
-  thresholdFilter->SetUpperThreshold(0.0);
-  MitkLoadingBarCommand::Pointer command = MitkLoadingBarCommand::New();
-  command->Initialize(30, false);
-  thresholdFilter->AddObserver(itk::ProgressEvent(), command);
-  thresholdFilter->Update();
-
-  // ------------------------------ //
-  // -------- Growing mask -------- //
-  // ------------------------------ //
-  // Grow the threshold to remove background.
-  typedef itk::BinaryBallStructuringElement<TPixel, VImageDimension> StructuringElementType;
-  StructuringElementType dilationStructuringElement;
-  dilationStructuringElement.SetRadius(erodeErodeThickness);
-  dilationStructuringElement.CreateStructuringElement();
-
-  typedef itk::GrayscaleDilateImageFilter<ImageType, ImageType, StructuringElementType> GrayscaleDilateImageFilterType;
-  typename GrayscaleDilateImageFilterType::Pointer dilateFilter = GrayscaleDilateImageFilterType::New();
-  dilateFilter->SetInput(thresholdFilter->GetOutput());
-  dilateFilter->SetKernel(dilationStructuringElement);
-  command = MitkLoadingBarCommand::New();
-  command->Initialize(40, false);
-  dilateFilter->AddObserver(itk::ProgressEvent(), command);
-  dilateFilter->Update();
-
-  // ------------------------- //
-  // -------- Masking -------- //
-  // ------------------------- //
-  typedef itk::MaskImageFilter<ImageType, ImageType, ImageType> MaskImageFilterType;
-  typename MaskImageFilterType::Pointer masker = MaskImageFilterType::New();
-  masker->SetInput(itkImage);
-  masker->SetMaskImage(dilateFilter->GetOutput());
-  masker->SetMaskingValue(1.0);
-  masker->SetOutsideValue(0.0);
-  command = MitkLoadingBarCommand::New();
-  command->Initialize(30, false);
-  masker->AddObserver(itk::ProgressEvent(), command);
-  masker->Update();
-
-  // ------------------------- //
-  // -------- Return --------- //
-  // ------------------------- //
-  // Convert to MITK
-  mitk::CastToMitkImage(masker->GetOutput(), result);
+void UncertaintyPreprocessor::ItkResampleToScan(itk::Image<TPixel, VImageDimension>* itkImage, const double matrix[3][3], const double offset[3], bool separable, mitk::Image::Pointer & resampled) {
+  Resampler<TPixel> resampler;
+  resampler.separable = separable;
+  for (unsigned int i = 0; i < 3; i++) {
+    resampler.size[i] = itkImage->GetLargestPossibleRegion().GetSize()[i];
+    resampler.outputSize[i] = this->scan->GetDimension(i);
+    resampler.offset[i] = offset[i];
+    for (unsigned int j = 0; j < 3; j++) {
+      resampler.matrix[i][j] = matrix[i][j];
+    }
+  }
+
+  resampled = mitk::Image::New();
+  resampled->Initialize(mitk::MakeScalarPixelType<TPixel>(), 3, resampler.outputSize);
+  mitk::ImagePixelWriteAccessor<TPixel, 3> writeAccess(resampled);
+  resampler.values = itkImage->GetBufferPointer();
+  resampler.output = writeAccess.GetData();
+  if (resampler.separable) {
+    resampler.buildTables();
+  }
+  ParallelFor::run(resampler.outputSize[2], resampler);
 }
\ No newline at end of file
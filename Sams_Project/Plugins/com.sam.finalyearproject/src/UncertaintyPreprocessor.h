@@ -2,32 +2,94 @@
 #define Uncertainty_Processor_h
 
 #include <mitkImage.h>
+#include <itkImage.h>
+#include <vector>
+
+#include "UncertaintyStatistics.h"
 
 class UncertaintyPreprocessor {
 	public:
+    UncertaintyPreprocessor();
     void setScan(mitk::Image::Pointer image);
     void setUncertainty(mitk::Image::Pointer image);
+    void setUncertaintyStatistics(const UncertaintyStatistics * statistics);
     void setNormalizationParams(double min, double max);
-    void setErodeParams(int erodeThickness);
+    void setErodeParams(int erodeThickness, bool onlyBorderBackground = false);
+    void setStreamingParams(unsigned int slabThickness, const std::string & outputFileName);
+    void setSinglePrecision(bool singlePrecision);
     mitk::Image::Pointer preprocessUncertainty(bool invert, bool erode, bool align);
 
   private:
     mitk::Image::Pointer scan;
     mitk::Image::Pointer uncertainty;
+    const UncertaintyStatistics * uncertaintyStatistics;
 
     // Preprocessing parameters
     double normalizationMin;
     double normalizationMax;
     
     int erodeErodeThickness;
+    bool erodeOnlyBorderBackground;
+
+    unsigned int streamingSlabThickness;
+    std::string streamingFileName;
+
+    bool singlePrecision;
+
+    // Background (1) of the current slab (and its halo) found while normalizing, for the erosion.
+    std::vector<unsigned char> background;
+
+    // Stages kept from the last time (unless streaming), so changing the parameters of a later stage only redoes the
+    // stages after it. Each is keyed by its input and the parameters that went into it.
+    // Normalized (and inverted, if enabled) uncertainty, before erosion.
+    mitk::Image::Pointer normalizedUncertainty;
+    const mitk::Image * normalizedSource;
+    unsigned long normalizedSourceMTime;
+    double normalizedMin;
+    double normalizedMax;
+    bool normalizedInverted;
+    bool normalizedSinglePrecision;
+    // Squared distance to the background of the normalized uncertainty (or the current slab, if streaming).
+    // Doesn't depend on the erode thickness. Empty if it hasn't been computed.
+    std::vector<float> backgroundDistances;
+    bool backgroundDistancesOnlyBorder;
+
+    void getNormalizationWindow(bool isUnsignedChar, double & windowMin, double & windowMax, double & outputMin, double & outputMax);
+    bool isNormalizedCached(bool invert) const;
+    void clearCache();
+    void updateBackgroundDistances();
+    mitk::Image::Pointer erodeNormalized();
+    mitk::Image::Pointer resampleToScan(mitk::Image::Pointer image);
+    template <typename TPixel>
+    void erodeSlab(TPixel * slabValues, const unsigned char * slabBackground, const unsigned int backgroundSize[3], unsigned int slabThickness, unsigned int haloBefore);
+    void keepBorderBackground(unsigned char * background, const unsigned int size[3]);
+
+    template <typename TOutput, typename TPixel, unsigned int VImageDimension>
+    void preprocessInto(itk::Image<TPixel, VImageDimension>* itkImage, bool invert, bool erode, mitk::Image::Pointer & result);
+
+    template <typename TPixel, typename TOutput>
+    struct NormalizeInverter;
+    template <typename TPixel>
+    struct BackgroundFinder;
+    template <typename TPixel>
+    struct BackgroundMasker;
+    struct SliceFiller;
+    struct DepthFiller;
+    template <typename TPixel>
+    struct Resampler;
+
+    // How far two grids can be apart (in voxels) and still be treated as the same.
+    static const double GRID_TOLERANCE;
 
     // ITK Methods
     template <typename TPixel, unsigned int VImageDimension>
-    void ItkNormalizeUncertainty(itk::Image<TPixel, VImageDimension>* itkImage, mitk::Image::Pointer & result);
+    void ItkPreprocessUncertainty(itk::Image<TPixel, VImageDimension>* itkImage, bool invert, bool erode, mitk::Image::Pointer & result);
+    template <typename TPixel, unsigned int VImageDimension>
+    void ItkFindBackground(itk::Image<TPixel, VImageDimension>* itkImage);
     template <typename TPixel, unsigned int VImageDimension>
-    void ItkInvertUncertainty(itk::Image<TPixel, VImageDimension>* itkImage, mitk::Image::Pointer & result);
+    void ItkErodeNormalized(itk::Image<TPixel, VImageDimension>* itkImage, mitk::Image::Pointer eroded);
     template <typename TPixel, unsigned int VImageDimension>
-    void ItkErodeUncertainty(itk::Image<TPixel, VImageDimension>* itkImage, mitk::Image::Pointer & result);
+    void ItkResampleToScan(itk::Image<TPixel, VImageDimension>* itkImage, const double matrix[3][3], const double offset[3], bool separable, mitk::Image::Pointer & resampled);
 };
 
 #endif
\ No newline at end of file
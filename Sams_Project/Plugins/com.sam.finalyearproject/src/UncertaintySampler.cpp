@@ -12,6 +12,7 @@
 
 UncertaintySampler::UncertaintySampler() {
   setAverage();
+  setBrickRecording(NULL, NULL);
 }
 
 /**
@@ -22,6 +23,7 @@ void UncertaintySampler::setUncertainty(mitk::Image::Pointer uncertainty) {
   this->uncertaintyHeight = uncertainty->GetDimension(0);
   this->uncertaintyWidth = uncertainty->GetDimension(1);
   this->uncertaintyDepth = uncertainty->GetDimension(2);
+  this->singlePrecision = Util::IsSinglePrecision(uncertainty);
 }
 
 double add(double a, double b) {
@@ -71,6 +73,16 @@ void UncertaintySampler::setMax() {
   this->collapse = &passThrough;
 }
 
+/**
+  * Records the bricks of the uncertainty read by each sample into touchedBricks (see UncertaintyBrickIndex).
+  * The caller clears touchedBricks before each ray so it ends up holding the bricks that ray depended on.
+  * Pass NULLs to stop recording.
+  */
+void UncertaintySampler::setBrickRecording(const UncertaintyBrickIndex * brickIndex, std::vector<unsigned int> * touchedBricks) {
+  this->brickIndex = brickIndex;
+  this->touchedBricks = touchedBricks;
+}
+
 /**
   * Returns the average uncertainty along a vector in the uncertainty.
   * startPosition - the vector to begin tracing from
@@ -78,6 +90,26 @@ void UncertaintySampler::setMax() {
   * percentage - how far to send the ray through the volume (0-100) (default 100)
   */
 double UncertaintySampler::sampleUncertainty(vtkVector<float, 3> startPosition, vtkVector<float, 3> direction, int percentage) {
+  // Get read access once for the whole ray (rather than for every sample, which locks the image each time).
+  try  {
+    if (singlePrecision) {
+      mitk::ImagePixelReadAccessor<float, 3> readAccess(this->uncertainty);
+      return sampleUncertainty(readAccess, startPosition, direction, percentage);
+    }
+    mitk::ImagePixelReadAccessor<double, 3> readAccess(this->uncertainty);
+    return sampleUncertainty(readAccess, startPosition, direction, percentage);
+  }
+  catch (mitk::Exception & e) {
+    cerr << "Hmmm... it appears we can't get read access to the uncertainty image. Maybe it's gone? Maybe it's type isn't double or float? (I've assumed it is)" << e << endl;
+    return -1;
+  }
+}
+
+/**
+  * As above, reading the uncertainty (double or float) through readAccess.
+  */
+template <typename TPixel>
+double UncertaintySampler::sampleUncertainty(mitk::ImagePixelReadAccessor<TPixel, 3> & readAccess, vtkVector<float, 3> startPosition, vtkVector<float, 3> direction, int percentage) {
   // Starting at 'startPosition' move in 'direction' in unit steps, taking samples.  
   // Similar to tortoise & hare algorithm. The tortoise moves slowly, collecting the samples we use
   // and the hare travels faster to see where the end of the uncertainty is.
@@ -103,7 +135,7 @@ double UncertaintySampler::sampleUncertainty(vtkVector<float, 3> startPosition,
 
   // Move the tortoise and hare to the start of the uncertainty (i.e. not background)
   while (isWithinUncertainty(tortoise)) {
-    double sample = interpolateUncertaintyAtPosition(tortoise);
+    double sample = interpolateUncertaintyAtPosition(readAccess, tortoise);
 
     if (DEBUGGING) {
       cout << " - Finding Uncertainty: (" << tortoise[0] << ", " << tortoise[1] << ", " << tortoise[2] << ")" <<
@@ -124,7 +156,7 @@ double UncertaintySampler::sampleUncertainty(vtkVector<float, 3> startPosition,
   double accumulator = initialAccumulator;
   unsigned int sampleCount = 0;
   while (isWithinUncertainty(tortoise)) {
-    double sample = interpolateUncertaintyAtPosition(tortoise);
+    double sample = interpolateUncertaintyAtPosition(readAccess, tortoise);
 
     // Include sample if it's not background.
     if (sample != 0.0) {
@@ -146,7 +178,7 @@ double UncertaintySampler::sampleUncertainty(vtkVector<float, 3> startPosition,
     }
 
     // If the hare goes over the edge, stop.
-    if (percentage != 100 && (!isWithinUncertainty(hare) || interpolateUncertaintyAtPosition(hare) == 0.0)) {
+    if (percentage != 100 && (!isWithinUncertainty(hare) || interpolateUncertaintyAtPosition(readAccess, hare) == 0.0)) {
       if (DEBUGGING) {
         cout << "- Hare over the edge." << endl;
       }
@@ -162,84 +194,186 @@ double UncertaintySampler::sampleUncertainty(vtkVector<float, 3> startPosition,
 }
 
 /**
-  * Given a continuous position in the volume this interpolates the value.
-  * NOTE: ITK has functionality to do this (see ITK VERSION below) but it turned out to be
-  *   slower than the manual version I had written before I had realised this. I think it must
-  *   sample more neighbours than the MANUAL VERSION.
+  * Marches the whole line through the uncertainty once and splits its samples into two halves.
+  * This gives the same result as calling sampleUncertainty(..., 50) from each end of the line
+  * (e.g. for two opposite points on a sphere) but only traverses the line once.
+  *   firstHalf - the value for the half nearest startPosition
+  *   secondHalf - the value for the half nearest the other end of the line
+  * The line is split at the middle of the uncertainty (i.e. ignoring background at either end).
   */
-double UncertaintySampler::interpolateUncertaintyAtPosition(vtkVector<float, 3> position) {
-  // // ITK VERSION
-  // double result;
-  // AccessByItk_2(this->uncertainty, Util::ItkInterpolateValue, position, result);
-  // return result;
+void UncertaintySampler::sampleUncertaintyHalves(vtkVector<float, 3> startPosition, vtkVector<float, 3> direction, double & firstHalf, double & secondHalf) {
+  if (!traceLine(startPosition, direction)) {
+    firstHalf = -1;
+    secondHalf = -1;
+    return;
+  }
 
-  // MANUAL VERSION
+  // Find the first and last samples that aren't background.
+  unsigned int first = 0;
+  while (first < lineSamples.size() && lineSamples[first] == 0.0) {
+    first++;
+  }
+  unsigned int last = lineSamples.size();
+  while (last > first && lineSamples[last - 1] == 0.0) {
+    last--;
+  }
+
+  // Split the uncertainty between them.
+  unsigned int middle = first + (last - first + 1) / 2;
+  firstHalf = accumulateSamples(first, middle);
+  secondHalf = accumulateSamples(middle, last);
+}
+
+/**
+  * As above but the line is split at a given number of steps from startPosition.
+  * e.g. when sampling outwards from the center of the volume (in both directions) split at the center.
+  * The sample at splitStep goes in both halves, as a ray marched out from there in either direction would start with it.
+  * So the halves have the same samples as sampleUncertainty from the split point each way (the positions can differ
+  * in the last bits, as they're stepped to from a different end).
+  */
+void UncertaintySampler::sampleUncertaintyHalves(vtkVector<float, 3> startPosition, vtkVector<float, 3> direction, unsigned int splitStep, double & firstHalf, double & secondHalf) {
+  if (!traceLine(startPosition, direction)) {
+    firstHalf = -1;
+    secondHalf = -1;
+    return;
+  }
+
+  unsigned int middle = std::min(splitStep, (unsigned int) lineSamples.size());
+  firstHalf = accumulateSamples(0, std::min(middle + 1, (unsigned int) lineSamples.size()));
+  secondHalf = accumulateSamples(middle, lineSamples.size());
+}
+
+/**
+  * Moves from startPosition in direction in unit steps until we leave the uncertainty.
+  * Every sample is stored in lineSamples.
+  * Returns false if startPosition isn't within the uncertainty (or the uncertainty can't be read).
+  */
+bool UncertaintySampler::traceLine(vtkVector<float, 3> startPosition, vtkVector<float, 3> direction) {
+  lineSamples.clear();
+
+  // Get read access once for the whole line.
   try  {
-    // See if the uncertainty data is available to be read.
+    if (singlePrecision) {
+      mitk::ImagePixelReadAccessor<float, 3> readAccess(this->uncertainty);
+      return traceLine(readAccess, startPosition, direction);
+    }
     mitk::ImagePixelReadAccessor<double, 3> readAccess(this->uncertainty);
+    return traceLine(readAccess, startPosition, direction);
+  }
+  catch (mitk::Exception & e) {
+    cerr << "Hmmm... it appears we can't get read access to the uncertainty image. Maybe it's gone? Maybe it's type isn't double or float? (I've assumed it is)" << e << endl;
+    return false;
+  }
+}
 
-    double interpolationTotalAccumulator = 0.0;
-    double interpolationDistanceAccumulator = 0.0;
-
-    // We're going to interpolate this point by looking at the 8 nearest neighbours. 
-    int xSampleRange = (round(position[0]) < position[0])? 1 : -1;
-    int ySampleRange = (round(position[1]) < position[1])? 1 : -1;
-    int zSampleRange = (round(position[2]) < position[2])? 1 : -1;
-
-    // Loop through the 8 samples.
-    for (int i = std::min(xSampleRange, 0); i <= std::max(xSampleRange, 0); i++) {
-      for (int j = std::min(ySampleRange, 0); j <= std::max(ySampleRange, 0); j++) { 
-        for (int k = std::min(zSampleRange, 0); k <= std::max(zSampleRange, 0); k++) {
-          // Get the position of the neighbour.
-          vtkVector<float, 3> neighbour = vtkVector<float, 3>();
-          neighbour[0] = continuousToDiscrete(position[0] + i, uncertaintyHeight);
-          neighbour[1] = continuousToDiscrete(position[1] + j, uncertaintyWidth);
-          neighbour[2] = continuousToDiscrete(position[2] + k, uncertaintyDepth);
-
-          // If the neighbour doesn't exist (we're over the edge), skip it.
-          if (!isWithinUncertainty(neighbour)) {
-            continue;
-          }
+/**
+  * As above, reading the uncertainty (double or float) through readAccess.
+  */
+template <typename TPixel>
+bool UncertaintySampler::traceLine(mitk::ImagePixelReadAccessor<TPixel, 3> & readAccess, vtkVector<float, 3> startPosition, vtkVector<float, 3> direction) {
+  vtkVector<float, 3> position = vtkVector<float, 3>(startPosition);
+  if (!isWithinUncertainty(position)) {
+    std::cerr << "Bad registration. Start point for uncertainty sampling not within uncertainty" << std::endl;
+    std::cerr << " - Point: (" << position[0] << ", " << position[1] << ", " << position[2] << ")" << std::endl;
+    return false;
+  }
 
-          // Read the uncertainty of the neighbour.
-          itk::Index<3> index;
-          index[0] = neighbour[0];
-          index[1] = neighbour[1];
-          index[2] = neighbour[2];
-          double neighbourUncertainty = readAccess.GetPixelByIndex(index);
+  while (isWithinUncertainty(position)) {
+    lineSamples.push_back(interpolateUncertaintyAtPosition(readAccess, position));
+    position = Util::vectorAdd(position, direction);
+  }
 
-          // If the uncertainty of the neighbour is 0, skip it.
-          if (std::abs(neighbourUncertainty) < 0.0001) {
-            continue;
-          }
+  return true;
+}
 
-          // Get the distance to this neighbour
-          vtkVector<float, 3> difference = Util::vectorSubtract(position, neighbour);
-          double distanceToSample = difference.Norm();
+/**
+  * Accumulates the samples [begin, end) of the last traced line. Background (zero) samples are ignored.
+  */
+double UncertaintySampler::accumulateSamples(unsigned int begin, unsigned int end) {
+  double accumulator = initialAccumulator;
+  unsigned int sampleCount = 0;
+  for (unsigned int i = begin; i < end; i++) {
+    if (lineSamples[i] != 0.0) {
+      accumulator = accumulate(accumulator, lineSamples[i]);
+      sampleCount++;
+    }
+  }
+  return collapse(accumulator, sampleCount);
+}
+
+/**
+  * Given a continuous position in the volume this interpolates the value, reading the uncertainty (double or float)
+  * through readAccess (which the callers get once per ray).
+  * NOTE: ITK has functionality to do this (e.g. Util::ItkInterpolateValue) but it turned out to be
+  *   slower than the manual version I had written before I had realised this. I think it must
+  *   sample more neighbours than this version.
+  */
+template <typename TPixel>
+double UncertaintySampler::interpolateUncertaintyAtPosition(mitk::ImagePixelReadAccessor<TPixel, 3> & readAccess, vtkVector<float, 3> position) {
+  double interpolationTotalAccumulator = 0.0;
+  double interpolationDistanceAccumulator = 0.0;
+
+  // We're going to interpolate this point by looking at the 8 nearest neighbours. 
+  int xSampleRange = (round(position[0]) < position[0])? 1 : -1;
+  int ySampleRange = (round(position[1]) < position[1])? 1 : -1;
+  int zSampleRange = (round(position[2]) < position[2])? 1 : -1;
+
+  // Loop through the 8 samples.
+  for (int i = std::min(xSampleRange, 0); i <= std::max(xSampleRange, 0); i++) {
+    for (int j = std::min(ySampleRange, 0); j <= std::max(ySampleRange, 0); j++) { 
+      for (int k = std::min(zSampleRange, 0); k <= std::max(zSampleRange, 0); k++) {
+        // Get the position of the neighbour.
+        vtkVector<float, 3> neighbour = vtkVector<float, 3>();
+        neighbour[0] = continuousToDiscrete(position[0] + i, uncertaintyHeight);
+        neighbour[1] = continuousToDiscrete(position[1] + j, uncertaintyWidth);
+        neighbour[2] = continuousToDiscrete(position[2] + k, uncertaintyDepth);
+
+        // If the neighbour doesn't exist (we're over the edge), skip it.
+        if (!isWithinUncertainty(neighbour)) {
+          continue;
+        }
 
-          // If the distance turns out to be zero, we have a perfect match. Ignore all other samples.
-          if (std::abs(distanceToSample) < 0.0001) {
-            interpolationTotalAccumulator = neighbourUncertainty;
-            interpolationDistanceAccumulator = 1;
-            goto BREAK_ALL_LOOPS;
+        // Read the uncertainty of the neighbour.
+        itk::Index<3> index;
+        index[0] = neighbour[0];
+        index[1] = neighbour[1];
+        index[2] = neighbour[2];
+        double neighbourUncertainty = readAccess.GetPixelByIndex(index);
+
+        // Remember which brick we read from (neighbouring samples are mostly in the same brick).
+        if (touchedBricks != NULL) {
+          unsigned int brick = brickIndex->brickContaining(index[0], index[1], index[2]);
+          if (touchedBricks->empty() || touchedBricks->back() != brick) {
+            touchedBricks->push_back(brick);
           }
+        }
 
-          // Accumulate
-          interpolationTotalAccumulator += neighbourUncertainty / distanceToSample;
-          interpolationDistanceAccumulator += 1.0 / distanceToSample;
+        // If the uncertainty of the neighbour is 0, skip it.
+        if (std::abs(neighbourUncertainty) < 0.0001) {
+          continue;
         }
+
+        // Get the distance to this neighbour
+        vtkVector<float, 3> difference = Util::vectorSubtract(position, neighbour);
+        double distanceToSample = difference.Norm();
+
+        // If the distance turns out to be zero, we have a perfect match. Ignore all other samples.
+        if (std::abs(distanceToSample) < 0.0001) {
+          interpolationTotalAccumulator = neighbourUncertainty;
+          interpolationDistanceAccumulator = 1;
+          goto BREAK_ALL_LOOPS;
+        }
+
+        // Accumulate
+        interpolationTotalAccumulator += neighbourUncertainty / distanceToSample;
+        interpolationDistanceAccumulator += 1.0 / distanceToSample;
       }
     }
-    BREAK_ALL_LOOPS:
-
-    // Interpolate the values. If there were no valid samples, set it to zero.
-    return (interpolationTotalAccumulator == 0.0) ? 0 : interpolationTotalAccumulator / interpolationDistanceAccumulator;
   }
+  BREAK_ALL_LOOPS:
 
-  catch (mitk::Exception & e) {
-    cerr << "Hmmm... it appears we can't get read access to the uncertainty image. Maybe it's gone? Maybe it's type isn't double? (I've assumed it is)" << e << endl;
-    return -1;
-  }
+  // Interpolate the values. If there were no valid samples, set it to zero.
+  return (interpolationTotalAccumulator == 0.0) ? 0 : interpolationTotalAccumulator / interpolationDistanceAccumulator;
 }
 
 /**
@@ -2,7 +2,11 @@
 #define Uncertainty_Sampler_h
 
 #include <mitkImage.h>
+#include <mitkImagePixelReadAccessor.h>
 #include <vtkVector.h>
+#include <vector>
+
+#include "UncertaintyBrickIndex.h"
 
 class UncertaintySampler {
 	public:
@@ -12,16 +16,34 @@ class UncertaintySampler {
     void setMin();
     void setMax();
     double sampleUncertainty(vtkVector<float, 3> startPosition, vtkVector<float, 3> direction, int percentage = 100);
+    void sampleUncertaintyHalves(vtkVector<float, 3> startPosition, vtkVector<float, 3> direction, double & firstHalf, double & secondHalf);
+    void sampleUncertaintyHalves(vtkVector<float, 3> startPosition, vtkVector<float, 3> direction, unsigned int splitStep, double & firstHalf, double & secondHalf);
+    void setBrickRecording(const UncertaintyBrickIndex * brickIndex, std::vector<unsigned int> * touchedBricks);
 
   private:
     mitk::Image::Pointer uncertainty;
     unsigned int uncertaintyHeight, uncertaintyWidth, uncertaintyDepth;
+    bool singlePrecision;
     double initialAccumulator;
     double (*accumulate)(double, double);
     double (*collapse)(double, double);
     static const bool DEBUGGING = false;
 
-    double interpolateUncertaintyAtPosition(vtkVector<float, 3> position);
+    // Where to record the bricks each sample reads (NULL to not record).
+    const UncertaintyBrickIndex * brickIndex;
+    std::vector<unsigned int> * touchedBricks;
+
+    // Samples along the most recently traced line (reused to avoid reallocating).
+    std::vector<double> lineSamples;
+    bool traceLine(vtkVector<float, 3> startPosition, vtkVector<float, 3> direction);
+    template <typename TPixel>
+    bool traceLine(mitk::ImagePixelReadAccessor<TPixel, 3> & readAccess, vtkVector<float, 3> startPosition, vtkVector<float, 3> direction);
+    double accumulateSamples(unsigned int begin, unsigned int end);
+
+    template <typename TPixel>
+    double sampleUncertainty(mitk::ImagePixelReadAccessor<TPixel, 3> & readAccess, vtkVector<float, 3> startPosition, vtkVector<float, 3> direction, int percentage);
+    template <typename TPixel>
+    double interpolateUncertaintyAtPosition(mitk::ImagePixelReadAccessor<TPixel, 3> & readAccess, vtkVector<float, 3> position);
     bool isWithinUncertainty(vtkVector<float, 3> position);
     unsigned int continuousToDiscrete(double continuous, unsigned int max);
 };
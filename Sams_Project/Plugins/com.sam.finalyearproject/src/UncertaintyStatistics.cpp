@@ -0,0 +1,331 @@
+#include "UncertaintyStatistics.h"
+
+#include "ParallelFor.h"
+
+#include <algorithm> // for min/max
+#include <sstream>
+
+#include <mitkImageAccessByItk.h>
+
+const char * UncertaintyStatistics::PROPERTY_NAME = "Uncertainty.Statistics";
+
+UncertaintyStatistics::UncertaintyStatistics() {
+  this->computedImage = NULL;
+  this->computedMTime = 0;
+  this->min = 0.0;
+  this->max = 0.0;
+  this->sum = 0.0;
+  this->sumOfSquares = 0.0;
+  this->numberOfVoxels = 0;
+  this->numberOfNonZeros = 0;
+}
+
+/**
+  * The statistics of the image in node. Computed the first time they're asked for (or if the image has been
+  * modified since) and then kept on the node.
+  * Returns NULL if the node doesn't hold an image.
+  */
+const UncertaintyStatistics * UncertaintyStatistics::forNode(mitk::DataNode::Pointer node) {
+  if (node.IsNull()) {
+    return NULL;
+  }
+  mitk::Image::Pointer image = dynamic_cast<mitk::Image*>(node->GetData());
+  if (image.IsNull()) {
+    return NULL;
+  }
+
+  UncertaintyStatistics & statistics = propertyStatistics(node);
+  if (!statistics.isFor(image)) {
+    statistics.compute(image);
+  }
+  return &statistics;
+}
+
+/**
+  * Puts statistics that have already been computed (e.g. kept for a timestep) on node, so forNode doesn't compute
+  * them again. They must be for the image node holds.
+  */
+void UncertaintyStatistics::setForNode(mitk::DataNode::Pointer node, const UncertaintyStatistics & statistics) {
+  if (node.IsNull()) {
+    return;
+  }
+  propertyStatistics(node) = statistics;
+}
+
+/**
+  * The statistics held on node, adding (empty) ones if it doesn't have any yet.
+  */
+UncertaintyStatistics & UncertaintyStatistics::propertyStatistics(mitk::DataNode::Pointer node) {
+  UncertaintyStatisticsProperty * property = dynamic_cast<UncertaintyStatisticsProperty*>(node->GetProperty(PROPERTY_NAME));
+  if (property == NULL) {
+    UncertaintyStatisticsProperty::Pointer newProperty = UncertaintyStatisticsProperty::New();
+    node->SetProperty(PROPERTY_NAME, newProperty);
+    property = newProperty;
+  }
+  return property->GetStatistics();
+}
+
+/**
+  * Whether these are the statistics of image as it is now.
+  */
+bool UncertaintyStatistics::isFor(mitk::Image::Pointer image) const {
+  return image.IsNotNull() && image.GetPointer() == computedImage && image->GetMTime() == computedMTime;
+}
+
+/**
+  * Makes these statistics for image, which must hold the same values as the image they were computed for (e.g. the
+  * same timestep extracted again), so they don't have to be computed again.
+  */
+void UncertaintyStatistics::rebind(mitk::Image::Pointer image) {
+  computedImage = image.GetPointer();
+  computedMTime = image->GetMTime();
+}
+
+/**
+  * Computes the statistics of image (which must be 3D).
+  */
+void UncertaintyStatistics::compute(mitk::Image::Pointer image) {
+  AccessFixedDimensionByItk(image, ItkComputeStatistics, 3);
+  computedImage = image.GetPointer();
+  computedMTime = image->GetMTime();
+}
+
+double UncertaintyStatistics::getMin() const {
+  return min;
+}
+
+double UncertaintyStatistics::getMax() const {
+  return max;
+}
+
+double UncertaintyStatistics::getSum() const {
+  return sum;
+}
+
+double UncertaintyStatistics::getSumOfSquares() const {
+  return sumOfSquares;
+}
+
+double UncertaintyStatistics::getMean() const {
+  return (numberOfVoxels > 0) ? sum / numberOfVoxels : 0.0;
+}
+
+double UncertaintyStatistics::getVariance() const {
+  if (numberOfVoxels == 0) {
+    return 0.0;
+  }
+  double mean = getMean();
+  return std::max(0.0, sumOfSquares / numberOfVoxels - mean * mean);
+}
+
+itk::uint64_t UncertaintyStatistics::getNumberOfVoxels() const {
+  return numberOfVoxels;
+}
+
+itk::uint64_t UncertaintyStatistics::getNumberOfNonZeros() const {
+  return numberOfNonZeros;
+}
+
+/**
+  * HISTOGRAM_BINS equal width bins between HISTOGRAM_MIN and HISTOGRAM_MAX.
+  */
+const std::vector<itk::uint64_t> & UncertaintyStatistics::getHistogram() const {
+  return histogram;
+}
+
+/**
+  * The histogram bin a value falls in.
+  */
+unsigned int UncertaintyStatistics::histogramBinContaining(double value) const {
+  double bin = (value - HISTOGRAM_MIN) / (HISTOGRAM_MAX - HISTOGRAM_MIN) * HISTOGRAM_BINS;
+  if (!(bin > 0.0)) {
+    return 0;
+  }
+  if (bin >= HISTOGRAM_BINS) {
+    return HISTOGRAM_BINS - 1;
+  }
+  return (unsigned int) bin;
+}
+
+/**
+  * The top edge of a histogram bin.
+  */
+double UncertaintyStatistics::histogramBinMax(unsigned int bin) const {
+  return HISTOGRAM_MIN + (HISTOGRAM_MAX - HISTOGRAM_MIN) * (bin + 1) / HISTOGRAM_BINS;
+}
+
+/**
+  * The middle of a histogram bin.
+  */
+double UncertaintyStatistics::histogramBinCentre(unsigned int bin) const {
+  return HISTOGRAM_MIN + (HISTOGRAM_MAX - HISTOGRAM_MIN) * (bin + 0.5) / HISTOGRAM_BINS;
+}
+
+bool UncertaintyStatistics::hasNonZeros() const {
+  return numberOfNonZeros > 0;
+}
+
+/**
+  * The smallest region containing every non-zero voxel. Empty if there are none.
+  */
+itk::ImageRegion<3> UncertaintyStatistics::getNonZeroRegion() const {
+  return nonZeroRegion;
+}
+
+/**
+  * The statistics of one slab (z slice) of the volume.
+  */
+struct UncertaintyStatistics::SlabStatistics {
+  double min;
+  double max;
+  double sum;
+  double sumOfSquares;
+  itk::uint64_t numberOfNonZeros;
+  std::vector<itk::uint64_t> histogram;
+  // Bounds of the non-zero voxels (only valid if there are any).
+  unsigned int nonZeroMin[2];
+  unsigned int nonZeroMax[2];
+};
+
+/**
+  * Computes the statistics of each slab. Each slab only writes its own statistics, so the result doesn't depend on
+  * how the slabs were shared out between the threads.
+  */
+template <typename TPixel>
+struct UncertaintyStatistics::SlabAccumulator {
+  const UncertaintyStatistics * statistics;
+  const TPixel * values;
+  unsigned int size[3];
+  std::vector<SlabStatistics> * slabs;
+
+  void operator()(unsigned int z, unsigned int /*threadID*/) {
+    SlabStatistics & slab = (*slabs)[z];
+    slab.histogram.assign(HISTOGRAM_BINS, 0);
+    slab.sum = 0.0;
+    slab.sumOfSquares = 0.0;
+    slab.numberOfNonZeros = 0;
+    slab.nonZeroMin[0] = size[0];
+    slab.nonZeroMin[1] = size[1];
+    slab.nonZeroMax[0] = 0;
+    slab.nonZeroMax[1] = 0;
+
+    const TPixel * slice = values + (size_t) z * size[0] * size[1];
+    slab.min = slice[0];
+    slab.max = slice[0];
+    for (unsigned int y = 0; y < size[1]; y++) {
+      const TPixel * row = slice + (size_t) y * size[0];
+      for (unsigned int x = 0; x < size[0]; x++) {
+        double value = row[x];
+        slab.min = std::min(slab.min, value);
+        slab.max = std::max(slab.max, value);
+        slab.sum += value;
+        slab.sumOfSquares += value * value;
+        slab.histogram[statistics->histogramBinContaining(value)]++;
+        if (value != 0.0) {
+          slab.numberOfNonZeros++;
+          slab.nonZeroMin[0] = std::min(slab.nonZeroMin[0], x);
+          slab.nonZeroMin[1] = std::min(slab.nonZeroMin[1], y);
+          slab.nonZeroMax[0] = std::max(slab.nonZeroMax[0], x);
+          slab.nonZeroMax[1] = std::max(slab.nonZeroMax[1], y);
+        }
+      }
+    }
+  }
+};
+
+/**
+  * Computes everything in one pass over the image (in parallel over z slices), then combines the slices.
+  */
+template <typename TPixel, unsigned int VImageDimension>
+void UncertaintyStatistics::ItkComputeStatistics(itk::Image<TPixel, VImageDimension>* itkImage) {
+  typedef itk::Image<TPixel, VImageDimension> ImageType;
+  typename ImageType::SizeType regionSize = itkImage->GetLargestPossibleRegion().GetSize();
+
+  SlabAccumulator<TPixel> accumulator;
+  accumulator.statistics = this;
+  accumulator.values = itkImage->GetBufferPointer();
+  for (unsigned int i = 0; i < 3; i++) {
+    accumulator.size[i] = regionSize[i];
+  }
+  std::vector<SlabStatistics> slabs(accumulator.size[2]);
+  accumulator.slabs = &slabs;
+  if (accumulator.size[0] > 0 && accumulator.size[1] > 0) {
+    ParallelFor::run(accumulator.size[2], accumulator);
+  }
+
+  // Combine the slabs.
+  min = max = sum = sumOfSquares = 0.0;
+  numberOfVoxels = (itk::uint64_t) accumulator.size[0] * accumulator.size[1] * accumulator.size[2];
+  numberOfNonZeros = 0;
+  histogram.assign(HISTOGRAM_BINS, 0);
+  unsigned int nonZeroMin[3] = {accumulator.size[0], accumulator.size[1], accumulator.size[2]};
+  unsigned int nonZeroMax[3] = {0, 0, 0};
+  for (unsigned int z = 0; z < slabs.size() && numberOfVoxels > 0; z++) {
+    SlabStatistics & slab = slabs[z];
+    min = (z == 0) ? slab.min : std::min(min, slab.min);
+    max = (z == 0) ? slab.max : std::max(max, slab.max);
+    sum += slab.sum;
+    sumOfSquares += slab.sumOfSquares;
+    for (unsigned int bin = 0; bin < HISTOGRAM_BINS; bin++) {
+      histogram[bin] += slab.histogram[bin];
+    }
+    if (slab.numberOfNonZeros > 0) {
+      numberOfNonZeros += slab.numberOfNonZeros;
+      for (unsigned int i = 0; i < 2; i++) {
+        nonZeroMin[i] = std::min(nonZeroMin[i], slab.nonZeroMin[i]);
+        nonZeroMax[i] = std::max(nonZeroMax[i], slab.nonZeroMax[i]);
+      }
+      nonZeroMin[2] = std::min(nonZeroMin[2], z);
+      nonZeroMax[2] = std::max(nonZeroMax[2], z);
+    }
+  }
+
+  itk::ImageRegion<3>::IndexType index;
+  itk::ImageRegion<3>::SizeType size;
+  for (unsigned int i = 0; i < 3; i++) {
+    index[i] = (numberOfNonZeros > 0) ? nonZeroMin[i] : 0;
+    size[i] = (numberOfNonZeros > 0) ? nonZeroMax[i] - nonZeroMin[i] + 1 : 0;
+  }
+  nonZeroRegion.SetIndex(index);
+  nonZeroRegion.SetSize(size);
+}
+
+// ---------------------------------------- //
+// ---- UncertaintyStatisticsProperty ---- //
+// ---------------------------------------- //
+
+UncertaintyStatisticsProperty::UncertaintyStatisticsProperty() {
+}
+
+UncertaintyStatisticsProperty::UncertaintyStatisticsProperty(const UncertaintyStatisticsProperty & other)
+  : mitk::BaseProperty(other), statistics(other.statistics) {
+}
+
+UncertaintyStatistics & UncertaintyStatisticsProperty::GetStatistics() {
+  return statistics;
+}
+
+std::string UncertaintyStatisticsProperty::GetValueAsString() const {
+  std::ostringstream stream;
+  stream << "min " << statistics.getMin() << ", max " << statistics.getMax() << ", mean " << statistics.getMean() <<
+            ", non-zeros " << statistics.getNumberOfNonZeros() << "/" << statistics.getNumberOfVoxels();
+  return stream.str();
+}
+
+itk::LightObject::Pointer UncertaintyStatisticsProperty::InternalClone() const {
+  itk::LightObject::Pointer result(new Self(*this));
+  result->UnRegister();
+  return result;
+}
+
+/**
+  * Statistics are only a cache, so any two are treated as equal (and never cause the node to be marked modified).
+  */
+bool UncertaintyStatisticsProperty::IsEqual(const mitk::BaseProperty & /*property*/) const {
+  return true;
+}
+
+bool UncertaintyStatisticsProperty::Assign(const mitk::BaseProperty & property) {
+  this->statistics = static_cast<const Self &>(property).statistics;
+  return true;
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+#ifndef Uncertainty_Statistics_h
+#define Uncertainty_Statistics_h
+
+#include <vector>
+
+#include <mitkImage.h>
+#include <mitkDataNode.h>
+#include <mitkBaseProperty.h>
+#include <itkImageRegion.h>
+#include <itkIntTypes.h>
+
+/**
+  * Statistics of an uncertainty volume, all computed together in one multithreaded pass:
+  *   min, max, sum, sum of squares, number of non-zero voxels, a histogram and the bounding box of the non-zero voxels.
+  * forNode() caches them on the image's DataNode, so everything using the same volume shares one pass.
+  */
+class UncertaintyStatistics {
+  public:
+    // The histogram covers the normalized range. Values outside it fall in the first/last bin.
+    static const unsigned int HISTOGRAM_BINS = 1000;
+    static const double HISTOGRAM_MIN = 0.0;
+    static const double HISTOGRAM_MAX = 1.0;
+
+    UncertaintyStatistics();
+    static const UncertaintyStatistics * forNode(mitk::DataNode::Pointer node);
+    static void setForNode(mitk::DataNode::Pointer node, const UncertaintyStatistics & statistics);
+    void compute(mitk::Image::Pointer image);
+    bool isFor(mitk::Image::Pointer image) const;
+    void rebind(mitk::Image::Pointer image);
+
+    double getMin() const;
+    double getMax() const;
+    double getSum() const;
+    double getSumOfSquares() const;
+    double getMean() const;
+    double getVariance() const;
+    itk::uint64_t getNumberOfVoxels() const;
+    itk::uint64_t getNumberOfNonZeros() const;
+    const std::vector<itk::uint64_t> & getHistogram() const;
+    unsigned int histogramBinContaining(double value) const;
+    double histogramBinMax(unsigned int bin) const;
+    double histogramBinCentre(unsigned int bin) const;
+    bool hasNonZeros() const;
+    itk::ImageRegion<3> getNonZeroRegion() const;
+
+  private:
+    // The image the statistics are for (and when).
+    const mitk::Image * computedImage;
+    unsigned long computedMTime;
+
+    double min;
+    double max;
+    double sum;
+    double sumOfSquares;
+    itk::uint64_t numberOfVoxels;
+    itk::uint64_t numberOfNonZeros;
+    std::vector<itk::uint64_t> histogram;
+    itk::ImageRegion<3> nonZeroRegion;
+
+    struct SlabStatistics;
+    template <typename TPixel>
+    struct SlabAccumulator;
+
+    static const char * PROPERTY_NAME;
+    static UncertaintyStatistics & propertyStatistics(mitk::DataNode::Pointer node);
+
+    // ITK Methods
+    template <typename TPixel, unsigned int VImageDimension>
+    void ItkComputeStatistics(itk::Image<TPixel, VImageDimension>* itkImage);
+};
+
+/**
+  * Holds an UncertaintyStatistics on a DataNode (see UncertaintyStatistics::forNode).
+  */
+class UncertaintyStatisticsProperty : public mitk::BaseProperty {
+  public:
+    mitkClassMacro(UncertaintyStatisticsProperty, mitk::BaseProperty);
+    itkFactorylessNewMacro(Self)
+    itkCloneMacro(Self)
+
+    UncertaintyStatistics & GetStatistics();
+    virtual std::string GetValueAsString() const;
+
+  protected:
+    UncertaintyStatisticsProperty();
+    UncertaintyStatisticsProperty(const UncertaintyStatisticsProperty & other);
+
+  private:
+    UncertaintyStatistics statistics;
+
+    virtual itk::LightObject::Pointer InternalClone() const;
+    virtual bool IsEqual(const mitk::BaseProperty & property) const;
+    virtual bool Assign(const mitk::BaseProperty & property);
+};
+
+#endif
\ No newline at end of file
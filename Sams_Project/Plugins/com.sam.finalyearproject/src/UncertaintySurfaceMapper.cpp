@@ -4,6 +4,7 @@
 #include "Util.h"
 
 #include <cstdio>
+#include <sstream>
 
 #include <vtkSmartPointer.h>
 #include <vtkFloatArray.h>
@@ -11,6 +12,10 @@
 #include <vtkVector.h>
 #include <vtkUnsignedCharArray.h>
 #include <vtkPointData.h>
+#include <vtkPointLocator.h>
+#include <vtkPoints.h>
+#include <vtkDataArray.h>
+#include <vtkMath.h>
 
 #include <itkImportImageFilter.h>
 #include <itkRescaleIntensityImageFilter.h>
@@ -30,6 +35,8 @@ UncertaintySurfaceMapper::UncertaintySurfaceMapper() {
   setSamplingAccumulator(AVERAGE);
   setRegistration(SIMPLE);
   setDebugRegistration(false);
+  setShareAntipodalRays(false);
+  setIncremental(false);
 }
 
 /**
@@ -111,6 +118,83 @@ void UncertaintySurfaceMapper::setDebugRegistration(bool debugRegistration) {
   this->debugRegistration = debugRegistration;
 }
 
+/**
+  * Sets whether opposite points on a sphere should share a ray (SPHERE registration with HALF sampling only).
+  * The two points each sample half of the same line through the volume, so instead it's marched once
+  * and split between them at the middle of the uncertainty along that line. Halves the work.
+  * Sampling each point separately stops where its own ray reaches half way, which isn't always the same split, so
+  * the result can differ a little. Off by default.
+  * Points without an opposite point on the surface are sampled normally.
+  */
+void UncertaintySurfaceMapper::setShareAntipodalRays(bool shareAntipodalRays) {
+  this->shareAntipodalRays = shareAntipodalRays;
+}
+
+/**
+  * Sets whether to keep track of what each point sampled so mapping the same surface again (with the same settings)
+  * only resamples the points whose rays cross bricks of the uncertainty that have changed (see UncertaintyBrickIndex).
+  * Not used with debug registration (as that changes the uncertainty as it goes).
+  */
+void UncertaintySurfaceMapper::setIncremental(bool incremental) {
+  this->incremental = incremental;
+}
+
+/**
+  * Describes everything (other than the uncertainty) that affects the sampled intensities.
+  * If it's the same as last time, the previous intensities can be reused.
+  * NOTE: Uses the modified times of the points and normals as the colours get written to the surface.
+  */
+std::string UncertaintySurfaceMapper::settingsKey(vtkPolyData * surfacePolyData) {
+  std::ostringstream key;
+  key << surfacePolyData << " " << surfacePolyData->GetNumberOfPoints() << " " << surfacePolyData->GetPoints()->GetMTime();
+  if (surfacePolyData->GetPointData()->GetNormals()) {
+    key << " " << surfacePolyData->GetPointData()->GetNormals()->GetMTime();
+  }
+  key << " " << samplingDistance << " " << samplingAccumulator << " " << registration << " " << invertNormals << " " << shareAntipodalRays;
+  return key.str();
+}
+
+/**
+  * Finds the index of the point on the other side of the sphere for each point on the surface.
+  * Points without an opposite point are given -1.
+  */
+std::vector<vtkIdType> UncertaintySurfaceMapper::findAntipodalPoints(vtkPolyData * surfacePolyData) {
+  unsigned int numberOfPoints = surfacePolyData->GetNumberOfPoints();
+  std::vector<vtkIdType> antipodes(numberOfPoints, -1);
+
+  vtkSmartPointer<vtkPointLocator> locator = vtkSmartPointer<vtkPointLocator>::New();
+  locator->SetDataSet(surfacePolyData);
+  locator->BuildLocator();
+
+  for (unsigned int i = 0; i < numberOfPoints; i++) {
+    double point[3];
+    surfacePolyData->GetPoint(i, point);
+    double opposite[3] = {-point[0], -point[1], -point[2]};
+
+    vtkIdType closest = locator->FindClosestPoint(opposite);
+    if (closest < 0 || closest == (vtkIdType) i) {
+      continue;
+    }
+
+    // Only accept it if it's (almost) exactly opposite.
+    double closestPoint[3];
+    surfacePolyData->GetPoint(closest, closestPoint);
+    double tolerance = 0.001 * vtkMath::Norm(point);
+    if (vtkMath::Distance2BetweenPoints(closestPoint, opposite) <= tolerance * tolerance) {
+      antipodes[i] = closest;
+    }
+  }
+
+  // Make sure pairs agree with each other (i.e. i -> j and j -> i).
+  for (unsigned int i = 0; i < numberOfPoints; i++) {
+    if (antipodes[i] >= 0 && antipodes[antipodes[i]] != (vtkIdType) i) {
+      antipodes[i] = -1;
+    }
+  }
+
+  return antipodes;
+}
+
 /**
   * Maps the uncertainty to the surface.
   */
@@ -222,7 +306,45 @@ void UncertaintySurfaceMapper::map() {
   plane[2] = mitk::PlaneGeometry::New();
   plane[2]->InitializePlane(zOrigin, zNormal);
 
+  // Pair up opposite points so each line through the sphere is only marched once.
+  bool sharingRays = shareAntipodalRays && registration == SPHERE && samplingDistance == HALF;
+  std::vector<vtkIdType> antipodes;
+  if (sharingRays) {
+    antipodes = findAntipodalPoints(surfacePolyData);
+  }
+
+  // When mapping incrementally, only resample points whose rays read bricks that have changed since last time.
+  bool recordingRays = incremental && !debugRegistration;
+  std::vector<bool> resample(numberOfPoints, true);
+  std::vector<unsigned int> touchedBricks;
+  if (recordingRays) {
+    std::vector<bool> dirtyBricks = brickIndex.updateBricks(this->uncertainty);
+    std::string settings = settingsKey(surfacePolyData);
+    if (settings == previousSettings && previousIntensities.size() == numberOfPoints && brickIndex.hasRays(numberOfPoints)) {
+      resample.assign(numberOfPoints, false);
+      std::vector<unsigned int> dirtyRays = brickIndex.findDirtyRays(dirtyBricks);
+      for (unsigned int i = 0; i < dirtyRays.size(); i++) {
+        resample[dirtyRays[i]] = true;
+      }
+      if (DEBUGGING) {
+        std::cout << "Resampling " << dirtyRays.size() << " of " << numberOfPoints << " points." << std::endl;
+      }
+    }
+    else {
+      brickIndex.resetRays(numberOfPoints);
+    }
+    previousSettings = settings;
+    sampler->setBrickRecording(&brickIndex, &touchedBricks);
+  }
+
   for (unsigned int i = 0; i < numberOfPoints; i++) {
+    // Nothing this point depends on has changed.
+    if (!resample[i]) {
+      intensityArray[i] = previousIntensities[i];
+      mitk::ProgressBar::GetInstance()->Progress();
+      continue;
+    }
+
     // Get the position of point i
     double positionOfPoint[3];
     surfacePolyData->GetPoint(i, positionOfPoint);
@@ -334,15 +456,21 @@ void UncertaintySurfaceMapper::map() {
     if (debugRegistration) {
         try  {
           // See if the uncertainty data is available to be written to.
-          mitk::ImagePixelWriteAccessor<double, 3> writeAccess(this->uncertainty);
           itk::Index<3> index;
           index[0] = std::min(uncertaintyHeight - 1.0, std::max(0.0, round(position[0])));
           index[1] = std::min(uncertaintyWidth - 1.0, std::max(0.0, round(position[1])));
           index[2] = std::min(uncertaintyDepth - 1.0, std::max(0.0, round(position[2])));
-          writeAccess.SetPixelByIndexSafe(index, 1.0);
+          if (Util::IsSinglePrecision(this->uncertainty)) {
+            mitk::ImagePixelWriteAccessor<float, 3> writeAccess(this->uncertainty);
+            writeAccess.SetPixelByIndexSafe(index, 1.0f);
+          }
+          else {
+            mitk::ImagePixelWriteAccessor<double, 3> writeAccess(this->uncertainty);
+            writeAccess.SetPixelByIndexSafe(index, 1.0);
+          }
         }
         catch (mitk::Exception & e) {
-          std::cerr << "Hmmm... it appears we can't get read access to the uncertainty image. Maybe it's gone? Maybe it's type isn't double? (I've assumed it is)" << e << std::endl;
+          std::cerr << "Hmmm... it appears we can't get read access to the uncertainty image. Maybe it's gone? Maybe it's type isn't double or float? (I've assumed it is)" << e << std::endl;
           std::cerr << "Continuing without marking registered point in uncertainty." << std::endl;
         }
     }
@@ -361,14 +489,41 @@ void UncertaintySurfaceMapper::map() {
       normal[2] = -normal[2];
     }
 
-    // Use the position and normal to sample the uncertainty data.
-    switch(samplingDistance) {
-     case FULL: intensityArray[i] = sampler->sampleUncertainty(position, normal); break;
-     case HALF: intensityArray[i] = sampler->sampleUncertainty(position, normal, 50); break;
+    // The opposite point has already sampled this one.
+    if (sharingRays && antipodes[i] >= 0 && antipodes[i] < (vtkIdType) i) {
+      mitk::ProgressBar::GetInstance()->Progress();
+      continue;
+    }
+
+    touchedBricks.clear();
+
+    // March all the way through the sphere and give each half to this point and the opposite one.
+    if (sharingRays && antipodes[i] >= 0) {
+      sampler->sampleUncertaintyHalves(position, normal, intensityArray[i], intensityArray[antipodes[i]]);
+      if (recordingRays) {
+        brickIndex.setRayBricks(antipodes[i], touchedBricks);
+      }
+    }
+    else {
+      // Use the position and normal to sample the uncertainty data.
+      switch(samplingDistance) {
+       case FULL: intensityArray[i] = sampler->sampleUncertainty(position, normal); break;
+       case HALF: intensityArray[i] = sampler->sampleUncertainty(position, normal, 50); break;
+      }
+    }
+
+    if (recordingRays) {
+      brickIndex.setRayBricks(i, touchedBricks);
     }
 
     mitk::ProgressBar::GetInstance()->Progress();
   }
+
+  // Keep the raw intensities and the bricks each ray read, for next time.
+  if (recordingRays) {
+    brickIndex.finishRays();
+    previousIntensities.assign(intensityArray, intensityArray + numberOfPoints);
+  }
   
   mitk::ProgressBar::GetInstance()->Progress();
 
@@ -4,6 +4,14 @@
 #include <mitkImage.h>
 #include <mitkSurface.h>
 
+#include <vector>
+#include <string>
+#include <vtkType.h>
+
+#include "UncertaintyBrickIndex.h"
+
+class vtkPolyData;
+
 class UncertaintySurfaceMapper {
   public:
     enum SAMPLING_DISTANCE {HALF, FULL};
@@ -22,6 +30,8 @@ class UncertaintySurfaceMapper {
     void setRegistration(REGISTRATION registration);
     void setInvertNormals(bool invertNormals);
     void setDebugRegistration(bool debugRegistration);
+    void setShareAntipodalRays(bool shareAntipodalRays);
+    void setIncremental(bool incremental);
     void map();
 
     double getLegendMinValue();
@@ -43,6 +53,16 @@ class UncertaintySurfaceMapper {
 
     bool invertNormals;
     bool debugRegistration;
+    bool shareAntipodalRays;
+
+    static std::vector<vtkIdType> findAntipodalPoints(vtkPolyData * surfacePolyData);
+
+    // Incremental mapping.
+    bool incremental;
+    UncertaintyBrickIndex brickIndex;
+    std::vector<double> previousIntensities;
+    std::string previousSettings;
+    std::string settingsKey(vtkPolyData * surfacePolyData);
 
     double legendMinValue, legendMaxValue;
 
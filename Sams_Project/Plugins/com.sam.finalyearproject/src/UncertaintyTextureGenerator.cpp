@@ -1,6 +1,15 @@
 #include "UncertaintyTextureGenerator.h"
 
 #include "UncertaintySampler.h"
+#include "ParallelFor.h"
+#include "Util.h"
+
+#include <vector>
+#include <algorithm> // for min/max
+#include <cmath> // floor
+#include <cfloat> // DBL_MAX
+#include <sstream>
+
 #include <mitkImageCast.h>
 #include <itkRescaleIntensityImageFilter.h>
 
@@ -8,6 +17,16 @@
 #include "MitkLoadingBarCommand.h"
 #include <mitkProgressBar.h>
 
+UncertaintyTextureGenerator::UncertaintyTextureGenerator() {
+  setScalingLinear(false);
+  setSamplingAverage();
+  setShareAntipodalRays(false);
+  setParametrization(SphereParametrization::EQUIRECTANGULAR);
+  setIncremental(false);
+  cancelled = false;
+  previousLevelNumber = 0;
+}
+
 /**
   * Sets the uncertainty to make a texture from.
   */
@@ -33,6 +52,27 @@ void UncertaintyTextureGenerator::setScalingLinear(bool scalingLinear) {
   this->scalingLinear = scalingLinear;
 }
 
+/**
+  * Sets whether opposite texels should share a ray.
+  * Each texel samples from the center to the edge, so the texel for direction d and the texel for -d
+  * sample the two halves of the same line. If enabled, that line is marched once and split between them (both
+  * get the sample at the center). Halves the work. Off by default. Texels without an exact opposite (the top row, or all of them if the width is odd)
+  * are sampled normally.
+  */
+void UncertaintyTextureGenerator::setShareAntipodalRays(bool shareAntipodalRays) {
+  this->shareAntipodalRays = shareAntipodalRays;
+}
+
+/**
+  * Sets how the sphere is laid out in the texture (see SphereParametrization).
+  * For OCTAHEDRAL and CUBE_MAP the width set in setDimensions is used as the number of texels around
+  * the equator and the texture is sized to give about the same resolution with fewer texels.
+  * The sphere surface must be generated with the same parametrization.
+  */
+void UncertaintyTextureGenerator::setParametrization(SphereParametrization::TYPE parametrization) {
+  this->parametrization = parametrization;
+}
+
 /**
   * Resets the sampling variables.
   */
@@ -66,14 +106,471 @@ void UncertaintyTextureGenerator::setSamplingMaximum() {
   this->samplingMaximum = true;
 }
 
+/**
+  * Samples the texels of one tile of the texture.
+  * Each thread has its own sampler and each tile only writes to its own texels, so tiles can be
+  * sampled in parallel.
+  */
+struct UncertaintyTextureGenerator::TileSampler {
+  std::vector<UncertaintySampler *> samplers;
+  unsigned char * texture;
+  unsigned int textureWidth, textureHeight;
+  unsigned int tilesAcross;
+  vtkVector<float, 3> center;
+  unsigned int uncertaintyHeight, uncertaintyWidth, uncertaintyDepth;
+  bool shareAntipodalRays;
+  SphereParametrization::TYPE parametrization;
+
+  // Texels that line up with a texel of a coarser texture are copied from it rather than sampled again.
+  const unsigned char * coarseTexture;
+  unsigned int coarseWidth, coarseHeight;
+  bool centeredTexels;
+
+  // Texels not flagged in texelsToSample are copied from the previous texture (NULL to sample them all).
+  const std::vector<bool> * texelsToSample;
+  const unsigned char * previousTexture;
+
+  // Where to record the bricks each texel's ray reads (NULL to not record), with a list per thread to collect them in.
+  // Texels copied from the coarser texture get the bricks its ray read.
+  UncertaintyBrickIndex * brickIndex;
+  const UncertaintyBrickIndex * coarseBrickIndex;
+  std::vector<std::vector<unsigned int> > * touchedBricks;
+
+  // Tiles are skipped once the generator is cancelled.
+  volatile bool * cancelled;
+
+  void operator()(unsigned int tile, unsigned int threadID) {
+    if (*cancelled) {
+      return;
+    }
+
+    unsigned int rowStart = (tile / tilesAcross) * TILE_SIZE;
+    unsigned int rowEnd = std::min(rowStart + TILE_SIZE, textureHeight);
+    unsigned int colStart = (tile % tilesAcross) * TILE_SIZE;
+    unsigned int colEnd = std::min(colStart + TILE_SIZE, textureWidth);
+
+    UncertaintySampler * sampler = samplers[threadID];
+    std::vector<unsigned int> * touched = (brickIndex != NULL) ? &(*touchedBricks)[threadID] : NULL;
+    for (unsigned int r = rowStart; r < rowEnd; r++) {
+      for (unsigned int c = colStart; c < colEnd; c++) {
+        unsigned int texel = r * textureWidth + c;
+
+        // Nothing this texel depends on has changed since the previous texture.
+        if (texelsToSample != NULL && !(*texelsToSample)[texel]) {
+          texture[texel] = previousTexture[texel];
+          continue;
+        }
+
+        vtkVector<float, 3> direction = texelDirection(r, c, textureWidth, textureHeight, parametrization);
+        unsigned int coarseR, coarseC;
+
+        // If the opposite texel exists, one of the pair marches the whole line for both of them.
+        unsigned int oppositeR, oppositeC;
+        if (shareAntipodalRays && antipodalTexel(r, c, textureWidth, textureHeight, parametrization, oppositeR, oppositeC)) {
+          // The other texel of the pair does the work.
+          if (oppositeR < r || (oppositeR == r && oppositeC < c)) {
+            continue;
+          }
+          unsigned int oppositeTexel = oppositeR * textureWidth + oppositeC;
+
+          // Both already sampled in the coarser texture.
+          unsigned int oppositeCoarseR, oppositeCoarseC;
+          if (coarseTexel(r, c, coarseR, coarseC) && coarseTexel(oppositeR, oppositeC, oppositeCoarseR, oppositeCoarseC)) {
+            copyCoarseTexel(texel, coarseR * coarseWidth + coarseC, touched);
+            copyCoarseTexel(oppositeTexel, oppositeCoarseR * coarseWidth + oppositeCoarseC, touched);
+            continue;
+          }
+
+          // Start at the edge of the uncertainty on the opposite side and march through the center.
+          unsigned int stepsToCenter = stepsToEdge(Util::vectorScale(direction, -1.0f));
+          vtkVector<float, 3> start = Util::vectorSubtract(center, Util::vectorScale(direction, stepsToCenter));
+
+          if (touched != NULL) {
+            touched->clear();
+          }
+          double oppositeValue, value;
+          sampler->sampleUncertaintyHalves(start, direction, stepsToCenter, oppositeValue, value);
+
+          int pixelValue = value * 255;
+          int oppositePixelValue = oppositeValue * 255;
+          texture[texel] = pixelValue;
+          texture[oppositeTexel] = oppositePixelValue;
+
+          // Both halves depend on the whole line.
+          if (touched != NULL) {
+            brickIndex->setRayBricks(texel, *touched);
+            brickIndex->setRayBricks(oppositeTexel, *touched);
+          }
+          continue;
+        }
+
+        // Already sampled in the coarser texture.
+        if (coarseTexel(r, c, coarseR, coarseC)) {
+          copyCoarseTexel(texel, coarseR * coarseWidth + coarseC, touched);
+          continue;
+        }
+
+        // Sample the uncertainty data and write it straight into the texture.
+        if (touched != NULL) {
+          touched->clear();
+        }
+        int pixelValue = sampler->sampleUncertainty(center, direction) * 255;
+        texture[texel] = pixelValue;
+        if (touched != NULL) {
+          brickIndex->setRayBricks(texel, *touched);
+        }
+      }
+    }
+  }
+
+  /**
+    * Copies a texel from the coarser texture (along with the bricks its ray read, if recording).
+    */
+  void copyCoarseTexel(unsigned int texel, unsigned int coarseTexel, std::vector<unsigned int> * touched) {
+    texture[texel] = coarseTexture[coarseTexel];
+    if (touched != NULL && coarseBrickIndex != NULL) {
+      *touched = coarseBrickIndex->getRayBricks(coarseTexel);
+      brickIndex->setRayBricks(texel, *touched);
+    }
+  }
+
+  /**
+    * Finds the texel in the coarser texture with exactly the same direction as texel (r, c), if there is one.
+    *   Corner sampled (equirectangular) texels line up when r * coarseHeight / textureHeight is whole.
+    *   Center sampled texels line up when (r + 0.5) * coarseHeight / textureHeight - 0.5 is whole.
+    */
+  bool coarseTexel(unsigned int r, unsigned int c, unsigned int & coarseR, unsigned int & coarseC) {
+    if (coarseTexture == NULL) {
+      return false;
+    }
+    return coarseIndex(r, textureHeight, coarseHeight, coarseR) && coarseIndex(c, textureWidth, coarseWidth, coarseC);
+  }
+
+  bool coarseIndex(unsigned int index, unsigned int size, unsigned int coarseSize, unsigned int & coarseIndex) {
+    unsigned long scaled, denominator;
+    if (centeredTexels) {
+      // (2 * index + 1) * coarseSize = (2 * coarseIndex + 1) * size
+      scaled = (2ul * index + 1) * coarseSize;
+      if (scaled < size) {
+        return false;
+      }
+      scaled -= size;
+      denominator = 2ul * size;
+    }
+    else {
+      scaled = (unsigned long) index * coarseSize;
+      denominator = size;
+    }
+
+    if (scaled % denominator != 0) {
+      return false;
+    }
+    coarseIndex = scaled / denominator;
+    return coarseIndex < coarseSize;
+  }
+
+  /**
+    * The number of whole unit steps we can take from the center in direction before leaving the uncertainty.
+    */
+  unsigned int stepsToEdge(vtkVector<float, 3> direction) {
+    unsigned int size[3] = {uncertaintyHeight, uncertaintyWidth, uncertaintyDepth};
+    double distance = DBL_MAX;
+    for (unsigned int i = 0; i < 3; i++) {
+      if (direction[i] > 0.000001) {
+        distance = std::min(distance, ((size[i] - 0.5) - center[i]) / direction[i]);
+      }
+      else if (direction[i] < -0.000001) {
+        distance = std::min(distance, (-0.5 - center[i]) / direction[i]);
+      }
+    }
+    // Stay slightly inside to avoid rounding errors putting us over the edge.
+    return std::max(0.0, floor(distance - 0.001));
+  }
+};
+
+/**
+  * Finds the texel on the opposite side of the sphere (i.e. direction -d for a texel with direction d).
+  * Returns false if there isn't a texel exactly opposite.
+  * For EQUIRECTANGULAR:
+  *   theta -> PI - theta, which is row (height - r). There is no row opposite the top row.
+  *   phi -> phi + PI, which is column (c + width / 2). Only exact if the width is even.
+  * For the others we look up -d in the texture and check that texel's center really is opposite.
+  */
+bool UncertaintyTextureGenerator::antipodalTexel(unsigned int r, unsigned int c, unsigned int width, unsigned int height, SphereParametrization::TYPE parametrization, unsigned int & oppositeR, unsigned int & oppositeC) {
+  if (parametrization == SphereParametrization::EQUIRECTANGULAR) {
+    if (r == 0 || width % 2 != 0) {
+      return false;
+    }
+
+    oppositeR = height - r;
+    oppositeC = (c + width / 2) % width;
+    return true;
+  }
+
+  vtkVector<float, 3> opposite = Util::vectorScale(texelDirection(r, c, width, height, parametrization), -1.0f);
+  double s, t;
+  SphereParametrization::textureCoordinates(parametrization, opposite, s, t);
+  oppositeC = std::min(width - 1.0, std::max(0.0, floor(s * width)));
+  oppositeR = std::min(height - 1.0, std::max(0.0, floor(t * height)));
+
+  vtkVector<float, 3> oppositeDirection = texelDirection(oppositeR, oppositeC, width, height, parametrization);
+  return oppositeDirection.Dot(opposite) > 0.99999;
+}
+
+/**
+  * Computes the direction (from the center of the sphere) that a texel represents.
+  * Matches the texture coordinates from SurfaceGenerator::generateSphere.
+  * For EQUIRECTANGULAR (the same as vtkTextureMapToSphere):
+  *   rows go from the +z pole (theta = 0) to the -z pole (theta = PI).
+  *   columns go around the z axis starting at +x (phi = 0 to 2PI).
+  * For the others we use the direction through the center of the texel.
+  */
+vtkVector<float, 3> UncertaintyTextureGenerator::texelDirection(unsigned int r, unsigned int c, unsigned int width, unsigned int height, SphereParametrization::TYPE parametrization) {
+  if (parametrization != SphereParametrization::EQUIRECTANGULAR) {
+    return SphereParametrization::direction(parametrization, (c + 0.5) / width, (r + 0.5) / height);
+  }
+
+  // Compute spherical coordinates: phi (longitude) & theta (latitude).
+  float theta = ((float) r / (float) height) * M_PI;
+  float phi = ((float) c / (float) width) * (2 * M_PI);
+
+  // Compute point on sphere with radius 1. This is also the vector from the center of the sphere to the point.
+  vtkVector<float, 3> direction = vtkVector<float, 3>();
+  direction[0] = cos(phi) * sin(theta);
+  direction[1] = sin(phi) * sin(theta);
+  direction[2] = cos(theta);
+  direction.Normalize();
+  return direction;
+}
+
 /**
   * Generates a texture that represents the uncertainty of the uncertainty volume.
   * It works by projecting a point in the center of the volume outwards, onto a sphere.
+  * The texture is split into tiles which are sampled in parallel.
+  * If incremental (and nothing but the uncertainty has changed) only texels whose rays cross changed bricks are resampled.
   */
 mitk::Image::Pointer UncertaintyTextureGenerator::generateUncertaintyTextureGenerator() {
-  mitk::ProgressBar::GetInstance()->AddStepsToDo(textureWidth * textureHeight);
-  if (scalingLinear) {
-    mitk::ProgressBar::GetInstance()->AddStepsToDo(100);
+  cancelled = false;
+
+  unsigned int width, height;
+  getTextureSize(width, height);
+
+  if (!incremental) {
+    TextureImageType::Pointer texture = sampleTexture(width, height, NULL, NULL, NULL, NULL, true);
+    return finishTexture(texture, true);
+  }
+
+  // Find the bricks that have changed, and from them the texels that need resampling.
+  bool update = canUpdateIncrementally();
+  std::vector<bool> dirtyBricks = brickIndex.updateBricks(this->uncertainty);
+  update = update && brickIndex.hasRays(width * height);
+
+  TextureImageType::Pointer texture;
+  if (update) {
+    std::vector<bool> texelsToSample(width * height, false);
+    std::vector<unsigned int> dirtyRays = brickIndex.findDirtyRays(dirtyBricks);
+    for (unsigned int i = 0; i < dirtyRays.size(); i++) {
+      texelsToSample[dirtyRays[i]] = true;
+    }
+    if (DEBUGGING) {
+      std::cout << "Resampling " << dirtyRays.size() << " of " << (width * height) << " texels." << std::endl;
+    }
+    texture = sampleTexture(width, height, NULL, NULL, &texelsToSample, lastFullTexture, true);
+  }
+  else {
+    brickIndex.resetRays(width * height);
+    texture = sampleTexture(width, height, NULL, NULL, NULL, NULL, true);
+  }
+
+  brickIndex.finishRays();
+  lastFullTexture = texture;
+  lastFullTextureSettings = settingsKey();
+  return finishTexture(texture, true);
+}
+
+/**
+  * Sets whether to keep track of what each texel sampled so that generating the full texture again (with the same settings)
+  * only resamples the texels whose rays cross bricks of the uncertainty that have changed (see UncertaintyBrickIndex).
+  * Tracked for generateUncertaintyTextureGenerator() and the last level of generateLevel().
+  */
+void UncertaintyTextureGenerator::setIncremental(bool incremental) {
+  this->incremental = incremental;
+}
+
+/**
+  * Whether generateUncertaintyTextureGenerator() can reuse the last full texture (i.e. only the uncertainty has changed since).
+  */
+bool UncertaintyTextureGenerator::canUpdateIncrementally() {
+  unsigned int width, height;
+  getTextureSize(width, height);
+  return incremental && lastFullTexture.IsNotNull() && lastFullTextureSettings == settingsKey() && brickIndex.hasRays(width * height);
+}
+
+/**
+  * Describes everything (other than the uncertainty's values) that affects the sampled texels.
+  */
+std::string UncertaintyTextureGenerator::settingsKey() {
+  unsigned int width, height;
+  getTextureSize(width, height);
+
+  std::ostringstream key;
+  key << width << " " << height << " " << parametrization << " " << shareAntipodalRays << " ";
+  key << samplingAverage << samplingMinimum << samplingMaximum << " ";
+  key << uncertaintyHeight << " " << uncertaintyWidth << " " << uncertaintyDepth;
+  return key.str();
+}
+
+/**
+  * Cancels generation. Any texture being sampled is abandoned (generateLevel returns NULL).
+  * Safe to call from another thread. Generation is started again by generateLevel(0) or generateUncertaintyTextureGenerator().
+  */
+void UncertaintyTextureGenerator::cancel() {
+  cancelled = true;
+}
+
+/**
+  * The number of levels for progressive generation (see generateLevel).
+  * Each level is a factor finer than the last, down to a coarsest level at least COARSEST_WIDTH texels wide.
+  */
+unsigned int UncertaintyTextureGenerator::getNumberOfLevels() {
+  unsigned int width, height;
+  getTextureSize(width, height);
+
+  unsigned int factor = getLevelFactor();
+  unsigned int levels = 1;
+  unsigned int divisor = factor;
+  while (width / divisor >= COARSEST_WIDTH) {
+    levels++;
+    divisor *= factor;
+  }
+  return levels;
+}
+
+/**
+  * Generates one level of the texture, from 0 (coarsest) to getNumberOfLevels() - 1 (the full texture).
+  * Texels that line up with the previous level (if it was the level just generated) are copied from it,
+  * so generating every level in turn costs little more than generating the last one.
+  * Returns NULL if cancelled.
+  *   reportProgress - whether to use the loading bar. Only allowed from the GUI thread.
+  */
+mitk::Image::Pointer UncertaintyTextureGenerator::generateLevel(unsigned int level, bool reportProgress) {
+  // Starting again.
+  if (level == 0) {
+    cancelled = false;
+    if (incremental) {
+      brickIndex.updateBricks(this->uncertainty);
+    }
+  }
+
+  unsigned int width, height;
+  getLevelSize(level, width, height);
+
+  TextureImageType::Pointer coarser = NULL;
+  if (level > 0 && previousLevel.IsNotNull() && previousLevelNumber == level - 1) {
+    coarser = previousLevel;
+  }
+
+  // Texels copied from the coarser level need the bricks its rays read (moved out, rather than copied, as this level
+  // records its own).
+  UncertaintyBrickIndex coarserBricks;
+  if (incremental) {
+    if (coarser.IsNotNull()) {
+      brickIndex.swapRays(coarserBricks);
+    }
+    brickIndex.resetRays(width * height);
+  }
+
+  TextureImageType::Pointer texture = sampleTexture(width, height, coarser, (incremental && coarser.IsNotNull()) ? &coarserBricks : NULL, NULL, NULL, reportProgress);
+  if (cancelled) {
+    return NULL;
+  }
+
+  previousLevel = texture;
+  previousLevelNumber = level;
+
+  // The last level is the full texture, which can be updated incrementally later.
+  if (incremental && level == getNumberOfLevels() - 1) {
+    brickIndex.finishRays();
+    lastFullTexture = texture;
+    lastFullTextureSettings = settingsKey();
+  }
+
+  return finishTexture(texture, reportProgress);
+}
+
+/**
+  * The size of the full texture. Only equirectangular textures use the dimensions directly.
+  * The others are sized to match its resolution.
+  */
+void UncertaintyTextureGenerator::getTextureSize(unsigned int & width, unsigned int & height) {
+  width = textureWidth;
+  height = textureHeight;
+  if (parametrization != SphereParametrization::EQUIRECTANGULAR) {
+    SphereParametrization::textureSize(parametrization, textureWidth, width, height);
+  }
+}
+
+/**
+  * Equirectangular texels are sampled at their corners so halving lines texels up.
+  * The others are sampled at their centers so they need thirds (the middle of each 3 x 3 block lines up).
+  */
+unsigned int UncertaintyTextureGenerator::getLevelFactor() {
+  return (parametrization == SphereParametrization::EQUIRECTANGULAR) ? 2 : 3;
+}
+
+/**
+  * The size of a level of the texture (see generateLevel).
+  */
+void UncertaintyTextureGenerator::getLevelSize(unsigned int level, unsigned int & width, unsigned int & height) {
+  getTextureSize(width, height);
+
+  unsigned int levels = getNumberOfLevels();
+  unsigned int divisor = 1;
+  for (unsigned int i = level + 1; i < levels; i++) {
+    divisor *= getLevelFactor();
+  }
+
+  switch (parametrization) {
+    case SphereParametrization::EQUIRECTANGULAR:
+    {
+      width = std::max(1u, width / divisor);
+      height = std::max(1u, height / divisor);
+    }
+    break;
+
+    // Keep it square and even (so opposite texels line up).
+    case SphereParametrization::OCTAHEDRAL:
+    {
+      width = std::max(2u, ((width / divisor) / 2) * 2);
+      height = width;
+    }
+    break;
+
+    // Keep the faces square.
+    case SphereParametrization::CUBE_MAP:
+    {
+      unsigned int faceSize = std::max(1u, (width / 3) / divisor);
+      width = faceSize * 3;
+      height = faceSize * 2;
+    }
+    break;
+  }
+}
+
+/**
+  * Samples a texture of the given size in parallel tiles.
+  *   coarser - a coarser texture to copy lined up texels from (may be NULL).
+  *   coarserBricks - the bricks read by the coarser texture's rays (only needed if incremental).
+  *   texelsToSample - which texels to sample, the rest are copied from previous (NULL to sample them all).
+  *   reportProgress - whether to use the loading bar. Only allowed from the GUI thread.
+  */
+TextureImageType::Pointer UncertaintyTextureGenerator::sampleTexture(unsigned int width, unsigned int height, TextureImageType::Pointer coarser, const UncertaintyBrickIndex * coarserBricks, const std::vector<bool> * texelsToSample, TextureImageType::Pointer previous, bool reportProgress) {
+  unsigned int tilesAcross = (width + TILE_SIZE - 1) / TILE_SIZE;
+  unsigned int tilesDown = (height + TILE_SIZE - 1) / TILE_SIZE;
+  unsigned int numberOfTiles = tilesAcross * tilesDown;
+
+  if (reportProgress) {
+    mitk::ProgressBar::GetInstance()->AddStepsToDo(numberOfTiles);
   }
 
   // Create a blank ITK image.
@@ -83,8 +580,8 @@ mitk::Image::Pointer UncertaintyTextureGenerator::generateUncertaintyTextureGene
   start[1] = 0;
  
   TextureImageType::SizeType size;
-  size[0] = textureWidth;
-  size[1] = textureHeight;
+  size[0] = width;
+  size[1] = height;
  
   region.SetSize(size);
   region.SetIndex(start);
@@ -93,53 +590,72 @@ mitk::Image::Pointer UncertaintyTextureGenerator::generateUncertaintyTextureGene
   UncertaintyTextureGenerator->SetRegions(region);
   UncertaintyTextureGenerator->Allocate();
 
-  // Create an uncertainty sampler.
-  UncertaintySampler * sampler = new UncertaintySampler();
-  sampler->setUncertainty(this->uncertainty);
-  if (samplingAverage) {
-    sampler->setAverage();
-  }
-  else if (samplingMinimum) {
-    sampler->setMin();
-  }
-  else if (samplingMaximum) {
-    sampler->setMax();
-  } 
-
   // Compute center of uncertainty data.
   vtkVector<float, 3> center = vtkVector<float, 3>();
   center[0] = ((float) uncertaintyHeight - 1) / 2.0;
   center[1] = ((float) uncertaintyWidth - 1) / 2.0;
   center[2] = ((float) uncertaintyDepth - 1) / 2.0;
 
-  // For each pixel in the texture, sample the uncertainty data.
-  for (unsigned int r = 0; r < textureHeight; r++) {
-    for (unsigned int c = 0; c < textureWidth; c++) {
-      // Compute spherical coordinates: phi (longitude) & theta (latitude).
-      float theta = ((float) r / (float) textureHeight) * M_PI;
-      float phi = ((float) c / (float) textureWidth) * (2 * M_PI);
-      
-      // Compute point on sphere with radius 1. This is also the vector from the center of the sphere to the point.
-      vtkVector<float, 3> direction = vtkVector<float, 3>();
-      direction[0] = cos(phi) * sin(theta);
-      direction[1] = cos(theta);
-      direction[2] = sin(phi) * sin(theta);
-      direction.Normalize();
-
-      // Sample the uncertainty data.
-      int pixelValue = sampler->sampleUncertainty(center, direction) * 255;
-      
-      // Set texture value.
-      TextureImageType::IndexType pixelIndex;
-      pixelIndex[0] = c;
-      pixelIndex[1] = r;
-
-      UncertaintyTextureGenerator->SetPixel(pixelIndex, pixelValue);
-      mitk::ProgressBar::GetInstance()->Progress();
-    }
-  }
-  delete sampler;
+  // Create an uncertainty sampler for each thread.
+  TileSampler tileSampler;
+  tileSampler.texture = UncertaintyTextureGenerator->GetBufferPointer();
+  tileSampler.textureWidth = width;
+  tileSampler.textureHeight = height;
+  tileSampler.tilesAcross = tilesAcross;
+  tileSampler.center = center;
+  tileSampler.uncertaintyHeight = uncertaintyHeight;
+  tileSampler.uncertaintyWidth = uncertaintyWidth;
+  tileSampler.uncertaintyDepth = uncertaintyDepth;
+  tileSampler.shareAntipodalRays = shareAntipodalRays;
+  tileSampler.parametrization = parametrization;
+  tileSampler.coarseTexture = NULL;
+  tileSampler.coarseWidth = 0;
+  tileSampler.coarseHeight = 0;
+  if (coarser.IsNotNull()) {
+    tileSampler.coarseTexture = coarser->GetBufferPointer();
+    tileSampler.coarseWidth = coarser->GetLargestPossibleRegion().GetSize()[0];
+    tileSampler.coarseHeight = coarser->GetLargestPossibleRegion().GetSize()[1];
+  }
+  tileSampler.centeredTexels = (parametrization != SphereParametrization::EQUIRECTANGULAR);
+  tileSampler.texelsToSample = texelsToSample;
+  tileSampler.previousTexture = (previous.IsNotNull()) ? previous->GetBufferPointer() : NULL;
+  tileSampler.brickIndex = incremental ? &brickIndex : NULL;
+  tileSampler.coarseBrickIndex = coarserBricks;
+  std::vector<std::vector<unsigned int> > touchedBricks(ParallelFor::getNumberOfThreads());
+  tileSampler.touchedBricks = &touchedBricks;
+  tileSampler.cancelled = &cancelled;
+  for (unsigned int i = 0; i < ParallelFor::getNumberOfThreads(); i++) {
+    UncertaintySampler * sampler = new UncertaintySampler();
+    sampler->setUncertainty(this->uncertainty);
+    if (samplingAverage) {
+      sampler->setAverage();
+    }
+    else if (samplingMinimum) {
+      sampler->setMin();
+    }
+    else if (samplingMaximum) {
+      sampler->setMax();
+    }
+    if (incremental) {
+      sampler->setBrickRecording(&brickIndex, &touchedBricks[i]);
+    }
+    tileSampler.samplers.push_back(sampler);
+  }
+
+  // Sample each tile of the texture (one step on the loading bar per tile).
+  ParallelFor::run(numberOfTiles, tileSampler, reportProgress);
+
+  for (unsigned int i = 0; i < tileSampler.samplers.size(); i++) {
+    delete tileSampler.samplers[i];
+  }
+
+  return UncertaintyTextureGenerator;
+}
 
+/**
+  * Scales the sampled texture (if enabled), sets the legend and converts it to MITK.
+  */
+mitk::Image::Pointer UncertaintyTextureGenerator::finishTexture(TextureImageType::Pointer UncertaintyTextureGenerator, bool reportProgress) {
   // Scale the texture values to increase contrast.
   if (scalingLinear) {
     typedef itk::RescaleIntensityImageFilter<TextureImageType, TextureImageType> RescaleFilterType;
@@ -147,9 +663,12 @@ mitk::Image::Pointer UncertaintyTextureGenerator::generateUncertaintyTextureGene
     rescaleFilter->SetInput(UncertaintyTextureGenerator);
     rescaleFilter->SetOutputMinimum(0);
     rescaleFilter->SetOutputMaximum(255);
-    MitkLoadingBarCommand::Pointer command = MitkLoadingBarCommand::New();
-    command->Initialize(100, false);
-    rescaleFilter->AddObserver(itk::ProgressEvent(), command);
+    if (reportProgress) {
+      mitk::ProgressBar::GetInstance()->AddStepsToDo(100);
+      MitkLoadingBarCommand::Pointer command = MitkLoadingBarCommand::New();
+      command->Initialize(100, false);
+      rescaleFilter->AddObserver(itk::ProgressEvent(), command);
+    }
     rescaleFilter->Update();
     UncertaintyTextureGenerator = rescaleFilter->GetOutput();
     legendMinValue = rescaleFilter->GetInputMinimum() / 255.0;
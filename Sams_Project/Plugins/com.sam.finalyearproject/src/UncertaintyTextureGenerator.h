@@ -3,19 +3,38 @@
 
 #include <mitkImage.h>
 #include <itkImage.h>
+#include <vtkVector.h>
+
+#include <vector>
+#include <string>
+
+#include "SphereParametrization.h"
+#include "UncertaintyBrickIndex.h"
 
 typedef itk::Image<unsigned char, 2>  TextureImageType;
 
 class UncertaintyTextureGenerator {
 	public:
+    UncertaintyTextureGenerator();
     void setUncertainty(mitk::Image::Pointer image);
     void setDimensions(unsigned int width, unsigned int height);
     void setScalingLinear(bool scalingLinear);
     void setSamplingAverage();
     void setSamplingMinimum();
     void setSamplingMaximum();
+    void setShareAntipodalRays(bool shareAntipodalRays);
+    void setParametrization(SphereParametrization::TYPE parametrization);
     mitk::Image::Pointer generateUncertaintyTextureGenerator();
 
+    // Incremental generation.
+    void setIncremental(bool incremental);
+    bool canUpdateIncrementally();
+
+    // Progressive generation.
+    void cancel();
+    unsigned int getNumberOfLevels();
+    mitk::Image::Pointer generateLevel(unsigned int level, bool reportProgress = false);
+
     double getLegendMinValue();
     double getLegendMaxValue();
     void getLegendMinColour(char * colour);
@@ -32,7 +51,45 @@ class UncertaintyTextureGenerator {
     bool samplingAverage, samplingMinimum, samplingMaximum;
     void clearSampling();
 
+    bool shareAntipodalRays;
+    SphereParametrization::TYPE parametrization;
+
     double legendMinValue, legendMaxValue;
+
+    // The texture is sampled in square tiles of this size.
+    static const unsigned int TILE_SIZE = 64;
+    struct TileSampler;
+    static vtkVector<float, 3> texelDirection(unsigned int r, unsigned int c, unsigned int width, unsigned int height, SphereParametrization::TYPE parametrization);
+    TextureImageType::Pointer sampleTexture(
+      unsigned int width,
+      unsigned int height,
+      TextureImageType::Pointer coarser,
+      const UncertaintyBrickIndex * coarserBricks,
+      const std::vector<bool> * texelsToSample,
+      TextureImageType::Pointer previous,
+      bool reportProgress
+    );
+    mitk::Image::Pointer finishTexture(TextureImageType::Pointer texture, bool reportProgress);
+    void getTextureSize(unsigned int & width, unsigned int & height);
+
+    // Progressive generation.
+    static const unsigned int COARSEST_WIDTH = 64;
+    volatile bool cancelled;
+    TextureImageType::Pointer previousLevel;
+    unsigned int previousLevelNumber;
+    unsigned int getLevelFactor();
+    void getLevelSize(unsigned int level, unsigned int & width, unsigned int & height);
+
+    // Incremental generation.
+    bool incremental;
+    UncertaintyBrickIndex brickIndex;
+    TextureImageType::Pointer lastFullTexture;
+    std::string lastFullTextureSettings;
+    std::string settingsKey();
+
+    static const bool DEBUGGING = false;
+
+    static bool antipodalTexel(unsigned int r, unsigned int c, unsigned int width, unsigned int height, SphereParametrization::TYPE parametrization, unsigned int & oppositeR, unsigned int & oppositeC);
 };
 
 #endif
\ No newline at end of file
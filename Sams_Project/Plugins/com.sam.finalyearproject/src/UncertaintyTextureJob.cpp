@@ -0,0 +1,95 @@
+#include "UncertaintyTextureJob.h"
+
+#include <QMutexLocker>
+
+/**
+  * Creates a job that generates the levels of the generator's texture from firstLevel up to the full texture.
+  * id is passed back with levelGenerated().
+  */
+UncertaintyTextureJob::UncertaintyTextureJob(UncertaintyTextureGenerator * generator, unsigned int firstLevel, unsigned int id, QObject * parent) : QThread(parent) {
+  this->generator = generator;
+  this->firstLevel = firstLevel;
+  this->id = id;
+  this->numberOfLevels = generator->getNumberOfLevels();
+  this->level = 0;
+  this->legendMinValue = 0.0;
+  this->legendMaxValue = 1.0;
+}
+
+/**
+  * Cancels the job and waits for it to stop.
+  */
+UncertaintyTextureJob::~UncertaintyTextureJob() {
+  cancel();
+  wait();
+}
+
+/**
+  * Asks the job to stop. It stops after the tiles currently being sampled.
+  */
+void UncertaintyTextureJob::cancel() {
+  generator->cancel();
+}
+
+/**
+  * Generates each level in turn. Cancelled levels aren't published.
+  * NOTE: Runs on the job's own thread, so mustn't touch the loading bar or GUI.
+  */
+void UncertaintyTextureJob::run() {
+  for (unsigned int i = firstLevel; i < numberOfLevels; i++) {
+    mitk::Image::Pointer levelTexture = generator->generateLevel(i);
+    if (levelTexture.IsNull()) {
+      return;
+    }
+
+    {
+      QMutexLocker locker(&mutex);
+      texture = levelTexture;
+      level = i;
+      legendMinValue = generator->getLegendMinValue();
+      legendMaxValue = generator->getLegendMaxValue();
+    }
+    emit levelGenerated(id);
+  }
+}
+
+/**
+  * The most recently generated texture.
+  */
+mitk::Image::Pointer UncertaintyTextureJob::getTexture() {
+  QMutexLocker locker(&mutex);
+  return texture;
+}
+
+/**
+  * The level of the most recently generated texture.
+  */
+unsigned int UncertaintyTextureJob::getLevel() {
+  QMutexLocker locker(&mutex);
+  return level;
+}
+
+unsigned int UncertaintyTextureJob::getNumberOfLevels() {
+  return numberOfLevels;
+}
+
+/**
+  * For legend support. The legend for the most recently generated texture.
+  */
+double UncertaintyTextureJob::getLegendMinValue() {
+  QMutexLocker locker(&mutex);
+  return legendMinValue;
+}
+
+double UncertaintyTextureJob::getLegendMaxValue() {
+  QMutexLocker locker(&mutex);
+  return legendMaxValue;
+}
+
+void UncertaintyTextureJob::getLegendMinColour(char * colour) {
+  generator->getLegendMinColour(colour);
+}
+
+void UncertaintyTextureJob::getLegendMaxColour(char * colour) {
+  generator->getLegendMaxColour(colour);
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef Uncertainty_Texture_Job_h
+#define Uncertainty_Texture_Job_h
+
+#include <QThread>
+#include <QMutex>
+
+#include <mitkImage.h>
+
+#include "UncertaintyTextureGenerator.h"
+
+/**
+  * Refines an uncertainty texture in the background, one level at a time (see UncertaintyTextureGenerator::generateLevel).
+  * levelGenerated() is emitted as each level completes, with the id the job was made with. The texture can then be picked up
+  * (on the GUI thread) with getTexture(). The id tells a job's signal apart from those of deleted jobs that were still queued.
+  * The generator must outlive the job (deleting the job cancels it and waits for it to stop).
+  */
+class UncertaintyTextureJob : public QThread {
+  Q_OBJECT
+
+  public:
+    UncertaintyTextureJob(UncertaintyTextureGenerator * generator, unsigned int firstLevel, unsigned int id = 0, QObject * parent = 0);
+    virtual ~UncertaintyTextureJob();
+    void cancel();
+
+    mitk::Image::Pointer getTexture();
+    unsigned int getLevel();
+    unsigned int getNumberOfLevels();
+    double getLegendMinValue();
+    double getLegendMaxValue();
+    void getLegendMinColour(char * colour);
+    void getLegendMaxColour(char * colour);
+
+  signals:
+    void levelGenerated(unsigned int id);
+
+  protected:
+    virtual void run();
+
+  private:
+    UncertaintyTextureGenerator * generator;
+    unsigned int firstLevel;
+    unsigned int numberOfLevels;
+    unsigned int id;
+
+    // Latest level, guarded by the mutex.
+    QMutex mutex;
+    mitk::Image::Pointer texture;
+    unsigned int level;
+    double legendMinValue, legendMaxValue;
+};
+
+#endif
\ No newline at end of file
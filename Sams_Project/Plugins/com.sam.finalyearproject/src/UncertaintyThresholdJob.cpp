@@ -0,0 +1,89 @@
+#include "UncertaintyThresholdJob.h"
+
+/**
+  * Creates a job that thresholds the thresholder's uncertainty with the range [min, max].
+  * id is passed back with thresholded().
+  */
+UncertaintyThresholdJob::UncertaintyThresholdJob(UncertaintyThresholder * thresholder, double min, double max, unsigned int id, QObject * parent) : QThread(parent) {
+  this->thresholder = thresholder;
+  this->min = min;
+  this->max = max;
+  this->id = id;
+  this->cancelled = false;
+}
+
+/**
+  * Cancels the job and waits for it to stop.
+  */
+UncertaintyThresholdJob::~UncertaintyThresholdJob() {
+  cancel();
+  wait();
+}
+
+/**
+  * Also thresholds the uncertainty into bands with the given cuts (see UncertaintyThresholder::thresholdUncertaintyIntoBands).
+  * Must be called before the job is started.
+  */
+void UncertaintyThresholdJob::setBands(const std::vector<double> & cuts) {
+  bandCuts = cuts;
+}
+
+/**
+  * Asks the job to stop. A cancelled job doesn't emit thresholded() (every other job does, even if it failed).
+  */
+void UncertaintyThresholdJob::cancel() {
+  cancelled = true;
+}
+
+/**
+  * Does the threshold.
+  * NOTE: Runs on the job's own thread, so mustn't touch the loading bar or GUI.
+  */
+void UncertaintyThresholdJob::run() {
+  if (cancelled) {
+    return;
+  }
+
+  mask = thresholder->thresholdUncertainty(min, max, false, &cancelled);
+  if (!bandCuts.empty() && !cancelled) {
+    bands = thresholder->thresholdUncertaintyIntoBands(bandCuts, false);
+  }
+  if (cancelled) {
+    // The mask on screen has to stay the thresholder's last one (it's double buffered).
+    if (mask.IsNotNull()) {
+      thresholder->cancelThreshold();
+    }
+    mask = NULL;
+    bands = NULL;
+    return;
+  }
+  emit thresholded(id);
+}
+
+/**
+  * The mask. NULL until the job has finished (or if it was cancelled).
+  * NOTE: Only safe to call once thresholded() has been emitted (or the job has been waited for).
+  * If the mask isn't going to be shown, call UncertaintyThresholder::cancelThreshold.
+  */
+mitk::Image::Pointer UncertaintyThresholdJob::getMask() {
+  return mask;
+}
+
+/**
+  * The band labels. NULL if no bands were asked for (see setBands).
+  * NOTE: Only safe to call once thresholded() has been emitted.
+  */
+mitk::Image::Pointer UncertaintyThresholdJob::getBands() {
+  return bands;
+}
+
+/**
+  * The range asked for (before the thresholder moves it above zero, if it's ignoring zeros).
+  */
+double UncertaintyThresholdJob::getMin() {
+  return min;
+}
+
+double UncertaintyThresholdJob::getMax() {
+  return max;
+}
\ No newline at end of file
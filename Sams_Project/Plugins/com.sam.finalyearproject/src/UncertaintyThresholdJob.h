@@ -0,0 +1,52 @@
+#ifndef Uncertainty_Threshold_Job_h
+#define Uncertainty_Threshold_Job_h
+
+#include <QThread>
+#include <vector>
+
+#include <mitkImage.h>
+
+#include "UncertaintyThresholder.h"
+
+/**
+  * Thresholds the uncertainty in the background (see UncertaintyThresholder::thresholdUncertainty).
+  * thresholded() is emitted when it's done, with the id the job was made with. The mask can then be picked up (on the GUI
+  * thread) with getMask(). The id tells a job's signal apart from those of deleted jobs that were still queued.
+  * The thresholder should be double buffered, so the last mask can stay on screen while the next one is made.
+  * Nothing else may use the thresholder until the job has finished, and it must outlive the job
+  * (deleting the job cancels it and waits for it to stop).
+  */
+class UncertaintyThresholdJob : public QThread {
+  Q_OBJECT
+
+  public:
+    UncertaintyThresholdJob(UncertaintyThresholder * thresholder, double min, double max, unsigned int id = 0, QObject * parent = 0);
+    virtual ~UncertaintyThresholdJob();
+    void setBands(const std::vector<double> & cuts);
+    void cancel();
+
+    mitk::Image::Pointer getMask();
+    mitk::Image::Pointer getBands();
+    double getMin();
+    double getMax();
+
+  signals:
+    void thresholded(unsigned int id);
+
+  protected:
+    virtual void run();
+
+  private:
+    UncertaintyThresholder * thresholder;
+    double min;
+    double max;
+    unsigned int id;
+    std::vector<double> bandCuts;
+    volatile bool cancelled;
+
+    // Only set once the job has finished.
+    mitk::Image::Pointer mask;
+    mitk::Image::Pointer bands;
+};
+
+#endif
\ No newline at end of file
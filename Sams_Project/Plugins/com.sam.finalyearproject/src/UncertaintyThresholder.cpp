@@ -1,41 +1,85 @@
 #include "UncertaintyThresholder.h"
 
 #include <cfloat> // for DBL_MIN
+#include <algorithm> // for sort
 #include <mitkImageAccessByItk.h>
 #include <mitkImageCast.h>
-#include <itkBinaryThresholdImageFilter.h>
-#include <itkImageToHistogramFilter.h>
+#include <mitkITKImageImport.h>
+#include <mitkImagePixelWriteAccessor.h>
+
+#include "ParallelFor.h"
 
 // Loading bar
-#include "MitkLoadingBarCommand.h"
 #include <mitkProgressBar.h>
 
 UncertaintyThresholder::UncertaintyThresholder() {
   this->ignoreZeros = false;
-  this->measurementComponents = 1; // Grayscale
-  this->binsPerDimension = 1000;
-  this->histogram = NULL;
-  this->totalPixels = 0;
+  this->cropToNonZeros = false;
+  this->croppedUncertaintyMTime = 0;
+  this->maskMTime = 0;
+  this->maskMin = 0.0;
+  this->maskMax = 0.0;
+  this->bitPackedMaskMTime = 0;
+  this->doubleBuffered = false;
+  this->backMaskMTime = 0;
+  this->backMaskMin = 0.0;
+  this->backMaskMax = 0.0;
 }
 
 UncertaintyThresholder::~UncertaintyThresholder() {
-  if (histogram) {
-    delete histogram;
-  }
 }
 
 /**
   * Sets the uncertainty to be thresholded.
+  * The statistics (histogram), value index and mask are kept (between calls) for as long as the uncertainty is the
+  * same image and hasn't been modified.
   */
 void UncertaintyThresholder::setUncertainty(mitk::Image::Pointer uncertainty) {
   if (this->uncertainty == uncertainty) {
     return;
   }
   this->uncertainty = uncertainty;
-  if (histogram) {
-    delete histogram;
-    histogram = NULL;
-    totalPixels = 0;
+  this->croppedUncertainty = NULL;
+  this->mask = NULL;
+  this->backMask = NULL;
+  this->bitPackedMask.clear();
+}
+
+/**
+  * Gives the thresholder statistics that have already been computed (e.g. cached on the node) so it doesn't
+  * need to compute its own. Ignored if they aren't for the current uncertainty.
+  */
+void UncertaintyThresholder::setStatistics(const UncertaintyStatistics * statistics) {
+  if (statistics != NULL && statistics->isFor(uncertainty)) {
+    this->statistics = *statistics;
+  }
+}
+
+/**
+  * Only thresholds the given region of the uncertainty. The masks (and bands) are cropped to it, and placed where it is.
+  * An empty region (the default) means the whole uncertainty. Ignored if it doesn't overlap the uncertainty.
+  */
+void UncertaintyThresholder::setRegionOfInterest(const itk::ImageRegion<3> & region) {
+  this->regionOfInterest = region;
+}
+
+/**
+  * Sets whether to crop to the box around the non-zero voxels (found with the statistics) when we're ignoring zeros,
+  * as nothing outside it can be in the threshold. Usually most of the volume is zero background.
+  */
+void UncertaintyThresholder::setCropToNonZeros(bool cropToNonZeros) {
+  this->cropToNonZeros = cropToNonZeros;
+}
+
+/**
+  * Sets whether to keep two masks and alternate between them. The mask returned by thresholdUncertainty is then left
+  * alone by the next threshold (which updates the one before it instead), so it can still be on screen while the next
+  * one is made on another thread. Costs a second mask.
+  */
+void UncertaintyThresholder::setDoubleBuffered(bool doubleBuffered) {
+  this->doubleBuffered = doubleBuffered;
+  if (!doubleBuffered) {
+    backMask = NULL;
   }
 }
 
@@ -49,36 +93,170 @@ void UncertaintyThresholder::setIgnoreZeros(bool ignoreZeros) {
 }
 
 /**
-  * Thresholds the uncertainty.
+  * Thresholds the uncertainty. The result is an unsigned char mask (1 inside the range, 0 outside).
+  * If only the range has changed since the last threshold, the previous mask is updated in place (and returned again)
+  * by flipping the voxels between the old and new cuts. Otherwise the whole volume is thresholded.
+  * Returns NULL if cancelled (or the uncertainty can't be read).
+  *   reportProgress - whether to use the loading bar. Only allowed from the GUI thread.
+  *   cancelled - a flag another thread can set to stop the threshold (see UncertaintyThresholdJob). It's only read,
+  *               so a cancel can't be lost by the threshold starting after it.
   */
-mitk::Image::Pointer UncertaintyThresholder::thresholdUncertainty(double min, double max) {
+mitk::Image::Pointer UncertaintyThresholder::thresholdUncertainty(double min, double max, bool reportProgress, const volatile bool * cancelled) {
+  // Check if we're ignoring zeros.
+  if (ignoreZeros) {
+    double epsilon = DBL_MIN;
+    min = std::max(epsilon, min);
+    max = std::max(epsilon, max);
+  }
+
+  // Update the mask before last, leaving the last one as it is.
+  if (doubleBuffered) {
+    swapMasks();
+  }
+
+  updateCrop();
+  if (mask.IsNotNull() && croppedUncertainty->GetMTime() == maskMTime && valueIndex.update(croppedUncertainty) && updateMask(min, max, cancelled)) {
+    return mask;
+  }
+  if (cancelled != NULL && *cancelled) {
+    cancelThreshold();
+    return NULL;
+  }
+
 	mitk::Image::Pointer thresholdedImage;
-	AccessByItk_3(this->uncertainty, ItkThresholdUncertainty, min, max, thresholdedImage);
+  try {
+    AccessFixedTypeByItk_n(croppedUncertainty, ItkThresholdUncertainty, MITK_ACCESSBYITK_FLOATING_PIXEL_TYPES_SEQ, (3), (min, max, reportProgress, thresholdedImage));
+  }
+  catch (mitk::Exception & e) {
+    std::cerr << "Hmmm... it appears we can't get read access to the uncertainty image. Maybe it's type isn't double or float? (I've assumed it is)" << e << std::endl;
+    cancelThreshold();
+    return NULL;
+  }
+  if (cancelled != NULL && *cancelled) {
+    cancelThreshold();
+    return NULL;
+  }
+
+  mask = thresholdedImage;
+  maskMTime = croppedUncertainty->GetMTime();
+  maskMin = min;
+  maskMax = max;
+
+  // Index the values now so the next threshold can be done incrementally.
+  valueIndex.update(croppedUncertainty);
 	return thresholdedImage;
 }
 
 /**
-  * Finds the threshold corresponding to the top X percent of uncertainty.
+  * Labels each voxel with the band it's in (1 to N - 1), given N cut points. Band i is [cuts[i - 1], cuts[i]), apart from
+  * the last band which includes the last cut. Voxels outside the cuts (and zeros, if we're ignoring them) are 0.
+  * Each item is a z slice. The cuts are counted one at a time over the whole slice, so the inner loops are simple
+  * enough for the compiler to vectorize.
   */
-void UncertaintyThresholder::getTopXPercentThreshold(double percentage, double & min, double & max) {
-  // If we've not previously generated the histogram, generate it.
-  if (!histogram) {
-    histogram = new unsigned int[binsPerDimension];
-    AccessByItk_2(this->uncertainty, ItkComputeHistogram, histogram, totalPixels);
+template <typename TPixel>
+struct UncertaintyThresholder::BandLabeller {
+  const TPixel * values;
+  unsigned char * labels;
+  size_t sliceSize;
+  const double * cuts;
+  unsigned int numberOfCuts;
+
+  void operator()(unsigned int slice, unsigned int /*threadID*/) {
+    const TPixel * sliceValues = values + slice * sliceSize;
+    unsigned char * sliceLabels = labels + slice * sliceSize;
+    std::fill(sliceLabels, sliceLabels + sliceSize, 0);
+
+    // Count how many cuts each value is at or above.
+    for (unsigned int c = 0; c < numberOfCuts; c++) {
+      double cut = cuts[c];
+      for (size_t i = 0; i < sliceSize; i++) {
+        sliceLabels[i] += (sliceValues[i] >= cut) ? 1 : 0;
+      }
+    }
+
+    // At or above every cut is outside, unless it's exactly on the last one.
+    unsigned char aboveAll = (unsigned char) numberOfCuts;
+    double lastCut = cuts[numberOfCuts - 1];
+    for (size_t i = 0; i < sliceSize; i++) {
+      if (sliceLabels[i] == aboveAll) {
+        sliceLabels[i] = (sliceValues[i] == lastCut) ? aboveAll - 1 : 0;
+      }
+    }
   }
+};
 
-  // Work out the number of pixels we need to get to reach percentage.
-  unsigned int goalPixels;
-  unsigned int i;
-  // If we're ignoring zeros the goal will be less.
+/**
+  * Thresholds the uncertainty into several bands at once (e.g. low, medium and high uncertainty), in one pass.
+  * The result is an unsigned char label image (see BandLabeller), cropped and placed like the masks.
+  * The cuts are sorted if they aren't already. Returns NULL if there are fewer than 2 or more than MAX_BANDS + 1.
+  *   reportProgress - whether to use the loading bar. Only allowed from the GUI thread.
+  */
+mitk::Image::Pointer UncertaintyThresholder::thresholdUncertaintyIntoBands(std::vector<double> cuts, bool reportProgress) {
+  if (cuts.size() < 2 || cuts.size() > MAX_BANDS + 1) {
+    return NULL;
+  }
+  std::sort(cuts.begin(), cuts.end());
+
+  // Zeros are below every cut if we're ignoring them. (as in thresholdUncertainty)
   if (ignoreZeros) {
-    goalPixels = (totalPixels - histogram[0]) * percentage;
-    i = 1;
+    double epsilon = DBL_MIN;
+    for (unsigned int i = 0; i < cuts.size(); i++) {
+      cuts[i] = std::max(epsilon, cuts[i]);
+    }
   }
-  else {
-    goalPixels = totalPixels * percentage;
-    i = 0;
+
+  updateCrop();
+
+  typedef itk::Image<unsigned char, 3> LabelImageType;
+  LabelImageType::RegionType region;
+  LabelImageType::SizeType regionSize;
+  for (unsigned int i = 0; i < 3; i++) {
+    regionSize[i] = croppedUncertainty->GetDimension(i);
   }
+  region.SetSize(regionSize);
+
+  LabelImageType::Pointer labelImage = LabelImageType::New();
+  labelImage->SetRegions(region);
+  labelImage->Allocate();
+
+  try {
+    if (reportProgress) {
+      mitk::ProgressBar::GetInstance()->AddStepsToDo(regionSize[2]);
+    }
+    AccessFixedTypeByItk_n(croppedUncertainty, ItkLabelBands, MITK_ACCESSBYITK_FLOATING_PIXEL_TYPES_SEQ, (3), (cuts, labelImage->GetBufferPointer(), reportProgress));
+  }
+  catch (mitk::Exception & e) {
+    std::cerr << "Hmmm... it appears we can't get read access to the uncertainty image. Maybe it's type isn't double or float? (I've assumed it is)" << e << std::endl;
+    return NULL;
+  }
+
+  mitk::Image::Pointer result;
+  mitk::CastToMitkImage(labelImage, result);
+  result->GetGeometry()->SetOrigin(croppedUncertainty->GetGeometry()->GetOrigin());
+  result->GetGeometry()->SetIndexToWorldTransform(croppedUncertainty->GetGeometry()->GetIndexToWorldTransform());
+  return result;
+}
+
+/**
+  * Finds the threshold corresponding to the top X percent of uncertainty.
+  * The cut is exact when the values can be indexed (see getExactTopXPercentThreshold). Otherwise it falls back to
+  * the histogram, which is only accurate to a bin.
+  */
+void UncertaintyThresholder::getTopXPercentThreshold(double percentage, double & min, double & max) {
+  min = 0.0;
+  if (getExactTopXPercentThreshold(percentage, max)) {
+    return;
+  }
+
+  updateStatistics();
+  const std::vector<itk::uint64_t> & histogram = statistics.getHistogram();
+
+  // Work out the number of pixels we need to get to reach percentage.
+  // If we're ignoring zeros the goal will be less (and they need taking out of the bin they're in).
+  itk::uint64_t totalPixels = ignoreZeros ? statistics.getNumberOfNonZeros() : statistics.getNumberOfVoxels();
+  itk::uint64_t goalPixels = totalPixels * percentage;
+  itk::uint64_t zeros = statistics.getNumberOfVoxels() - statistics.getNumberOfNonZeros();
+  unsigned int zeroBin = statistics.histogramBinContaining(0.0);
 
   if (DEBUGGING) {
     std::cout << "Total Pixels: " << totalPixels << std::endl << 
@@ -86,91 +264,561 @@ void UncertaintyThresholder::getTopXPercentThreshold(double percentage, double &
   }
 
   // Go through the histogram (effectively comuting the CDF) until we reach our goal.
-  unsigned int pixelCount = 0;
-  while ((pixelCount < goalPixels) && (i < binsPerDimension)) {
+  itk::uint64_t pixelCount = 0;
+  unsigned int i = 0;
+  while ((pixelCount < goalPixels) && (i < UncertaintyStatistics::HISTOGRAM_BINS)) {
     pixelCount += histogram[i];
+    if (ignoreZeros && i == zeroBin) {
+      pixelCount -= zeros;
+    }
     i++;
   }
 
   // 'Return' the threshold values.
-  min = 0.0;
-  max = (double) i / (double) binsPerDimension;
+  max = (i == 0) ? UncertaintyStatistics::HISTOGRAM_MIN : statistics.histogramBinMax(i - 1);
 }
 
 /**
-  * Use ITK to actually do the thresholding.
+  * Finds the threshold that best splits the uncertainty into two classes (Otsu's method), from the histogram.
+  * Voxels at or below it are the worse class.
   */
-template <typename TPixel, unsigned int VImageDimension>
-void UncertaintyThresholder::ItkThresholdUncertainty(itk::Image<TPixel, VImageDimension>* itkImage, double min, double max, mitk::Image::Pointer & result) {
-  mitk::ProgressBar::GetInstance()->AddStepsToDo(1);
+double UncertaintyThresholder::getOtsuThreshold() {
+  return getMultiOtsuThresholds(2)[0];
+}
+
+/**
+  * Finds the numberOfClasses - 1 thresholds that best split the uncertainty into classes (multi-level Otsu), from the
+  * histogram. i.e. the cuts (at bin edges) maximizing the between-class variance, which is the same as maximizing
+  * sum(classSum^2 / classCount) over the classes. Found exactly by dynamic programming over the occupied bins.
+  * The thresholds are sorted, and class i is the voxels above threshold i - 1 and at or below threshold i.
+  */
+std::vector<double> UncertaintyThresholder::getMultiOtsuThresholds(unsigned int numberOfClasses) {
+  numberOfClasses = std::max(numberOfClasses, 2u);
+
+  std::vector<double> histogram;
+  unsigned int first, last;
+  getHistogram(histogram, first, last);
+
+  // Cumulative counts and sums over the occupied bins, so any class's score is O(1).
+  unsigned int numberOfBins = last - first + 1;
+  std::vector<double> counts(numberOfBins + 1, 0.0);
+  std::vector<double> sums(numberOfBins + 1, 0.0);
+  for (unsigned int i = 0; i < numberOfBins; i++) {
+    counts[i + 1] = counts[i] + histogram[first + i];
+    sums[i + 1] = sums[i] + histogram[first + i] * statistics.histogramBinCentre(first + i);
+  }
+
+  // score[k][b] - the best score for splitting the first b bins into k + 1 classes.
+  // cut[k][b] - where the last of those classes starts.
+  // The last row is only needed for all the bins (which makes two classes a single pass).
+  std::vector<std::vector<double> > score(numberOfClasses, std::vector<double>(numberOfBins + 1, 0.0));
+  std::vector<std::vector<unsigned int> > cut(numberOfClasses, std::vector<unsigned int>(numberOfBins + 1, 0));
+  for (unsigned int b = 1; b <= numberOfBins; b++) {
+    score[0][b] = (counts[b] > 0) ? sums[b] * sums[b] / counts[b] : 0.0;
+  }
+  for (unsigned int k = 1; k < numberOfClasses; k++) {
+    unsigned int firstB = (k == numberOfClasses - 1) ? numberOfBins : 1;
+    for (unsigned int b = firstB; b <= numberOfBins; b++) {
+      double bestScore = score[k - 1][b];
+      unsigned int bestCut = b;
+      for (unsigned int a = 1; a < b; a++) {
+        double classCount = counts[b] - counts[a];
+        double classSum = sums[b] - sums[a];
+        double candidate = score[k - 1][a] + ((classCount > 0) ? classSum * classSum / classCount : 0.0);
+        if (candidate > bestScore) {
+          bestScore = candidate;
+          bestCut = a;
+        }
+      }
+      score[k][b] = bestScore;
+      cut[k][b] = bestCut;
+    }
+  }
+
+  // Walk back through the cuts. (a class starting at bin a means a threshold at the top of bin a - 1)
+  std::vector<double> thresholds(numberOfClasses - 1, 0.0);
+  unsigned int b = numberOfBins;
+  for (unsigned int k = numberOfClasses - 1; k > 0; k--) {
+    b = cut[k][b];
+    thresholds[k - 1] = statistics.histogramBinMax(first + b - 1);
+  }
+
+  if (DEBUGGING) {
+    std::cout << "Multi-Otsu (" << numberOfClasses << " classes):";
+    for (unsigned int i = 0; i < thresholds.size(); i++) {
+      std::cout << " " << thresholds[i];
+    }
+    std::cout << std::endl;
+  }
+
+  return thresholds;
+}
+
+/**
+  * Finds the knee of the histogram (the triangle method). A line is drawn from the peak to the end of the longer tail,
+  * and the knee is the bin furthest below it, where the tail flattens out.
+  */
+double UncertaintyThresholder::getKneeThreshold() {
+  std::vector<double> histogram;
+  unsigned int first, last;
+  getHistogram(histogram, first, last);
+
+  unsigned int peak = first;
+  for (unsigned int i = first; i <= last; i++) {
+    if (histogram[i] > histogram[peak]) {
+      peak = i;
+    }
+  }
+
+  // The line from the peak to the end of the longer tail.
+  bool lowerTail = (peak - first) >= (last - peak);
+  unsigned int end = lowerTail ? first : last;
+  double dx = (double) end - peak;
+  double dy = histogram[end] - histogram[peak];
+
+  // Distance (up to a constant) of each bin between them from the line.
+  unsigned int knee = peak;
+  double kneeDistance = 0.0;
+  unsigned int from = std::min(peak, end);
+  unsigned int to = std::max(peak, end);
+  for (unsigned int i = from; i <= to; i++) {
+    double distance = dy * ((double) i - peak) - dx * (histogram[i] - histogram[peak]);
+    distance = lowerTail ? -distance : distance;
+    if (distance > kneeDistance) {
+      kneeDistance = distance;
+      knee = i;
+    }
+  }
+
+  if (DEBUGGING) {
+    std::cout << "Knee: bin " << knee << " (peak " << peak << ", " << (lowerTail ? "lower" : "upper") << " tail)" << std::endl;
+  }
+
+  return statistics.histogramBinMax(knee);
+}
+
+/**
+  * Finds the exact value that the top X percent of uncertainty (the lowest values) are at or below, using the value index
+  * (a bucket walk followed by a selection within one bucket). Zeros aren't counted if we're ignoring them.
+  * Only the voxels in the cropped region are counted.
+  * Returns false if the uncertainty can't be indexed.
+  */
+bool UncertaintyThresholder::getExactTopXPercentThreshold(double percentage, double & max) {
+  updateCrop();
+  if (!valueIndex.update(croppedUncertainty)) {
+    return false;
+  }
+
+  itk::uint64_t totalValues = valueIndex.getNumberOfValues(ignoreZeros);
+  itk::uint64_t goalValues = (itk::uint64_t) (totalValues * percentage + 0.5);
+  goalValues = std::min(goalValues, totalValues);
+
+  if (DEBUGGING) {
+    std::cout << "Total Values: " << totalValues << std::endl <<
+                 "Goal Values: " << goalValues << std::endl;
+  }
+
+  // Nothing to show.
+  if (goalValues == 0) {
+    max = 0.0;
+    return true;
+  }
+
+  try {
+    max = valueIndex.valueAtRank(croppedUncertainty, goalValues - 1, ignoreZeros);
+  }
+  catch (mitk::Exception & e) {
+    std::cerr << "Hmmm... it appears we can't get read access to the uncertainty image. Maybe it's type isn't double or float? (I've assumed it is)" << e << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+  * The last threshold packed one bit per voxel (repacked if the mask has changed since it was last asked for).
+  * Empty if nothing has been thresholded yet.
+  */
+const UncertaintyBitMask & UncertaintyThresholder::getBitPackedMask() {
+  if (mask.IsNull()) {
+    bitPackedMask.clear();
+  }
+  else if (bitPackedMask.isEmpty() || mask->GetMTime() != bitPackedMaskMTime) {
+    bitPackedMask.pack(mask);
+    bitPackedMaskMTime = mask->GetMTime();
+  }
+  return bitPackedMask;
+}
+
+/**
+  * The range the last mask was actually thresholded with (i.e. after moving the bottom above zero if we're ignoring zeros).
+  * Returns false if there's no mask, or it's out of date (the uncertainty, or its crop, has changed since).
+  */
+bool UncertaintyThresholder::getMaskRange(double & min, double & max) const {
+  min = maskMin;
+  max = maskMax;
+  return mask.IsNotNull() && croppedUncertainty.IsNotNull() &&
+         uncertainty->GetMTime() == croppedUncertaintyMTime && croppedUncertainty->GetMTime() == maskMTime;
+}
+
+/**
+  * The part of the uncertainty that's thresholded, which the masks line up with (the uncertainty itself if it isn't cropped).
+  */
+mitk::Image::Pointer UncertaintyThresholder::getCroppedUncertainty() {
+  updateCrop();
+  return croppedUncertainty;
+}
+
+/**
+  * Where the cropped uncertainty is in the uncertainty (in voxels).
+  */
+itk::ImageRegion<3> UncertaintyThresholder::getCroppedRegion() {
+  updateCrop();
+  return croppedRegion;
+}
+
+/**
+  * Computes the statistics if we've not got them for the uncertainty as it is now.
+  * NOTE: These are always for the whole uncertainty (so the histogram isn't cropped).
+  */
+void UncertaintyThresholder::updateStatistics() {
+  if (!statistics.isFor(uncertainty)) {
+    statistics.compute(uncertainty);
+  }
+}
+
+/**
+  * The region of interest, cut down to the non-zero voxels if we're cropping to them.
+  * The whole uncertainty if there's nothing to cut (or nothing would be left).
+  */
+itk::ImageRegion<3> UncertaintyThresholder::getRegionToThreshold() {
+  itk::ImageRegion<3> wholeRegion;
+  itk::ImageRegion<3>::SizeType wholeSize;
+  for (unsigned int i = 0; i < 3; i++) {
+    wholeSize[i] = uncertainty->GetDimension(i);
+  }
+  wholeRegion.SetSize(wholeSize);
+
+  itk::ImageRegion<3> region = wholeRegion;
+  if (regionOfInterest.GetNumberOfPixels() > 0 && !region.Crop(regionOfInterest)) {
+    region = wholeRegion;
+  }
+
+  if (cropToNonZeros && ignoreZeros) {
+    updateStatistics();
+    itk::ImageRegion<3> nonZeroRegion = region;
+    if (statistics.hasNonZeros() && nonZeroRegion.Crop(statistics.getNonZeroRegion())) {
+      region = nonZeroRegion;
+    }
+  }
+
+  return region;
+}
+
+/**
+  * Copies a region of the uncertainty. Each item is a z slice of the region.
+  */
+template <typename TPixel>
+struct UncertaintyThresholder::Cropper {
+  const TPixel * values;
+  TPixel * croppedValues;
+  unsigned int size[3];
+  itk::ImageRegion<3> region;
+
+  void operator()(unsigned int slice, unsigned int /*threadID*/) {
+    const itk::ImageRegion<3>::IndexType & start = region.GetIndex();
+    const itk::ImageRegion<3>::SizeType & croppedSize = region.GetSize();
+    for (unsigned int y = 0; y < croppedSize[1]; y++) {
+      const TPixel * row = values + ((size_t) (start[2] + slice) * size[1] + start[1] + y) * size[0] + start[0];
+      TPixel * croppedRow = croppedValues + ((size_t) slice * croppedSize[1] + y) * croppedSize[0];
+      std::copy(row, row + croppedSize[0], croppedRow);
+    }
+  }
+};
+
+/**
+  * Crops the uncertainty to the region to threshold, if the region or the uncertainty has changed.
+  * The crop is a new image, so the masks and value index (which are for the cropped uncertainty) are rebuilt with it.
+  */
+void UncertaintyThresholder::updateCrop() {
+  itk::ImageRegion<3> region = getRegionToThreshold();
+  if (croppedUncertainty.IsNotNull() && region == croppedRegion && uncertainty->GetMTime() == croppedUncertaintyMTime) {
+    return;
+  }
+  croppedRegion = region;
+  croppedUncertaintyMTime = uncertainty->GetMTime();
+
+  // Nothing to cut off.
+  if (region.GetNumberOfPixels() == (size_t) uncertainty->GetDimension(0) * uncertainty->GetDimension(1) * uncertainty->GetDimension(2)) {
+    croppedUncertainty = uncertainty;
+    return;
+  }
+
+  mitk::Image::Pointer cropped;
+  try {
+    AccessFixedTypeByItk_n(uncertainty, ItkCropUncertainty, MITK_ACCESSBYITK_FLOATING_PIXEL_TYPES_SEQ, (3), (region, cropped));
+  }
+  catch (mitk::Exception & e) {
+    std::cerr << "Hmmm... it appears we can't get read access to the uncertainty image. Maybe it's type isn't double or float? (I've assumed it is)" << e << std::endl;
+    croppedRegion = itk::ImageRegion<3>();
+    croppedUncertainty = uncertainty;
+    return;
+  }
+
+  // Same spacing and orientation, but starting at the first voxel of the region.
+  mitk::BaseGeometry * geometry = uncertainty->GetGeometry();
+  mitk::Point3D regionStart;
+  for (unsigned int i = 0; i < 3; i++) {
+    regionStart[i] = region.GetIndex(i);
+  }
+  mitk::Point3D origin;
+  geometry->IndexToWorld(regionStart, origin);
+  cropped->GetGeometry()->SetIndexToWorldTransform(geometry->GetIndexToWorldTransform());
+  cropped->GetGeometry()->SetOrigin(origin);
+  croppedUncertainty = cropped;
+
+  if (DEBUGGING) {
+    std::cout << "Cropped uncertainty to " << region << std::endl;
+  }
+}
+
+/**
+  * The histogram of the uncertainty (without zeros if we're ignoring them), and the first and last bins with anything in.
+  * Comes from the statistics, so no voxels are read if they've been cached.
+  */
+void UncertaintyThresholder::getHistogram(std::vector<double> & histogram, unsigned int & first, unsigned int & last) {
+  updateStatistics();
+  const std::vector<itk::uint64_t> & counts = statistics.getHistogram();
+  histogram.assign(counts.begin(), counts.end());
 
-  typedef itk::Image<TPixel, VImageDimension> ImageType;
-  typedef itk::BinaryThresholdImageFilter<ImageType, ImageType> BinaryThresholdImageFilterType;
-  
-  // Check if we're ignoring zeros.
   if (ignoreZeros) {
-    double epsilon = DBL_MIN;
-    min = std::max(epsilon, min);
-    max = std::max(epsilon, max);
+    unsigned int zeroBin = statistics.histogramBinContaining(0.0);
+    histogram[zeroBin] -= statistics.getNumberOfVoxels() - statistics.getNumberOfNonZeros();
   }
 
-  // Create a thresholder.
-  typename BinaryThresholdImageFilterType::Pointer thresholdFilter = BinaryThresholdImageFilterType::New();
-  thresholdFilter->AddObserver(itk::ProgressEvent(), MitkLoadingBarCommand::New());
-  thresholdFilter->SetInput(itkImage);
-  thresholdFilter->SetInsideValue(1);
-  thresholdFilter->SetOutsideValue(0);
-  thresholdFilter->SetLowerThreshold(min);
-  thresholdFilter->SetUpperThreshold(max);
+  first = 0;
+  while (first < histogram.size() - 1 && histogram[first] <= 0) {
+    first++;
+  }
+  last = histogram.size() - 1;
+  while (last > first && histogram[last] <= 0) {
+    last--;
+  }
+}
 
-  // Compute result.
-  thresholdFilter->Update();
-  ImageType * thresholdedImage = thresholdFilter->GetOutput();
-  mitk::CastToMitkImage(thresholdedImage, result);
-  mitk::ProgressBar::GetInstance()->Progress();
+/**
+  * Sets each voxel of a z slice to whether it's inside the range. Values are compared as doubles (as in MaskUpdater),
+  * so a float uncertainty gives the same mask whether it's thresholded from scratch or updated.
+  */
+template <typename TPixel>
+struct UncertaintyThresholder::MaskThresholder {
+  const TPixel * values;
+  unsigned char * maskValues;
+  size_t sliceSize;
+  double min;
+  double max;
+
+  void operator()(unsigned int slice, unsigned int /*threadID*/) {
+    const TPixel * sliceValues = values + slice * sliceSize;
+    unsigned char * sliceMask = maskValues + slice * sliceSize;
+    for (size_t i = 0; i < sliceSize; i++) {
+      double value = sliceValues[i];
+      sliceMask[i] = (value >= min && value <= max) ? 1 : 0;
+    }
+  }
+};
+
+/**
+  * Sets each voxel in a run of the value index to whether it's inside the new range.
+  * Items are blocks of positions in the index. Each voxel appears once in the index, so items never write to the same voxel.
+  * Blocks are skipped once the threshold is cancelled.
+  */
+template <typename TPixel>
+struct UncertaintyThresholder::MaskUpdater {
+  const volatile bool * cancelled;
+  const TPixel * values;
+  unsigned char * maskValues;
+  const unsigned int * sortedVoxels;
+  unsigned int start;
+  unsigned int end;
+  double min;
+  double max;
+
+  static const unsigned int BLOCK_SIZE = 65536;
+
+  unsigned int numberOfBlocks() const {
+    return (end - start + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  }
+
+  void operator()(unsigned int block, unsigned int /*threadID*/) {
+    if (cancelled != NULL && *cancelled) {
+      return;
+    }
+    unsigned int blockStart = start + block * BLOCK_SIZE;
+    unsigned int blockEnd = std::min(end, blockStart + BLOCK_SIZE);
+    for (unsigned int i = blockStart; i < blockEnd; i++) {
+      unsigned int voxel = sortedVoxels[i];
+      double value = values[voxel];
+      maskValues[voxel] = (value >= min && value <= max) ? 1 : 0;
+    }
+  }
+};
+
+/**
+  * Moves the cuts of the existing mask from [maskMin, maskMax] to [min, max].
+  * Only voxels with values between the old and new lower cut, or the old and new upper cut, can change,
+  * so only the buckets of the value index covering those intervals are visited.
+  * Returns false if the mask couldn't be updated (and needs to be recomputed), or the update was cancelled.
+  */
+bool UncertaintyThresholder::updateMask(double min, double max, const volatile bool * cancelled) {
+  if (min == maskMin && max == maskMax) {
+    return true;
+  }
+
+  // The buckets covering the two changed intervals (merged if they overlap).
+  unsigned int lowerFirst = valueIndex.bucketContaining(std::min(min, maskMin));
+  unsigned int lowerLast = valueIndex.bucketContaining(std::max(min, maskMin));
+  unsigned int upperFirst = valueIndex.bucketContaining(std::min(max, maskMax));
+  unsigned int upperLast = valueIndex.bucketContaining(std::max(max, maskMax));
+  std::vector<std::pair<unsigned int, unsigned int> > bucketRanges;
+  if (upperFirst <= lowerLast) {
+    bucketRanges.push_back(std::make_pair(lowerFirst, std::max(lowerLast, upperLast)));
+  }
+  else {
+    bucketRanges.push_back(std::make_pair(lowerFirst, lowerLast));
+    bucketRanges.push_back(std::make_pair(upperFirst, upperLast));
+  }
+
+  try {
+    mitk::ImagePixelWriteAccessor<unsigned char, 3> writeAccess(mask);
+    AccessFixedTypeByItk_n(croppedUncertainty, ItkUpdateMask, MITK_ACCESSBYITK_FLOATING_PIXEL_TYPES_SEQ, (3), (min, max, bucketRanges, cancelled, writeAccess.GetData()));
+
+    // Half updated, so it's no use to anyone.
+    if (cancelled != NULL && *cancelled) {
+      mask = NULL;
+      return false;
+    }
+
+    if (DEBUGGING) {
+      std::cout << "Updated mask from [" << maskMin << ", " << maskMax << "] to [" << min << ", " << max << "]" << std::endl;
+    }
+  }
+  catch (mitk::Exception & e) {
+    std::cerr << "Hmmm... it appears we can't access the uncertainty or the mask. Maybe they aren't double (or float) and unsigned char? (I've assumed they are)" << e << std::endl;
+    return false;
+  }
+
+  mask->Modified();
+  maskMin = min;
+  maskMax = max;
+  return true;
 }
 
 /**
-  * Use ITK to build a histogram of all the values in the image.
+  * Goes back to the masks as they were before a cancelled threshold. If double buffered, the last mask returned
+  * mustn't become the one that's updated next (it may still be on screen).
+  * Also call this when a mask that was returned is thrown away rather than shown (e.g. its job was cancelled after
+  * it finished), so the mask that is on screen stays the last one.
+  */
+void UncertaintyThresholder::cancelThreshold() {
+  if (doubleBuffered) {
+    swapMasks();
+  }
+}
+
+/**
+  * Swaps the last mask with the one before it (along with the ranges they were thresholded with).
+  */
+void UncertaintyThresholder::swapMasks() {
+  std::swap(mask, backMask);
+  std::swap(maskMTime, backMaskMTime);
+  std::swap(maskMin, backMaskMin);
+  std::swap(maskMax, backMaskMax);
+}
+
+/**
+  * Thresholds the whole (cropped) uncertainty into a new mask in parallel. See MaskThresholder.
   */
 template <typename TPixel, unsigned int VImageDimension>
-void UncertaintyThresholder::ItkComputeHistogram(itk::Image<TPixel, VImageDimension>* itkImage, unsigned int * histogram, unsigned int & totalPixels) {
-  mitk::ProgressBar::GetInstance()->AddStepsToDo(1);
-
-  typedef itk::Image<TPixel, VImageDimension> ImageType;
-  typedef itk::Statistics::ImageToHistogramFilter<ImageType> ImageToHistogramFilterType;
-
-  // Customise the filter.
-  typename ImageToHistogramFilterType::HistogramType::MeasurementVectorType lowerBound(binsPerDimension);
-  lowerBound.Fill(0.0);
- 
-  typename ImageToHistogramFilterType::HistogramType::MeasurementVectorType upperBound(binsPerDimension);
-  upperBound.Fill(1.0);
- 
-  typename ImageToHistogramFilterType::HistogramType::SizeType size(measurementComponents);
-  size.Fill(binsPerDimension);
-
-  // Create the filter.
-  typename ImageToHistogramFilterType::Pointer imageToHistogramFilter = ImageToHistogramFilterType::New();
-  imageToHistogramFilter->SetInput(itkImage);
-  imageToHistogramFilter->SetHistogramBinMinimum(lowerBound);
-  imageToHistogramFilter->SetHistogramBinMaximum(upperBound);
-  imageToHistogramFilter->SetHistogramSize(size);
-  imageToHistogramFilter->AddObserver(itk::ProgressEvent(), MitkLoadingBarCommand::New());
-  imageToHistogramFilter->Update();
-
-  // Get the resultant histogram. It has binsPerDimension buckets.
-  typename ImageToHistogramFilterType::HistogramType::Pointer computedHistogram = imageToHistogramFilter->GetOutput();
-
-  // We know that in total there are uncertaintyX * uncertaintyY * uncertaintyZ pixels.
-  typename ImageType::RegionType region = itkImage->GetLargestPossibleRegion();
-  typename ImageType::SizeType regionSize = region.GetSize();
-  totalPixels = regionSize[0] * regionSize[1] * regionSize[2];  
-
-  unsigned int pixelCount = 0;
-  for (unsigned int i = 0; i < binsPerDimension; i++) {
-    histogram[i] = computedHistogram->GetFrequency(i);
-  }
-
-  mitk::ProgressBar::GetInstance()->Progress();
+void UncertaintyThresholder::ItkThresholdUncertainty(itk::Image<TPixel, VImageDimension>* itkImage, double min, double max, bool reportProgress, mitk::Image::Pointer & result) {
+  typedef itk::Image<unsigned char, VImageDimension> MaskImageType;
+  typename MaskImageType::Pointer maskImage = MaskImageType::New();
+  maskImage->CopyInformation(itkImage);
+  maskImage->SetRegions(itkImage->GetLargestPossibleRegion());
+  maskImage->Allocate();
+
+  typename itk::Image<TPixel, VImageDimension>::SizeType size = itkImage->GetLargestPossibleRegion().GetSize();
+  if (reportProgress) {
+    mitk::ProgressBar::GetInstance()->AddStepsToDo(size[2]);
+  }
+
+  MaskThresholder<TPixel> thresholder;
+  thresholder.values = itkImage->GetBufferPointer();
+  thresholder.maskValues = maskImage->GetBufferPointer();
+  thresholder.sliceSize = (size_t) size[0] * size[1];
+  thresholder.min = min;
+  thresholder.max = max;
+  ParallelFor::run(size[2], thresholder, reportProgress);
+
+  result = mitk::GrabItkImageMemory(maskImage.GetPointer());
+}
+
+/**
+  * Labels the bands of the (cropped) uncertainty in parallel. See BandLabeller.
+  */
+template <typename TPixel, unsigned int VImageDimension>
+void UncertaintyThresholder::ItkLabelBands(itk::Image<TPixel, VImageDimension>* itkImage, const std::vector<double> & cuts, unsigned char * labels, bool reportProgress) {
+  typename itk::Image<TPixel, VImageDimension>::SizeType size = itkImage->GetLargestPossibleRegion().GetSize();
+
+  BandLabeller<TPixel> labeller;
+  labeller.values = itkImage->GetBufferPointer();
+  labeller.labels = labels;
+  labeller.sliceSize = (size_t) size[0] * size[1];
+  labeller.cuts = &cuts[0];
+  labeller.numberOfCuts = cuts.size();
+  ParallelFor::run(size[2], labeller, reportProgress);
+}
+
+/**
+  * Copies a region of the uncertainty into a new image of the same type. See Cropper.
+  */
+template <typename TPixel, unsigned int VImageDimension>
+void UncertaintyThresholder::ItkCropUncertainty(itk::Image<TPixel, VImageDimension>* itkImage, const itk::ImageRegion<3> & region, mitk::Image::Pointer & result) {
+  typedef itk::Image<TPixel, VImageDimension> CroppedImageType;
+  typename CroppedImageType::RegionType croppedImageRegion;
+  croppedImageRegion.SetSize(region.GetSize());
+  typename CroppedImageType::Pointer croppedImage = CroppedImageType::New();
+  croppedImage->SetRegions(croppedImageRegion);
+  croppedImage->Allocate();
+
+  Cropper<TPixel> cropper;
+  cropper.values = itkImage->GetBufferPointer();
+  cropper.croppedValues = croppedImage->GetBufferPointer();
+  for (unsigned int i = 0; i < 3; i++) {
+    cropper.size[i] = itkImage->GetLargestPossibleRegion().GetSize(i);
+  }
+  cropper.region = region;
+  ParallelFor::run(region.GetSize(2), cropper);
+
+  result = mitk::GrabItkImageMemory(croppedImage.GetPointer());
+}
+
+/**
+  * Flips the mask for the voxels in the given runs of buckets of the value index. See MaskUpdater.
+  */
+template <typename TPixel, unsigned int VImageDimension>
+void UncertaintyThresholder::ItkUpdateMask(itk::Image<TPixel, VImageDimension>* itkImage, double min, double max,
+                                           const std::vector<std::pair<unsigned int, unsigned int> > & bucketRanges, const volatile bool * cancelled,
+                                           unsigned char * maskValues) {
+  MaskUpdater<TPixel> updater;
+  updater.cancelled = cancelled;
+  updater.values = itkImage->GetBufferPointer();
+  updater.maskValues = maskValues;
+  updater.sortedVoxels = &valueIndex.getSortedVoxels()[0];
+  updater.min = min;
+  updater.max = max;
+  for (unsigned int i = 0; i < bucketRanges.size(); i++) {
+    updater.start = valueIndex.bucketStart(bucketRanges[i].first);
+    updater.end = valueIndex.bucketEnd(bucketRanges[i].second);
+    ParallelFor::run(updater.numberOfBlocks(), updater);
+  }
 }
\ No newline at end of file
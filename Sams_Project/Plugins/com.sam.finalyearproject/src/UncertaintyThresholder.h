@@ -2,6 +2,13 @@
 #define Uncertainty_Thresholder_h
 
 #include <mitkImage.h>
+#include <itkIntTypes.h>
+#include <itkImageRegion.h>
+#include <vector>
+
+#include "UncertaintyValueIndex.h"
+#include "UncertaintyBitMask.h"
+#include "UncertaintyStatistics.h"
 
 class UncertaintyThresholder {
 	public:
@@ -9,31 +16,90 @@ class UncertaintyThresholder {
     ~UncertaintyThresholder();
     void setUncertainty(mitk::Image::Pointer image);
     void setIgnoreZeros(bool ignoreZeros);
-    mitk::Image::Pointer thresholdUncertainty(double min, double max);
+    void setStatistics(const UncertaintyStatistics * statistics);
+    void setRegionOfInterest(const itk::ImageRegion<3> & region);
+    void setCropToNonZeros(bool cropToNonZeros);
+    void setDoubleBuffered(bool doubleBuffered);
+    mitk::Image::Pointer thresholdUncertainty(double min, double max, bool reportProgress = true, const volatile bool * cancelled = NULL);
+    void cancelThreshold();
+    mitk::Image::Pointer thresholdUncertaintyIntoBands(std::vector<double> cuts, bool reportProgress = true);
     void getTopXPercentThreshold(double percentage, double & min, double & max);
+    double getOtsuThreshold();
+    std::vector<double> getMultiOtsuThresholds(unsigned int numberOfClasses);
+    double getKneeThreshold();
+    const UncertaintyBitMask & getBitPackedMask();
+    bool getMaskRange(double & min, double & max) const;
+    mitk::Image::Pointer getCroppedUncertainty();
+    itk::ImageRegion<3> getCroppedRegion();
+
+    // Band labels are unsigned char, with 0 for outside every band.
+    static const unsigned int MAX_BANDS = 255;
 
   private:
     mitk::Image::Pointer uncertainty;
 
     // Processing Parameters
     bool ignoreZeros;
+    itk::ImageRegion<3> regionOfInterest;
+    bool cropToNonZeros;
     double min;
     double max;
 
-    // Histogram (so we don't have to keep computing it)
-    unsigned int * histogram;
-    unsigned int totalPixels;
+    // The part of the uncertainty that's thresholded (or the uncertainty itself, if that's all of it)
+    mitk::Image::Pointer croppedUncertainty;
+    unsigned long croppedUncertaintyMTime;
+    itk::ImageRegion<3> croppedRegion;
+
+    // Mask from the last threshold (so moving the threshold only has to change the voxels between the old and new cuts)
+    mitk::Image::Pointer mask;
+    unsigned long maskMTime;
+    double maskMin;
+    double maskMax;
+
+    // The mask before last (if double buffered), which is what the next threshold updates.
+    bool doubleBuffered;
+    mitk::Image::Pointer backMask;
+    unsigned long backMaskMTime;
+    double backMaskMin;
+    double backMaskMax;
+
+    UncertaintyValueIndex valueIndex;
+    UncertaintyBitMask bitPackedMask;
+    unsigned long bitPackedMaskMTime;
 
-    unsigned int measurementComponents;
-    unsigned int binsPerDimension;
+    // Statistics, including the histogram (so we don't have to keep computing it)
+    UncertaintyStatistics statistics;
+
+    bool getExactTopXPercentThreshold(double percentage, double & max);
+    void updateStatistics();
+    itk::ImageRegion<3> getRegionToThreshold();
+    void updateCrop();
+    void getHistogram(std::vector<double> & histogram, unsigned int & first, unsigned int & last);
+    bool updateMask(double min, double max, const volatile bool * cancelled);
+    void swapMasks();
+
+    template <typename TPixel>
+    struct MaskThresholder;
+    template <typename TPixel>
+    struct MaskUpdater;
+    template <typename TPixel>
+    struct BandLabeller;
+    template <typename TPixel>
+    struct Cropper;
 
     static const bool DEBUGGING = false;
 
     // ITK Methods
     template <typename TPixel, unsigned int VImageDimension>
-    void ItkThresholdUncertainty(itk::Image<TPixel, VImageDimension>* itkImage, double min, double max, mitk::Image::Pointer & result);
+    void ItkThresholdUncertainty(itk::Image<TPixel, VImageDimension>* itkImage, double min, double max, bool reportProgress, mitk::Image::Pointer & result);
+    template <typename TPixel, unsigned int VImageDimension>
+    void ItkLabelBands(itk::Image<TPixel, VImageDimension>* itkImage, const std::vector<double> & cuts, unsigned char * labels, bool reportProgress);
+    template <typename TPixel, unsigned int VImageDimension>
+    void ItkCropUncertainty(itk::Image<TPixel, VImageDimension>* itkImage, const itk::ImageRegion<3> & region, mitk::Image::Pointer & result);
     template <typename TPixel, unsigned int VImageDimension>
-    void ItkComputeHistogram(itk::Image<TPixel, VImageDimension>* itkImage, unsigned int * histogram, unsigned int & totalPixels);
+    void ItkUpdateMask(itk::Image<TPixel, VImageDimension>* itkImage, double min, double max,
+                       const std::vector<std::pair<unsigned int, unsigned int> > & bucketRanges, const volatile bool * cancelled,
+                       unsigned char * maskValues);
 };
 
 #endif
\ No newline at end of file
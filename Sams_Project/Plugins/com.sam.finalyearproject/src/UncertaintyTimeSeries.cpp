@@ -0,0 +1,150 @@
+#include "UncertaintyTimeSeries.h"
+
+#include <algorithm> // for min
+
+#include <mitkImageTimeSelector.h>
+
+UncertaintyTimeSeries::UncertaintyTimeSeries() {
+  this->uncertaintyMTime = 0;
+}
+
+/**
+  * Sets the (3D or 4D) uncertainty. Everything kept is forgotten, unless it's the same uncertainty as before (and it
+  * hasn't been modified since).
+  */
+void UncertaintyTimeSeries::setUncertainty(mitk::Image::Pointer uncertainty) {
+  if (this->uncertainty == uncertainty && uncertainty.IsNotNull() && uncertainty->GetMTime() == uncertaintyMTime) {
+    return;
+  }
+  this->uncertainty = uncertainty;
+  this->uncertaintyMTime = uncertainty.IsNotNull() ? uncertainty->GetMTime() : 0;
+
+  window.clear();
+  unsigned int numberOfTimeSteps = getNumberOfTimeSteps();
+  statistics.assign(numberOfTimeSteps, UncertaintyStatistics());
+  statisticsComputed.assign(numberOfTimeSteps, false);
+  preprocessedStatistics.assign(numberOfTimeSteps, UncertaintyStatistics());
+  preprocessedStatisticsComputed.assign(numberOfTimeSteps, false);
+}
+
+/**
+  * The number of timesteps (1 if the uncertainty is 3D).
+  */
+unsigned int UncertaintyTimeSeries::getNumberOfTimeSteps() const {
+  if (uncertainty.IsNull()) {
+    return 0;
+  }
+  return (uncertainty->GetDimension() > 3) ? uncertainty->GetDimension(3) : 1;
+}
+
+/**
+  * The 3D volume of a timestep. It's kept (and the same image handed out) while the timestep is in the window.
+  */
+mitk::Image::Pointer UncertaintyTimeSeries::getTimeStep(unsigned int timeStep) {
+  return getResident(timeStep).volume;
+}
+
+/**
+  * The statistics of a timestep, computed the first time they're asked for.
+  */
+const UncertaintyStatistics * UncertaintyTimeSeries::getStatistics(unsigned int timeStep) {
+  Resident & resident = getResident(timeStep);
+  if (!statisticsComputed[resident.timeStep]) {
+    statistics[resident.timeStep].compute(resident.volume);
+    statisticsComputed[resident.timeStep] = true;
+  }
+  return &statistics[resident.timeStep];
+}
+
+/**
+  * The preprocessed volume of a timestep, or NULL if it hasn't been preprocessed (or has left the window since).
+  */
+mitk::Image::Pointer UncertaintyTimeSeries::getPreprocessed(unsigned int timeStep) {
+  return getResident(timeStep).preprocessed;
+}
+
+/**
+  * Keeps the preprocessed volume of a timestep (while it's in the window).
+  * It must have been preprocessed the same way as the others kept (see clearPreprocessed), as its statistics are
+  * reused if it's been preprocessed before.
+  */
+void UncertaintyTimeSeries::setPreprocessed(unsigned int timeStep, mitk::Image::Pointer preprocessed) {
+  Resident & resident = getResident(timeStep);
+  resident.preprocessed = preprocessed;
+  if (preprocessedStatisticsComputed[resident.timeStep]) {
+    preprocessedStatistics[resident.timeStep].rebind(preprocessed);
+  }
+}
+
+/**
+  * The statistics of the preprocessed volume of a timestep, computed the first time they're asked for.
+  * Returns NULL if the timestep hasn't been preprocessed.
+  */
+const UncertaintyStatistics * UncertaintyTimeSeries::getPreprocessedStatistics(unsigned int timeStep) {
+  Resident & resident = getResident(timeStep);
+  if (resident.preprocessed.IsNull()) {
+    return NULL;
+  }
+  if (!preprocessedStatisticsComputed[resident.timeStep]) {
+    preprocessedStatistics[resident.timeStep].compute(resident.preprocessed);
+    preprocessedStatisticsComputed[resident.timeStep] = true;
+  }
+  return &preprocessedStatistics[resident.timeStep];
+}
+
+/**
+  * Forgets the preprocessed volumes (and their statistics), e.g. because the preprocessing settings have changed.
+  */
+void UncertaintyTimeSeries::clearPreprocessed() {
+  for (std::list<Resident>::iterator it = window.begin(); it != window.end(); ++it) {
+    it->preprocessed = NULL;
+  }
+  preprocessedStatisticsComputed.assign(preprocessedStatisticsComputed.size(), false);
+}
+
+/**
+  * The window entry for a timestep (clamped to the last one), bringing it into memory if it isn't already.
+  * Using a timestep moves it to the front of the window, and the least recently used one is dropped once the window
+  * is full.
+  */
+UncertaintyTimeSeries::Resident & UncertaintyTimeSeries::getResident(unsigned int timeStep) {
+  timeStep = std::min(timeStep, getNumberOfTimeSteps() - 1);
+
+  for (std::list<Resident>::iterator it = window.begin(); it != window.end(); ++it) {
+    if (it->timeStep == timeStep) {
+      window.splice(window.begin(), window, it);
+      return window.front();
+    }
+  }
+
+  Resident resident;
+  resident.timeStep = timeStep;
+  resident.volume = extractTimeStep(timeStep);
+  window.push_front(resident);
+  if (window.size() > WINDOW_SIZE) {
+    window.pop_back();
+  }
+
+  // It's the same values as when the statistics were computed, just a new image.
+  if (statisticsComputed[timeStep]) {
+    statistics[timeStep].rebind(resident.volume);
+  }
+  return window.front();
+}
+
+/**
+  * Copies the volume of a timestep out of the uncertainty (if it's 3D, it's the uncertainty itself).
+  */
+mitk::Image::Pointer UncertaintyTimeSeries::extractTimeStep(unsigned int timeStep) {
+  if (getNumberOfTimeSteps() <= 1) {
+    return uncertainty;
+  }
+
+  mitk::ImageTimeSelector::Pointer timeSelector = mitk::ImageTimeSelector::New();
+  timeSelector->SetInput(uncertainty);
+  timeSelector->SetTimeNr(timeStep);
+  timeSelector->UpdateLargestPossibleRegion();
+  mitk::Image::Pointer volume = timeSelector->GetOutput();
+  volume->DisconnectPipeline();
+  return volume;
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#ifndef Uncertainty_Time_Series_h
+#define Uncertainty_Time_Series_h
+
+#include <list>
+#include <vector>
+
+#include <mitkImage.h>
+
+#include "UncertaintyStatistics.h"
+
+/**
+  * An uncertainty with a volume per timestep (e.g. from cine or fetal MRI), handed out one timestep at a time as the
+  * 3D volumes everything else works on. A 3D uncertainty is a series with one timestep (handed out as it is).
+  *
+  * Only the last WINDOW_SIZE timesteps used (and their preprocessed volumes) are kept in memory. The statistics of
+  * every timestep are kept though (they're small), so going back to a timestep doesn't compute them again.
+  */
+class UncertaintyTimeSeries {
+  public:
+    static const unsigned int WINDOW_SIZE = 3;
+
+    UncertaintyTimeSeries();
+    void setUncertainty(mitk::Image::Pointer uncertainty);
+    unsigned int getNumberOfTimeSteps() const;
+    mitk::Image::Pointer getTimeStep(unsigned int timeStep);
+    const UncertaintyStatistics * getStatistics(unsigned int timeStep);
+
+    mitk::Image::Pointer getPreprocessed(unsigned int timeStep);
+    void setPreprocessed(unsigned int timeStep, mitk::Image::Pointer preprocessed);
+    const UncertaintyStatistics * getPreprocessedStatistics(unsigned int timeStep);
+    void clearPreprocessed();
+
+  private:
+    // The uncertainty the series is of (and when).
+    mitk::Image::Pointer uncertainty;
+    unsigned long uncertaintyMTime;
+
+    // A timestep that's in memory, and what's been made from it.
+    struct Resident {
+      unsigned int timeStep;
+      mitk::Image::Pointer volume;
+      mitk::Image::Pointer preprocessed;
+    };
+    // Most recently used first.
+    std::list<Resident> window;
+
+    // Per timestep. Only valid where computed is set.
+    std::vector<UncertaintyStatistics> statistics;
+    std::vector<bool> statisticsComputed;
+    std::vector<UncertaintyStatistics> preprocessedStatistics;
+    std::vector<bool> preprocessedStatisticsComputed;
+
+    Resident & getResident(unsigned int timeStep);
+    mitk::Image::Pointer extractTimeStep(unsigned int timeStep);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,304 @@
+#include "UncertaintyValueIndex.h"
+
+#include "ParallelFor.h"
+
+#include <algorithm> // for min/max, nth_element
+#include <climits> // for UINT_MAX
+
+#include <mitkImageAccessByItk.h>
+
+UncertaintyValueIndex::UncertaintyValueIndex() {
+  this->indexedImage = NULL;
+  this->indexedMTime = 0;
+  this->minValue = 0.0;
+  this->bucketScale = 0.0;
+  this->numberOfVoxels = 0;
+  this->numberOfZeros = 0;
+}
+
+/**
+  * Finds the smallest and largest value in each chunk of the volume.
+  */
+template <typename TPixel>
+struct UncertaintyValueIndex::RangeFinder {
+  const TPixel * values;
+  size_t numberOfVoxels;
+  unsigned int numberOfChunks;
+  std::vector<double> * mins;
+  std::vector<double> * maxs;
+
+  void operator()(unsigned int chunk, unsigned int /*threadID*/) {
+    size_t start = numberOfVoxels * chunk / numberOfChunks;
+    size_t end = numberOfVoxels * (chunk + 1) / numberOfChunks;
+    double min = values[start];
+    double max = values[start];
+    for (size_t i = start; i < end; i++) {
+      min = std::min(min, (double) values[i]);
+      max = std::max(max, (double) values[i]);
+    }
+    (*mins)[chunk] = min;
+    (*maxs)[chunk] = max;
+  }
+};
+
+/**
+  * Counts how many voxels of each chunk fall in each bucket (and how many are zero).
+  * Each chunk has its own row of counts.
+  */
+template <typename TPixel>
+struct UncertaintyValueIndex::BucketCounter {
+  const UncertaintyValueIndex * index;
+  const TPixel * values;
+  size_t numberOfVoxels;
+  unsigned int numberOfChunks;
+  std::vector<unsigned int> * counts;
+  std::vector<itk::uint64_t> * zeros;
+
+  void operator()(unsigned int chunk, unsigned int /*threadID*/) {
+    size_t start = numberOfVoxels * chunk / numberOfChunks;
+    size_t end = numberOfVoxels * (chunk + 1) / numberOfChunks;
+    unsigned int * chunkCounts = &(*counts)[(size_t) chunk * NUMBER_OF_BUCKETS];
+    itk::uint64_t chunkZeros = 0;
+    for (size_t i = start; i < end; i++) {
+      chunkCounts[index->bucketContaining(values[i])]++;
+      if (values[i] == 0.0) {
+        chunkZeros++;
+      }
+    }
+    (*zeros)[chunk] = chunkZeros;
+  }
+};
+
+/**
+  * Writes the offsets of each chunk's voxels into their buckets. Each chunk has its own (precomputed) position
+  * in every bucket so chunks never write to the same place, and voxels stay in memory order within a bucket.
+  */
+template <typename TPixel>
+struct UncertaintyValueIndex::BucketFiller {
+  const UncertaintyValueIndex * index;
+  const TPixel * values;
+  size_t numberOfVoxels;
+  unsigned int numberOfChunks;
+  std::vector<unsigned int> * positions;
+  std::vector<unsigned int> * sortedVoxels;
+
+  void operator()(unsigned int chunk, unsigned int /*threadID*/) {
+    size_t start = numberOfVoxels * chunk / numberOfChunks;
+    size_t end = numberOfVoxels * (chunk + 1) / numberOfChunks;
+    unsigned int * chunkPositions = &(*positions)[(size_t) chunk * NUMBER_OF_BUCKETS];
+    for (size_t i = start; i < end; i++) {
+      unsigned int bucket = index->bucketContaining(values[i]);
+      (*sortedVoxels)[chunkPositions[bucket]] = i;
+      chunkPositions[bucket]++;
+    }
+  }
+};
+
+/**
+  * (Re)builds the index if the uncertainty is a different image, or has been modified, since it was last built.
+  * Returns whether the index can be used.
+  */
+bool UncertaintyValueIndex::update(mitk::Image::Pointer uncertainty) {
+  if (isBuilt() && uncertainty.GetPointer() == indexedImage && uncertainty->GetMTime() == indexedMTime) {
+    return true;
+  }
+
+  clear();
+  size_t numberOfVoxels = (size_t) uncertainty->GetDimension(0) * uncertainty->GetDimension(1) * uncertainty->GetDimension(2);
+  // Offsets are stored as unsigned ints to halve the size of the index.
+  if (numberOfVoxels == 0 || numberOfVoxels > UINT_MAX) {
+    return false;
+  }
+
+  try {
+    AccessFixedTypeByItk_n(uncertainty, ItkBuild, MITK_ACCESSBYITK_FLOATING_PIXEL_TYPES_SEQ, (3), (numberOfVoxels));
+  }
+  catch (mitk::Exception & e) {
+    std::cerr << "Hmmm... it appears we can't get read access to the uncertainty image. Maybe it's type isn't double or float? (I've assumed it is)" << e << std::endl;
+    clear();
+    return false;
+  }
+
+  indexedImage = uncertainty.GetPointer();
+  indexedMTime = uncertainty->GetMTime();
+  return true;
+}
+
+/**
+  * Builds the index from the voxels of the uncertainty (as whichever type it is).
+  */
+template <typename TPixel, unsigned int VImageDimension>
+void UncertaintyValueIndex::ItkBuild(itk::Image<TPixel, VImageDimension>* itkImage, size_t numberOfVoxels) {
+  build(itkImage->GetBufferPointer(), numberOfVoxels);
+}
+
+/**
+  * Counting sort of the voxel offsets into buckets, in parallel over chunks of the volume.
+  */
+template <typename TPixel>
+void UncertaintyValueIndex::build(const TPixel * values, size_t numberOfVoxels) {
+  unsigned int numberOfChunks = std::min((size_t) ParallelFor::getNumberOfThreads() * 4, numberOfVoxels);
+
+  // Find the range of values so the buckets can cover it.
+  std::vector<double> mins(numberOfChunks);
+  std::vector<double> maxs(numberOfChunks);
+  RangeFinder<TPixel> rangeFinder;
+  rangeFinder.values = values;
+  rangeFinder.numberOfVoxels = numberOfVoxels;
+  rangeFinder.numberOfChunks = numberOfChunks;
+  rangeFinder.mins = &mins;
+  rangeFinder.maxs = &maxs;
+  ParallelFor::run(numberOfChunks, rangeFinder);
+
+  minValue = *std::min_element(mins.begin(), mins.end());
+  double maxValue = *std::max_element(maxs.begin(), maxs.end());
+  bucketScale = (maxValue > minValue) ? NUMBER_OF_BUCKETS / (maxValue - minValue) : 0.0;
+
+  // Count the voxels in each bucket (per chunk).
+  std::vector<unsigned int> counts((size_t) numberOfChunks * NUMBER_OF_BUCKETS, 0);
+  std::vector<itk::uint64_t> zeros(numberOfChunks, 0);
+  BucketCounter<TPixel> counter;
+  counter.index = this;
+  counter.values = values;
+  counter.numberOfVoxels = numberOfVoxels;
+  counter.numberOfChunks = numberOfChunks;
+  counter.counts = &counts;
+  counter.zeros = &zeros;
+  ParallelFor::run(numberOfChunks, counter);
+
+  this->numberOfVoxels = numberOfVoxels;
+  this->numberOfZeros = 0;
+  for (unsigned int chunk = 0; chunk < numberOfChunks; chunk++) {
+    this->numberOfZeros += zeros[chunk];
+  }
+
+  // Turn the counts into where each chunk starts writing in each bucket (i.e. a prefix sum, bucket by bucket).
+  bucketStarts.resize(NUMBER_OF_BUCKETS + 1);
+  unsigned int position = 0;
+  for (unsigned int bucket = 0; bucket < NUMBER_OF_BUCKETS; bucket++) {
+    bucketStarts[bucket] = position;
+    for (unsigned int chunk = 0; chunk < numberOfChunks; chunk++) {
+      unsigned int & count = counts[(size_t) chunk * NUMBER_OF_BUCKETS + bucket];
+      unsigned int chunkCount = count;
+      count = position;
+      position += chunkCount;
+    }
+  }
+  bucketStarts[NUMBER_OF_BUCKETS] = position;
+
+  // Fill in the buckets.
+  sortedVoxels.resize(numberOfVoxels);
+  BucketFiller<TPixel> filler;
+  filler.index = this;
+  filler.values = values;
+  filler.numberOfVoxels = numberOfVoxels;
+  filler.numberOfChunks = numberOfChunks;
+  filler.positions = &counts;
+  filler.sortedVoxels = &sortedVoxels;
+  ParallelFor::run(numberOfChunks, filler);
+}
+
+/**
+  * Throws the index away (e.g. to free the memory).
+  */
+void UncertaintyValueIndex::clear() {
+  std::vector<unsigned int>().swap(sortedVoxels);
+  std::vector<unsigned int>().swap(bucketStarts);
+  indexedImage = NULL;
+  indexedMTime = 0;
+  numberOfVoxels = 0;
+  numberOfZeros = 0;
+}
+
+bool UncertaintyValueIndex::isBuilt() const {
+  return !bucketStarts.empty();
+}
+
+/**
+  * The bucket a value falls in. Values outside the indexed range fall in the first/last bucket.
+  */
+unsigned int UncertaintyValueIndex::bucketContaining(double value) const {
+  double bucket = (value - minValue) * bucketScale;
+  if (!(bucket > 0.0)) {
+    return 0;
+  }
+  if (bucket >= NUMBER_OF_BUCKETS) {
+    return NUMBER_OF_BUCKETS - 1;
+  }
+  return (unsigned int) bucket;
+}
+
+/**
+  * The position in getSortedVoxels() of the first voxel in bucket.
+  */
+unsigned int UncertaintyValueIndex::bucketStart(unsigned int bucket) const {
+  return bucketStarts[bucket];
+}
+
+/**
+  * The position in getSortedVoxels() just after the last voxel in bucket.
+  */
+unsigned int UncertaintyValueIndex::bucketEnd(unsigned int bucket) const {
+  return bucketStarts[bucket + 1];
+}
+
+const std::vector<unsigned int> & UncertaintyValueIndex::getSortedVoxels() const {
+  return sortedVoxels;
+}
+
+/**
+  * The number of values indexed (not counting zeros if ignoreZeros is set).
+  */
+itk::uint64_t UncertaintyValueIndex::getNumberOfValues(bool ignoreZeros) const {
+  return ignoreZeros ? numberOfVoxels - numberOfZeros : numberOfVoxels;
+}
+
+/**
+  * The exact value with the given rank (0 is the smallest) among the indexed values (not counting zeros if ignoreZeros is set).
+  * uncertainty must be the indexed image. Walks the bucket counts to find the bucket the rank falls in, then
+  * selects within just that bucket. Returns 0 if there's no such rank.
+  */
+double UncertaintyValueIndex::valueAtRank(mitk::Image::Pointer uncertainty, itk::uint64_t rank, bool ignoreZeros) const {
+  double value = 0.0;
+  if (!isBuilt() || rank >= getNumberOfValues(ignoreZeros)) {
+    return value;
+  }
+  AccessFixedTypeByItk_n(uncertainty, ItkValueAtRank, MITK_ACCESSBYITK_FLOATING_PIXEL_TYPES_SEQ, (3), (rank, ignoreZeros, value));
+  return value;
+}
+
+template <typename TPixel, unsigned int VImageDimension>
+void UncertaintyValueIndex::ItkValueAtRank(itk::Image<TPixel, VImageDimension>* itkImage, itk::uint64_t rank, bool ignoreZeros, double & value) const {
+  const TPixel * values = itkImage->GetBufferPointer();
+
+  // Zeros all fall in the same bucket.
+  unsigned int zeroBucket = bucketContaining(0.0);
+
+  // Find the bucket containing the rank.
+  itk::uint64_t valuesBefore = 0;
+  unsigned int bucket = 0;
+  for (; bucket < NUMBER_OF_BUCKETS; bucket++) {
+    itk::uint64_t valuesInBucket = bucketEnd(bucket) - bucketStart(bucket);
+    if (ignoreZeros && bucket == zeroBucket) {
+      valuesInBucket -= numberOfZeros;
+    }
+    if (valuesBefore + valuesInBucket > rank) {
+      break;
+    }
+    valuesBefore += valuesInBucket;
+  }
+
+  // Select within the bucket.
+  std::vector<double> bucketValues;
+  bucketValues.reserve(bucketEnd(bucket) - bucketStart(bucket));
+  for (unsigned int i = bucketStart(bucket); i < bucketEnd(bucket); i++) {
+    double voxelValue = values[sortedVoxels[i]];
+    if (ignoreZeros && voxelValue == 0.0) {
+      continue;
+    }
+    bucketValues.push_back(voxelValue);
+  }
+  std::vector<double>::iterator nth = bucketValues.begin() + (rank - valuesBefore);
+  std::nth_element(bucketValues.begin(), nth, bucketValues.end());
+  value = *nth;
+}
\ No newline at end of file
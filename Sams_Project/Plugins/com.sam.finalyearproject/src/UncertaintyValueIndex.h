@@ -0,0 +1,65 @@
+#ifndef Uncertainty_Value_Index_h
+#define Uncertainty_Value_Index_h
+
+#include <vector>
+
+#include <mitkImage.h>
+#include <itkImage.h>
+#include <itkIntTypes.h>
+
+/**
+  * An index of the voxels of the uncertainty sorted into buckets by value (a counting sort over NUMBER_OF_BUCKETS
+  * equal width buckets between the smallest and largest value).
+  * Finding the voxels with values in a range only means looking at the buckets that overlap it, so e.g. a threshold
+  * can be moved by only touching the voxels between the old and new cut.
+  * NOTE: Assumes the uncertainty is double or float (see UncertaintyPreprocessor::setSinglePrecision).
+  */
+class UncertaintyValueIndex {
+  public:
+    static const unsigned int NUMBER_OF_BUCKETS = 65536;
+
+    UncertaintyValueIndex();
+    bool update(mitk::Image::Pointer uncertainty);
+    void clear();
+    bool isBuilt() const;
+
+    unsigned int bucketContaining(double value) const;
+    unsigned int bucketStart(unsigned int bucket) const;
+    unsigned int bucketEnd(unsigned int bucket) const;
+    const std::vector<unsigned int> & getSortedVoxels() const;
+
+    itk::uint64_t getNumberOfValues(bool ignoreZeros) const;
+    double valueAtRank(mitk::Image::Pointer uncertainty, itk::uint64_t rank, bool ignoreZeros) const;
+
+  private:
+    // The image the index was built from (and when).
+    const mitk::Image * indexedImage;
+    unsigned long indexedMTime;
+
+    double minValue;
+    double bucketScale;
+    itk::uint64_t numberOfVoxels;
+    itk::uint64_t numberOfZeros;
+
+    // Voxel offsets, bucket by bucket. Bucket b is sortedVoxels[bucketStarts[b]] to sortedVoxels[bucketStarts[b + 1] - 1].
+    std::vector<unsigned int> sortedVoxels;
+    std::vector<unsigned int> bucketStarts;
+
+    template <typename TPixel>
+    void build(const TPixel * values, size_t numberOfVoxels);
+
+    template <typename TPixel>
+    struct RangeFinder;
+    template <typename TPixel>
+    struct BucketCounter;
+    template <typename TPixel>
+    struct BucketFiller;
+
+    // ITK Methods
+    template <typename TPixel, unsigned int VImageDimension>
+    void ItkBuild(itk::Image<TPixel, VImageDimension>* itkImage, size_t numberOfVoxels);
+    template <typename TPixel, unsigned int VImageDimension>
+    void ItkValueAtRank(itk::Image<TPixel, VImageDimension>* itkImage, itk::uint64_t rank, bool ignoreZeros, double & value) const;
+};
+
+#endif
\ No newline at end of file
@@ -86,6 +86,13 @@ mitk::Image::Pointer Util::MitkImageFromNode(mitk::DataNode::Pointer node) {
   return dynamic_cast<mitk::Image*>(node->GetData());
 }
 
+/**
+  * Whether an image is float (e.g. uncertainty preprocessed in single precision) rather than double.
+  */
+bool Util::IsSinglePrecision(const mitk::Image * image) {
+  return image != NULL && image->GetPixelType().GetComponentType() == itk::ImageIOBase::FLOAT;
+}
+
 std::string Util::StringFromStringProperty(mitk::BaseProperty * property) {
   mitk::StringProperty::Pointer stringProperty = dynamic_cast<mitk::StringProperty*>(property);
   if (stringProperty) {
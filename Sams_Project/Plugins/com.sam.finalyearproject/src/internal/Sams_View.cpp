@@ -10,9 +10,14 @@
 // Sam's Helper Functions
 #include "Util.h"
 #include "UncertaintyPreprocessor.h"
+#include "UncertaintyStatistics.h"
+#include "UncertaintyComponentLabeller.h"
 #include "UncertaintySampler.h"
 #include "SurfaceGenerator.h"
 #include "UncertaintySurfaceMapper.h"
+#include "UncertaintyTextureGenerator.h"
+#include "UncertaintyTextureJob.h"
+#include "UncertaintyThresholdJob.h"
 #include "UncertaintyGenerator.h"
 #include "RANSACScanPlaneGenerator.h"
 #include "SVDScanPlaneGenerator.h"
@@ -23,12 +28,14 @@
 #include <mitkIRenderWindowPart.h>
 #include <mitkILinkedRenderWindowPart.h>
 #include <mitkIRenderingManager.h>
+#include <mitkSliceNavigationController.h>
 #include <mitkNodePredicateProperty.h>
 #include <mitkNodePredicateDataType.h>
 
 // C Libraries
 #include <algorithm> // for min/max
 #include <cstdlib>
+#include <cfloat> // for DBL_MIN
 
 // Reconstruction Landmarks
 #include <mitkPointSet.h>
@@ -48,6 +55,8 @@
 #include <QString>
 #include <QLayoutItem>
 #include <QDesktopServices>
+#include <QDir>
+#include <QDateTime>
 
 #include <ctkCmdLineModuleReference.h>
 #include <ctkCmdLineModuleParameter.h>
@@ -103,6 +112,28 @@ const QString CYLINDER_SURFACE_NAME = QString::fromStdString("Cylinder");
 
 const std::string SCAN_PREVIEW_NAME = "Scan Preview";
 
+// ------------------------------------- //
+// ---- Automatic Threshold Methods ---- //
+// ------------------------------------- //
+// (in the order they are in the drop-down)
+const int AUTO_THRESHOLD_OTSU = 0;
+const int AUTO_THRESHOLD_MULTI_OTSU = 1;
+const int AUTO_THRESHOLD_KNEE = 2;
+
+/**
+  * Stops any background work before the view goes.
+  */
+Sams_View::~Sams_View() {
+  CancelUncertaintySphereTexture();
+  CancelThresholdJob();
+  delete sphereTextureGenerator;
+  delete surfaceMapper;
+  delete preprocessor;
+  delete thresholder;
+  delete thresholdSurfaceGenerator;
+  delete timeSeries;
+}
+
 /**
   * Create the UI, connects up Signals and Slots.
   */
@@ -121,6 +152,10 @@ void Sams_View::CreateQtPartControl(QWidget *parent) {
   // Preprocessing
   connect(UI.checkBoxErosionEnabled, SIGNAL(toggled(bool)), this, SLOT(ToggleErosionEnabled(bool)));
 
+  // Time
+  connect(UI.sliderTimeStep, SIGNAL(sliderMoved(int)), this, SLOT(TimeStepSliderMoved(int)));
+  connect(UI.sliderTimeStep, SIGNAL(valueChanged(int)), this, SLOT(TimeStepChanged(int)));
+
   // Thresholding
   connect(UI.pushButtonEnableThreshold, SIGNAL(toggled(bool)), this, SLOT(ToggleUncertaintyThresholding(bool)));
   connect(UI.pushButtonEnableThresholdAutoUpdate, SIGNAL(toggled(bool)), this, SLOT(ToggleUncertaintyThresholdingAutoUpdate(bool)));
@@ -134,13 +169,37 @@ void Sams_View::CreateQtPartControl(QWidget *parent) {
   connect(UI.buttonTop1Percent, SIGNAL(clicked()), this, SLOT(TopOnePercent()));
   connect(UI.buttonTop5Percent, SIGNAL(clicked()), this, SLOT(TopFivePercent()));
   connect(UI.buttonTop10Percent, SIGNAL(clicked()), this, SLOT(TopTenPercent()));
+  connect(UI.buttonAutoThreshold, SIGNAL(clicked()), this, SLOT(AutoThreshold()));
   connect(UI.checkBoxIgnoreZeros, SIGNAL(stateChanged(int)), this, SLOT(ThresholdUncertaintyIfAutoUpdateEnabled()));
+  connect(UI.checkBoxThresholdCrop, SIGNAL(stateChanged(int)), this, SLOT(ThresholdUncertaintyIfAutoUpdateEnabled()));
+  connect(UI.checkBoxThresholdSurface, SIGNAL(stateChanged(int)), this, SLOT(ThresholdUncertaintyIfAutoUpdateEnabled()));
+  connect(UI.checkBoxThresholdComponents, SIGNAL(stateChanged(int)), this, SLOT(ThresholdUncertaintyIfAutoUpdateEnabled()));
+  connect(UI.checkBoxThresholdBands, SIGNAL(stateChanged(int)), this, SLOT(ThresholdUncertaintyIfAutoUpdateEnabled()));
+  connect(UI.spinBoxThresholdBands, SIGNAL(valueChanged(int)), this, SLOT(ThresholdUncertaintyIfAutoUpdateEnabled()));
   connect(UI.buttonThresholdingReset, SIGNAL(clicked()), this, SLOT(ResetThresholds()));
 
+  // Settings that change quickly (e.g. dragging a slider) are only thresholded once they settle.
+  thresholdTimer = new QTimer(this);
+  thresholdTimer->setSingleShot(true);
+  thresholdTimer->setInterval(THRESHOLD_DEBOUNCE_MS);
+  connect(thresholdTimer, SIGNAL(timeout()), this, SLOT(StartThresholdJob()));
+
   // Texture Mapping
   connect(UI.spinBoxSphereThetaResolution, SIGNAL(valueChanged(int)), this, SLOT(ThetaResolutionChanged(int)));
   connect(UI.spinBoxSpherePhiResolution, SIGNAL(valueChanged(int)), this, SLOT(PhiResolutionChanged(int)));
   connect(UI.buttonSphere, SIGNAL(clicked()), this, SLOT(GenerateUncertaintySphere()));
+  // Any change to the settings makes a texture being refined out of date.
+  connect(UI.spinBoxSphereThetaResolution, SIGNAL(valueChanged(int)), this, SLOT(CancelUncertaintySphereTexture()));
+  connect(UI.spinBoxSpherePhiResolution, SIGNAL(valueChanged(int)), this, SLOT(CancelUncertaintySphereTexture()));
+  connect(UI.radioButtonSphereSampleAccumulatorAverage, SIGNAL(toggled(bool)), this, SLOT(CancelUncertaintySphereTexture()));
+  connect(UI.radioButtonSphereSampleAccumulatorMin, SIGNAL(toggled(bool)), this, SLOT(CancelUncertaintySphereTexture()));
+  connect(UI.radioButtonSphereSampleAccumulatorMax, SIGNAL(toggled(bool)), this, SLOT(CancelUncertaintySphereTexture()));
+  connect(UI.radioButtonSphereScalingNone, SIGNAL(toggled(bool)), this, SLOT(CancelUncertaintySphereTexture()));
+  connect(UI.radioButtonSphereScalingLinear, SIGNAL(toggled(bool)), this, SLOT(CancelUncertaintySphereTexture()));
+  connect(UI.radioButtonSphereLayoutEquirectangular, SIGNAL(toggled(bool)), this, SLOT(CancelUncertaintySphereTexture()));
+  connect(UI.radioButtonSphereLayoutOctahedral, SIGNAL(toggled(bool)), this, SLOT(CancelUncertaintySphereTexture()));
+  connect(UI.radioButtonSphereLayoutCubeMap, SIGNAL(toggled(bool)), this, SLOT(CancelUncertaintySphereTexture()));
+  connect(UI.checkBoxSphereShareAntipodalRays, SIGNAL(toggled(bool)), this, SLOT(CancelUncertaintySphereTexture()));
 
   // Surface Mapping
   connect(UI.buttonSurfaceMapping, SIGNAL(clicked()), this, SLOT(SurfaceMapping()));
@@ -225,6 +284,9 @@ void Sams_View::Initialize() {
   // Hide erode options boxes.
   UI.widgetVisualizeSelectErodeOptions->setVisible(false);
 
+  // Hide time controls (until there's a 4D uncertainty).
+  UI.widgetVisualizeTimeStep->setVisible(false);
+
   // Disable visualisation
   UI.widgetVisualizeThreshold->setEnabled(false);
   UI.widgetVisualizeSphere->setEnabled(false);
@@ -529,6 +591,7 @@ void Sams_View::ScanSimulationSimulateScan() {
   simulator->setScanSize(UI.spinBoxScanDimensionX->value(), UI.spinBoxScanDimensionY->value(), UI.spinBoxScanDimensionZ->value());
   simulator->setMotionCorruption(UI.checkBoxMotionCorruptionEnabled->isChecked());
   simulator->setMotionCorruptionMaxAngle(UI.spinBoxMotionCorruptionAngle->value());
+  simulator->setSinglePrecision(UI.checkBoxSinglePrecisionEnabled->isChecked());
   simulator->setScanCenter(center);
 
   mitk::Image::Pointer sliceStack = simulator->scan();
@@ -1328,6 +1391,10 @@ void Sams_View::UpdateSelectionDropDowns() {
   * correct, we do some pre-processing on the data.
   */
 void Sams_View::ConfirmSelection() {
+  // Any texture being refined (or threshold being made) is for the old uncertainty.
+  CancelUncertaintySphereTexture();
+  CancelThresholdJob();
+
   // Get the DataNodes corresponding to the drop-down boxes.
   mitk::DataNode::Pointer scanNode = this->GetDataStorage()->GetNamedNode(UI.comboBoxScan->currentText().toStdString());
   mitk::DataNode::Pointer uncertaintyNode = this->GetDataStorage()->GetNamedNode(UI.comboBoxUncertainty->currentText().toStdString());
@@ -1385,7 +1452,22 @@ void Sams_View::ConfirmSelection() {
   this->scan = scanNode;
   this->uncertainty = uncertaintyNode;
 
+  // The uncertainty may have a volume per timestep (e.g. cine MRI). Stay on the same timestep if there is one.
+  if (timeSeries == NULL) {
+    timeSeries = new UncertaintyTimeSeries();
+  }
+  timeSeries->setUncertainty(GetMitkUncertainty());
+  timeSeries->clearPreprocessed();
+  unsigned int numberOfTimeSteps = timeSeries->getNumberOfTimeSteps();
+  timeStep = std::min(timeStep, numberOfTimeSteps - 1);
+  UI.sliderTimeStep->setMaximum(numberOfTimeSteps - 1);
+  UI.sliderTimeStep->setValue(timeStep);
+  UI.labelTimeStep->setText(QString::number(timeStep));
+  UI.widgetVisualizeTimeStep->setVisible(numberOfTimeSteps > 1);
+  mappedSurface = 0;
+
   // Preprocess the uncertainty.
+  ReadPreprocessingSettings();
   PreprocessNode(this->uncertainty);
 
   // Save dimensions.
@@ -1427,6 +1509,9 @@ void Sams_View::ResetPreprocessingSettings() {
   UI.checkBoxInversionEnabled->setChecked(false);
   UI.checkBoxErosionEnabled->setChecked(false);
   UI.spinBoxErodeThickness->setValue(2);
+  UI.checkBoxErodeOnlyBorder->setChecked(false);
+  UI.checkBoxStreamingEnabled->setChecked(false);
+  UI.checkBoxSinglePrecisionEnabled->setChecked(false);
 }
 
 /**
@@ -1437,27 +1522,112 @@ void Sams_View::ToggleErosionEnabled(bool checked) {
 }
 
 /**
-  * Normalizes, Inverts (if enabled), Erodes (if enabled) the uncertainty and
+  * Takes the preprocessing settings from the UI. Every timestep is preprocessed with these until they're read again.
+  */
+void Sams_View::ReadPreprocessingSettings() {
+  preprocessingSettings.invert = UI.checkBoxInversionEnabled->isChecked();
+  preprocessingSettings.erode = UI.checkBoxErosionEnabled->isChecked();
+  preprocessingSettings.erodeThickness = UI.spinBoxErodeThickness->value();
+  preprocessingSettings.erodeOnlyBorder = UI.checkBoxErodeOnlyBorder->isChecked();
+  preprocessingSettings.align = UI.checkBoxAligningEnabled->isChecked();
+  preprocessingSettings.streaming = UI.checkBoxStreamingEnabled->isChecked();
+  preprocessingSettings.singlePrecision = UI.checkBoxSinglePrecisionEnabled->isChecked();
+}
+
+/**
+  * Normalizes, Inverts (if enabled), Erodes (if enabled) the uncertainty (at the current timestep) and
   * saves the result as a child of the original.
   */
 void Sams_View::PreprocessNode(mitk::DataNode::Pointer node) {
-  UncertaintyPreprocessor * preprocessor = new UncertaintyPreprocessor();
+  mitk::Image::Pointer fullyProcessedMitkImage = PreprocessTimeStep();
+  preprocessedUncertainty = SaveDataNode("Preprocessed", fullyProcessedMitkImage, true, node);
+  UncertaintyStatistics::setForNode(preprocessedUncertainty, *timeSeries->getPreprocessedStatistics(timeStep));
+}
+
+/**
+  * Preprocesses the current timestep of the uncertainty with the settings read when the selection was confirmed
+  * (see ReadPreprocessingSettings), and keeps it in the time series.
+  * The preprocessor is kept, so only the stages after a changed setting are redone.
+  */
+mitk::Image::Pointer Sams_View::PreprocessTimeStep() {
+  if (preprocessor == NULL) {
+    preprocessor = new UncertaintyPreprocessor();
+  }
   preprocessor->setScan(GetMitkScan());
-  preprocessor->setUncertainty(GetMitkUncertainty());
+  preprocessor->setUncertainty(timeSeries->getTimeStep(timeStep));
+  preprocessor->setUncertaintyStatistics(timeSeries->getStatistics(timeStep));
   preprocessor->setNormalizationParams(
     NORMALIZED_MIN,
     NORMALIZED_MAX
   );
   preprocessor->setErodeParams(
-    UI.spinBoxErodeThickness->value()
+    preprocessingSettings.erodeThickness,
+    preprocessingSettings.erodeOnlyBorder
   );
+  if (preprocessingSettings.streaming) {
+    QString fileName = QDir(QDir::tempPath()).filePath(
+      QString("Preprocessed-%1.raw").arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmsszzz"))
+    );
+    preprocessor->setStreamingParams(PREPROCESSING_SLAB_THICKNESS, fileName.toStdString());
+  }
+  else {
+    preprocessor->setStreamingParams(0, "");
+  }
+  preprocessor->setSinglePrecision(preprocessingSettings.singlePrecision);
   mitk::Image::Pointer fullyProcessedMitkImage = preprocessor->preprocessUncertainty(
-    UI.checkBoxInversionEnabled->isChecked(),
-    UI.checkBoxErosionEnabled->isChecked(),
-    UI.checkBoxAligningEnabled->isChecked()
+    preprocessingSettings.invert,
+    preprocessingSettings.erode,
+    preprocessingSettings.align
   );
-  delete preprocessor;
-  preprocessedUncertainty = SaveDataNode("Preprocessed", fullyProcessedMitkImage, true, node);
+  timeSeries->setPreprocessed(timeStep, fullyProcessedMitkImage);
+  return fullyProcessedMitkImage;
+}
+
+// -------------- //
+// ---- Time ---- //
+// -------------- //
+
+/**
+  * Shows which timestep the slider is on while it's being dragged (it's only moved there once it's let go).
+  */
+void Sams_View::TimeStepSliderMoved(int timeStep) {
+  UI.labelTimeStep->setText(QString::number(timeStep));
+}
+
+/**
+  * Moves to another timestep of the uncertainty. It's preprocessed (unless it still is from before) and swapped into
+  * the preprocessed node, then the threshold and mapped surface (if there are any) are redone for it.
+  * The statistics of each timestep are kept, so going back and forth doesn't compute them again.
+  */
+void Sams_View::TimeStepChanged(int timeStep) {
+  UI.labelTimeStep->setText(QString::number(timeStep));
+  if (timeSeries == NULL || preprocessedUncertainty.IsNull() || (unsigned int) timeStep == this->timeStep) {
+    return;
+  }
+
+  // Anything being made is for the old timestep.
+  CancelUncertaintySphereTexture();
+  CancelThresholdJob();
+  this->timeStep = timeStep;
+
+  mitk::Image::Pointer preprocessed = timeSeries->getPreprocessed(timeStep);
+  if (preprocessed.IsNull()) {
+    preprocessed = PreprocessTimeStep();
+  }
+  preprocessedUncertainty->SetData(preprocessed);
+  UncertaintyStatistics::setForNode(preprocessedUncertainty, *timeSeries->getPreprocessedStatistics(timeStep));
+
+  // Show the scan (if it's 4D too) at the same time.
+  mitk::IRenderWindowPart* renderWindowPart = this->GetRenderWindowPart();
+  if (renderWindowPart != NULL) {
+    renderWindowPart->GetTimeNavigationController()->GetTime()->SetPos(timeStep);
+  }
+
+  if (thresholdingEnabled) {
+    ThresholdUncertaintyInBackground();
+  }
+  RemapSurface();
+  this->RequestRenderWindowUpdate();
 }
 
 // ---------------------- //
@@ -1472,17 +1642,12 @@ void Sams_View::ToggleUncertaintyThresholding(bool checked) {
     UI.thresholdingEnabledIndicator1->setChecked(true);
     UI.thresholdingEnabledIndicator2->setChecked(true);
     thresholdingEnabled = true;
-    thresholder = new UncertaintyThresholder();
     ThresholdUncertainty();
   }
   else {
     UI.thresholdingEnabledIndicator1->setChecked(false);
     UI.thresholdingEnabledIndicator2->setChecked(false);
     thresholdingEnabled = false;
-    if (thresholder) {
-      delete thresholder;
-      thresholder = NULL;
-    }
     RemoveThresholdedUncertainty();
   }
 }
@@ -1509,7 +1674,9 @@ void Sams_View::SetLowerThreshold(double lower) {
   thresholdingEnabled = false;
   UI.sliderMinThreshold->setValue(sliderValue);
   thresholdingEnabled = wasEnabled;
-  LowerThresholdChanged(sliderValue);
+
+  // Use the exact value (the slider only has 1000 steps).
+  LowerThresholdValueChanged(std::min(std::max(lower, (double) NORMALIZED_MIN), (double) NORMALIZED_MAX));
 }
 
 /**
@@ -1535,6 +1702,14 @@ void Sams_View::LowerThresholdChanged() {
   */
 void Sams_View::LowerThresholdChanged(int lower) {
   float translatedLowerValue = ((NORMALIZED_MAX - NORMALIZED_MIN) / 1000) * lower + NORMALIZED_MIN;
+  LowerThresholdValueChanged(translatedLowerValue);
+}
+
+/**
+  * Set Lower Threshold
+  * - lower is between NORMALIZED_MIN and NORMALIZED_MAX
+  */
+void Sams_View::LowerThresholdValueChanged(double translatedLowerValue) {
   if (translatedLowerValue > upperThreshold) {
     std::cout << "Lower (" << translatedLowerValue << ") higher than Upper (" << upperThreshold << ") - setting to (" << UI.sliderMaxThreshold->value() << ")" << std::endl;
     UI.sliderMinThreshold->setValue(UI.sliderMaxThreshold->value());
@@ -1560,7 +1735,9 @@ void Sams_View::SetUpperThreshold(double upper) {
   thresholdingEnabled = false;
   UI.sliderMaxThreshold->setValue(sliderValue);
   thresholdingEnabled = wasEnabled;
-  UpperThresholdChanged(sliderValue);
+
+  // Use the exact value (the slider only has 1000 steps).
+  UpperThresholdValueChanged(std::min(std::max(upper, (double) NORMALIZED_MIN), (double) NORMALIZED_MAX));
 }
 
 /**
@@ -1586,6 +1763,14 @@ void Sams_View::UpperThresholdChanged() {
   */
 void Sams_View::UpperThresholdChanged(int upper) {
   float translatedUpperValue = ((NORMALIZED_MAX - NORMALIZED_MIN) / 1000) * upper + NORMALIZED_MIN;
+  UpperThresholdValueChanged(translatedUpperValue);
+}
+
+/**
+  * Set Upper Threshold
+  * - upper is between NORMALIZED_MIN and NORMALIZED_MAX
+  */
+void Sams_View::UpperThresholdValueChanged(double translatedUpperValue) {
   if (translatedUpperValue < lowerThreshold) {
     std::cout << "Upper (" << translatedUpperValue << ") higher than Lower (" << lowerThreshold << ") - setting to (" << UI.sliderMinThreshold->value() << ")" << std::endl;
     UI.sliderMaxThreshold->setValue(UI.sliderMinThreshold->value());
@@ -1642,10 +1827,8 @@ void Sams_View::TopXPercent(double percentage) {
   thresholdingEnabled = wasEnabled;
 
   if (thresholdingEnabled) {
-    thresholder->setUncertainty(GetMitkPreprocessedUncertainty());
-    thresholder->setIgnoreZeros(UI.checkBoxIgnoreZeros->isChecked());
     double min, max;
-    thresholder->getTopXPercentThreshold(percentage / 100.0, min, max);
+    GetThresholder()->getTopXPercentThreshold(percentage / 100.0, min, max);
 
     // Filter the uncertainty to only show the top 10%. Avoid filtering twice by disabling thresholding.
     thresholdingEnabled = false;
@@ -1655,6 +1838,40 @@ void Sams_View::TopXPercent(double percentage) {
   }
 }
 
+/**
+  * Picks the threshold from the histogram with the method in the drop-down, and shows everything at or below it.
+  * Multi-Otsu also picks the cuts between the bands. (one class per band, with the best class left out)
+  */
+void Sams_View::AutoThreshold() {
+  if (!thresholdingEnabled) {
+    return;
+  }
+
+  double max;
+  automaticBandCuts.clear();
+  switch (UI.comboBoxAutoThreshold->currentIndex()) {
+    case AUTO_THRESHOLD_MULTI_OTSU: {
+      std::vector<double> thresholds = GetThresholder()->getMultiOtsuThresholds(UI.spinBoxThresholdBands->value() + 1);
+      max = thresholds.back();
+      automaticBandCuts.push_back(NORMALIZED_MIN);
+      automaticBandCuts.insert(automaticBandCuts.end(), thresholds.begin(), thresholds.end());
+      break;
+    }
+    case AUTO_THRESHOLD_KNEE:
+      max = GetThresholder()->getKneeThreshold();
+      break;
+    default:
+      max = GetThresholder()->getOtsuThreshold();
+      break;
+  }
+
+  // Avoid filtering twice by disabling thresholding.
+  thresholdingEnabled = false;
+  SetLowerThreshold(NORMALIZED_MIN);
+  thresholdingEnabled = true;
+  SetUpperThreshold(max);
+}
+
 /**
   * Shows the threshold.
   */
@@ -1662,13 +1879,20 @@ void Sams_View::DisplayThreshold() {
   // Hide Everything
   HideAllDataNodes();
 
-  // Make Scan and Thresholded Visible  
+  // Make Scan and Thresholded (or its surface, or its bands) Visible
+  mitk::DataNode::Pointer thresholdedNode = thresholdedUncertainty;
+  if (UI.checkBoxThresholdSurface->isChecked()) {
+    thresholdedNode = thresholdedSurface;
+  }
+  else if (UI.checkBoxThresholdBands->isChecked() && thresholdedBands.IsNotNull()) {
+    thresholdedNode = thresholdedBands;
+  }
   ShowDataNode(this->scan);
-  ShowDataNode(thresholdedUncertainty);
+  ShowDataNode(thresholdedNode);
 
   // Put Scan behind Thresholded Uncertainty
   SetDataNodeLayer(this->scan, 0);
-  SetDataNodeLayer(thresholdedUncertainty, 1);
+  SetDataNodeLayer(thresholdedNode, 1);
 
   this->RequestRenderWindowUpdate();
 }
@@ -1677,6 +1901,12 @@ void Sams_View::DisplayThreshold() {
   * Hides the threshold.
   */
 void Sams_View::RemoveThresholdedUncertainty() {
+  CancelThresholdJob();
+  RemoveDataNode("Thresholded Bands", preprocessedUncertainty);
+  thresholdedBands = 0;
+  RemoveDataNode("Thresholded Regions", preprocessedUncertainty);
+  UI.labelThresholdComponents->setText("");
+  RemoveDataNode("Thresholded Surface", preprocessedUncertainty);
   RemoveDataNode("Thresholded", preprocessedUncertainty);
 }
 
@@ -1693,23 +1923,157 @@ void Sams_View::ResetThresholds() {
 
 /**
   * Called when a setting is changed. Only actually updates the threshold
-  * when auto update is enabled.
+  * when auto update is enabled. The threshold is made in the background.
   */
 void Sams_View::ThresholdUncertaintyIfAutoUpdateEnabled() {
   if (thresholdingAutoUpdate) {
-    ThresholdUncertainty();
+    ThresholdUncertaintyInBackground();
   }
 }
 
 /**
-  * Thresholds the uncertainty.
+  * Asks for the uncertainty to be thresholded in the background, once the settings have stopped changing.
+  * Requests made while a threshold is being made are combined, so only the latest range is thresholded next.
   */
-void Sams_View::ThresholdUncertainty() {
-  UncertaintyThresholder * thresholder = new UncertaintyThresholder();
+void Sams_View::ThresholdUncertaintyInBackground() {
+  thresholdPending = true;
+  thresholdTimer->start();
+}
+
+/**
+  * Starts thresholding the latest range in the background (unless a threshold is already being made, in which case
+  * it's started when that one finishes).
+  */
+void Sams_View::StartThresholdJob() {
+  if (thresholdJob != NULL || !thresholdPending) {
+    return;
+  }
+  thresholdPending = false;
+
+  if (!thresholdingEnabled || preprocessedUncertainty.IsNull()) {
+    return;
+  }
+
+  thresholdJobId++;
+  thresholdJob = new UncertaintyThresholdJob(GetThresholder(), lowerThreshold, upperThreshold, thresholdJobId);
+  std::vector<double> cuts;
+  if (GetThresholdBandCuts(cuts)) {
+    thresholdJob->setBands(cuts);
+  }
+  connect(thresholdJob, SIGNAL(thresholded(unsigned int)), this, SLOT(ThresholdJobFinished(unsigned int)), Qt::QueuedConnection);
+  thresholdJob->start();
+}
+
+/**
+  * Shows the threshold from the background job, then starts on the latest range if it has moved since.
+  */
+void Sams_View::ThresholdJobFinished(unsigned int jobId) {
+  // Ignore jobs that have since been cancelled. Their signals can still be queued after they're deleted, and a new job
+  // can be given the same address, so they're told apart by id rather than by sender().
+  if (thresholdJob == NULL || jobId != thresholdJobId) {
+    return;
+  }
+
+  // It's done, so deleting it only waits for its thread to exit.
+  mitk::Image::Pointer thresholdedImage = thresholdJob->getMask();
+  mitk::Image::Pointer bands = thresholdJob->getBands();
+  disconnect(thresholdJob, 0, this, 0);
+  delete thresholdJob;
+  thresholdJob = NULL;
+
+  if (thresholdingEnabled && thresholdedImage.IsNotNull()) {
+    ShowThresholdedUncertainty(thresholdedImage, bands);
+  }
+  else if (thresholdedImage.IsNotNull()) {
+    thresholder->cancelThreshold();
+  }
+
+  // If the timer's still running, it'll start the next one.
+  if (thresholdPending && !thresholdTimer->isActive()) {
+    StartThresholdJob();
+  }
+}
+
+/**
+  * Stops any threshold being made in the background, and forgets any waiting to be made.
+  */
+void Sams_View::CancelThresholdJob() {
+  thresholdPending = false;
+  if (thresholdTimer != NULL) {
+    thresholdTimer->stop();
+  }
+  if (thresholdJob == NULL) {
+    return;
+  }
+
+  // If it finished before it was cancelled, its mask is thrown away, so the one on screen has to stay the last one.
+  thresholdJob->cancel();
+  thresholdJob->wait();
+  if (thresholdJob->getMask().IsNotNull()) {
+    thresholder->cancelThreshold();
+  }
+  disconnect(thresholdJob, 0, this, 0);
+  delete thresholdJob;
+  thresholdJob = NULL;
+}
+
+/**
+  * The thresholder for the preprocessed uncertainty. It's kept between thresholds so its index and mask are only
+  * built once per preprocessed uncertainty (they're rebuilt if the image is replaced or modified).
+  * Its histogram comes from the statistics cached on the preprocessed node.
+  * It's double buffered, so the threshold on screen isn't touched while the next one is made in the background.
+  * Waits for any background threshold to finish first (as the job is using it).
+  */
+UncertaintyThresholder * Sams_View::GetThresholder() {
+  if (thresholdJob != NULL) {
+    thresholdJob->wait();
+  }
+  if (thresholder == NULL) {
+    thresholder = new UncertaintyThresholder();
+    thresholder->setDoubleBuffered(true);
+  }
   thresholder->setUncertainty(GetMitkPreprocessedUncertainty());
+  thresholder->setStatistics(UncertaintyStatistics::forNode(preprocessedUncertainty));
   thresholder->setIgnoreZeros(UI.checkBoxIgnoreZeros->isChecked());
-  mitk::Image::Pointer thresholdedImage = thresholder->thresholdUncertainty(lowerThreshold, upperThreshold);
-  delete thresholder;
+  thresholder->setCropToNonZeros(UI.checkBoxThresholdCrop->isChecked());
+  return thresholder;
+}
+
+/**
+  * Thresholds the uncertainty (now, rather than in the background).
+  */
+void Sams_View::ThresholdUncertainty() {
+  CancelThresholdJob();
+  mitk::Image::Pointer thresholdedImage = GetThresholder()->thresholdUncertainty(lowerThreshold, upperThreshold);
+  if (thresholdedImage.IsNull()) {
+    return;
+  }
+  mitk::Image::Pointer bands = NULL;
+  std::vector<double> cuts;
+  if (GetThresholdBandCuts(cuts)) {
+    bands = thresholder->thresholdUncertaintyIntoBands(cuts);
+  }
+  ShowThresholdedUncertainty(thresholdedImage, bands);
+}
+
+/**
+  * Puts a new threshold on screen, along with its surface, regions and bands (if enabled).
+  * NOTE: Must be called on the GUI thread.
+  */
+void Sams_View::ShowThresholdedUncertainty(mitk::Image::Pointer thresholdedImage, mitk::Image::Pointer bands) {
+  UpdateThresholdSurface(thresholdedImage);
+  UpdateThresholdComponents(thresholdedImage);
+  UpdateThresholdBands(bands);
+
+  // If it's already shown, swap the new mask into the node (the thresholder alternates between two masks, and may
+  // have updated one in place) and re-render.
+  if (thresholdedUncertainty.IsNotNull() && this->GetDataStorage()->Exists(thresholdedUncertainty)) {
+    if (thresholdedUncertainty->GetData() != thresholdedImage.GetPointer()) {
+      thresholdedUncertainty->SetData(thresholdedImage);
+    }
+    DisplayThreshold();
+    return;
+  }
 
   // Save it. (replace if it already exists)
   thresholdedUncertainty = SaveDataNode("Thresholded", thresholdedImage, true, preprocessedUncertainty);
@@ -1741,6 +2105,149 @@ void Sams_View::ThresholdUncertainty() {
   DisplayThreshold();
 }
 
+/**
+  * Extracts the surface of the thresholded uncertainty (if showing it as a surface is enabled).
+  * The generator is kept so moving the threshold only re-extracts the parts of the surface it can affect.
+  */
+void Sams_View::UpdateThresholdSurface(mitk::Image::Pointer thresholdedImage) {
+  if (!UI.checkBoxThresholdSurface->isChecked()) {
+    RemoveDataNode("Thresholded Surface", preprocessedUncertainty);
+    thresholdedSurface = 0;
+    return;
+  }
+
+  if (thresholdSurfaceGenerator == NULL) {
+    thresholdSurfaceGenerator = new UncertaintyIsoSurfaceGenerator();
+  }
+  double min, max;
+  thresholder->getMaskRange(min, max);
+  thresholdSurfaceGenerator->setUncertainty(thresholder->getCroppedUncertainty());
+  thresholdSurfaceGenerator->setMask(thresholdedImage);
+  mitk::Surface::Pointer surface = thresholdSurfaceGenerator->generateSurface(min, max);
+
+  // The generator updates the same surface, so it only needs saving the first time.
+  if (thresholdedSurface.IsNotNull() && thresholdedSurface->GetData() == surface.GetPointer() &&
+      this->GetDataStorage()->Exists(thresholdedSurface)) {
+    surface->Modified();
+    return;
+  }
+  thresholdedSurface = SaveDataNode("Thresholded Surface", surface, true, preprocessedUncertainty);
+  thresholdedSurface->SetProperty("color", mitk::ColorProperty::New(1.0, 0.0, 0.0));
+  thresholdedSurface->SetProperty("opacity", mitk::FloatProperty::New(0.5));
+  thresholdedSurface->SetProperty("layer", mitk::IntProperty::New(10));
+}
+
+/**
+  * The cuts splitting the threshold range into bands (if bands are enabled). These are the ones picked by
+  * AutoThreshold if the range hasn't moved since, otherwise equal bands.
+  * Returns false if they aren't.
+  */
+bool Sams_View::GetThresholdBandCuts(std::vector<double> & cuts) {
+  cuts.clear();
+  if (!UI.checkBoxThresholdBands->isChecked()) {
+    return false;
+  }
+
+  unsigned int numberOfBands = UI.spinBoxThresholdBands->value();
+  if (automaticBandCuts.size() == numberOfBands + 1 &&
+      automaticBandCuts.front() == lowerThreshold && automaticBandCuts.back() == upperThreshold) {
+    cuts = automaticBandCuts;
+    return true;
+  }
+  for (unsigned int i = 0; i <= numberOfBands; i++) {
+    cuts.push_back(lowerThreshold + (upperThreshold - lowerThreshold) * i / numberOfBands);
+  }
+  return true;
+}
+
+/**
+  * Shows the bands of the thresholded uncertainty (if enabled), each in its own colour. The lowest band (the worst
+  * uncertainty) is red and the most opaque, going through yellow to green.
+  */
+void Sams_View::UpdateThresholdBands(mitk::Image::Pointer bands) {
+  if (bands.IsNull()) {
+    RemoveDataNode("Thresholded Bands", preprocessedUncertainty);
+    thresholdedBands = 0;
+    return;
+  }
+
+  // Swap the new labels into the node if it's already there.
+  if (thresholdedBands.IsNotNull() && this->GetDataStorage()->Exists(thresholdedBands)) {
+    thresholdedBands->SetData(bands);
+  }
+  else {
+    thresholdedBands = SaveDataNode("Thresholded Bands", bands, true, preprocessedUncertainty);
+    thresholdedBands->SetProperty("binary", mitk::BoolProperty::New(false));
+    thresholdedBands->SetProperty("volumerendering", mitk::BoolProperty::New(true));
+    thresholdedBands->SetProperty("layer", mitk::IntProperty::New(10));
+    thresholdedBands->SetProperty("opacity", mitk::FloatProperty::New(0.5));
+  }
+
+  // One colour per band. (label 0 is outside every band)
+  unsigned int numberOfBands = UI.spinBoxThresholdBands->value();
+  mitk::TransferFunction::ControlPoints scalarOpacityPoints;
+  vtkSmartPointer<vtkColorTransferFunction> colorTransferFunction = vtkSmartPointer<vtkColorTransferFunction>::New();
+  scalarOpacityPoints.push_back(std::make_pair(0.0, 0.0));
+  scalarOpacityPoints.push_back(std::make_pair(0.5, 0.0));
+  colorTransferFunction->AddRGBPoint(0.0, 0.0, 0.0, 0.0);
+  for (unsigned int band = 1; band <= numberOfBands; band++) {
+    double position = (numberOfBands > 1) ? (band - 1.0) / (numberOfBands - 1.0) : 0.0;
+    double red = (position < 0.5) ? 1.0 : 2.0 * (1.0 - position);
+    double green = (position < 0.5) ? 2.0 * position : 1.0;
+    double opacity = 1.0 - 0.8 * position;
+
+    // Flat across the band, so neighbouring bands don't blend.
+    scalarOpacityPoints.push_back(std::make_pair(band - 0.49, opacity));
+    scalarOpacityPoints.push_back(std::make_pair(band + 0.49, opacity));
+    colorTransferFunction->AddRGBPoint(band - 0.49, red, green, 0.0);
+    colorTransferFunction->AddRGBPoint(band + 0.49, red, green, 0.0);
+  }
+
+  mitk::TransferFunction::Pointer transferFunction = mitk::TransferFunction::New();
+  transferFunction->SetScalarOpacityPoints(scalarOpacityPoints);
+  transferFunction->SetColorTransferFunction(colorTransferFunction);
+  thresholdedBands->SetProperty("TransferFunction", mitk::TransferFunctionProperty::New(transferFunction));
+}
+
+/**
+  * Finds the separate regions of the thresholded uncertainty (if enabled). Saves the labels (hidden) and
+  * shows how many there are and where the largest is.
+  */
+void Sams_View::UpdateThresholdComponents(mitk::Image::Pointer thresholdedImage) {
+  if (!UI.checkBoxThresholdComponents->isChecked()) {
+    RemoveDataNode("Thresholded Regions", preprocessedUncertainty);
+    UI.labelThresholdComponents->setText("");
+    return;
+  }
+
+  UncertaintyComponentLabeller labeller;
+  labeller.setUncertainty(thresholder->getCroppedUncertainty());
+  labeller.setMask(thresholdedImage);
+  labeller.labelComponents();
+
+  const std::vector<UncertaintyComponentLabeller::Component> & components = labeller.getComponents();
+  if (components.empty()) {
+    RemoveDataNode("Thresholded Regions", preprocessedUncertainty);
+    UI.labelThresholdComponents->setText("No regions");
+    return;
+  }
+
+  mitk::DataNode::Pointer regions = SaveDataNode("Thresholded Regions", labeller.getLabels(), true, preprocessedUncertainty);
+  regions->SetProperty("visible", mitk::BoolProperty::New(false));
+
+  // The mask may be cropped, so put the centroid back in the whole uncertainty's voxels.
+  const UncertaintyComponentLabeller::Component & largest = components[labeller.getLargestComponent()];
+  itk::ImageRegion<3> croppedRegion = thresholder->getCroppedRegion();
+  UI.labelThresholdComponents->setText(
+    QString("%1 regions (largest: %2 voxels at (%3, %4, %5))")
+      .arg(components.size())
+      .arg((qulonglong) largest.numberOfVoxels)
+      .arg(largest.centroid[0] + croppedRegion.GetIndex(0), 0, 'f', 1)
+      .arg(largest.centroid[1] + croppedRegion.GetIndex(1), 0, 'f', 1)
+      .arg(largest.centroid[2] + croppedRegion.GetIndex(2), 0, 'f', 1)
+  );
+}
+
 // ---------------------------- //
 // ---- Uncertainty Sphere ---- //
 // ---------------------------- //
@@ -1771,6 +2278,14 @@ void Sams_View::PhiResolutionChanged(int value) {
   * Maps the uncertainty to the surface of a sphere.
   */
 void Sams_View::GenerateUncertaintySphere() {
+  CancelUncertaintySphereTexture();
+
+  // Texturing is a faster alternative to mapping every point of the sphere.
+  if (UI.radioButtonSphereMethodTexture->isChecked()) {
+    GenerateUncertaintySphereTexture();
+    return;
+  }
+
   std::ostringstream name;
   name << "Sphere Surface";
   mitk::Surface::Pointer generatedSurface = SurfaceGenerator::generateSphere(UI.spinBoxSphereThetaResolution->value(), UI.spinBoxSphereThetaResolution->value());
@@ -1822,13 +2337,139 @@ void Sams_View::GenerateUncertaintySphere() {
 
   bool invertNormals = true;
 
-  SurfaceMapping(surfaceNode, samplingAccumulator, samplingDistance, scaling, colour, registration, invertNormals, false);
+  SurfaceMapping(surfaceNode, samplingAccumulator, samplingDistance, scaling, colour, registration, invertNormals, false,
+                 UI.checkBoxSphereShareAntipodalRays->isChecked());
+
+  HideAllDataNodes();
+  ShowDataNode(surfaceNode);
+  this->RequestRenderWindowUpdate();
+}
+
+/**
+  * Maps the uncertainty to a texture (horizontal x vertical texels) and wraps it around a sphere.
+  * The texture is sampled in parallel so this is much faster than mapping each point of a sphere.
+  * NOTE: The texture is black and white and always samples from the center to the edge (half).
+  */
+void Sams_View::GenerateUncertaintySphereTexture() {
+  CancelUncertaintySphereTexture();
+
+  // The generator is kept so that regenerating after the uncertainty changes only resamples what's changed.
+  if (sphereTextureGenerator == NULL) {
+    sphereTextureGenerator = new UncertaintyTextureGenerator();
+    sphereTextureGenerator->setIncremental(true);
+  }
+  UncertaintyTextureGenerator * textureGenerator = sphereTextureGenerator;
+  textureGenerator->setUncertainty(GetMitkPreprocessedUncertainty());
+  textureGenerator->setDimensions(UI.spinBoxSphereThetaResolution->value(), UI.spinBoxSpherePhiResolution->value());
+  textureGenerator->setScalingLinear(UI.radioButtonSphereScalingLinear->isChecked());
+  textureGenerator->setShareAntipodalRays(UI.checkBoxSphereShareAntipodalRays->isChecked());
+
+  // ---- Texture Layout Options ---- //
+  SphereParametrization::TYPE parametrization = SphereParametrization::EQUIRECTANGULAR;
+  if (UI.radioButtonSphereLayoutOctahedral->isChecked()) {
+    parametrization = SphereParametrization::OCTAHEDRAL;
+  }
+  else if (UI.radioButtonSphereLayoutCubeMap->isChecked()) {
+    parametrization = SphereParametrization::CUBE_MAP;
+  }
+  textureGenerator->setParametrization(parametrization);
+
+  // ---- Sampling Accumulator Options ---- //
+  if (UI.radioButtonSphereSampleAccumulatorAverage->isChecked()) {
+    textureGenerator->setSamplingAverage();
+  }
+  else if (UI.radioButtonSphereSampleAccumulatorMin->isChecked()) {
+    textureGenerator->setSamplingMinimum();
+  }
+  else if (UI.radioButtonSphereSampleAccumulatorMax->isChecked()) {
+    textureGenerator->setSamplingMaximum();
+  }
+
+  // If only the uncertainty has changed since the last full texture, just resample the texels that depend on the changes.
+  // Otherwise show the coarsest level straight away and refine it.
+  mitk::Image::Pointer texture;
+  bool refine = false;
+  if (textureGenerator->canUpdateIncrementally()) {
+    texture = textureGenerator->generateUncertaintyTextureGenerator();
+  }
+  else {
+    texture = textureGenerator->generateLevel(0, true);
+    refine = (textureGenerator->getNumberOfLevels() > 1);
+  }
+
+  // The texture holds the detail so the sphere itself can use the default resolution.
+  mitk::Surface::Pointer generatedSurface = SurfaceGenerator::generateSphere(100, 50, 20, parametrization);
+  mitk::DataNode::Pointer surfaceNode = SaveDataNode("Sphere Surface", generatedSurface, true);
+  surfaceNode->SetProperty("Surface.Texture", mitk::SmartPointerProperty::New(texture));
+  surfaceNode->SetProperty("scalar visibility", mitk::BoolProperty::New(false));
+
+  // Stop it being specular in the rendering.
+  surfaceNode->SetProperty("material.ambientCoefficient", mitk::FloatProperty::New(1.0f));
+  surfaceNode->SetProperty("material.diffuseCoefficient", mitk::FloatProperty::New(0.0f));
+  surfaceNode->SetProperty("material.specularCoefficient", mitk::FloatProperty::New(0.0f));
+
+  // Adjust legend.
+  char colourLow[3];
+  textureGenerator->getLegendMinColour(colourLow);
+  char colourHigh[3];
+  textureGenerator->getLegendMaxColour(colourHigh);
+  SetLegend(textureGenerator->getLegendMinValue(), colourLow, textureGenerator->getLegendMaxValue(), colourHigh);
+  ShowLegend();
+
+  // Refine it in the background. Each level replaces the texture as it's finished.
+  if (refine) {
+    sphereTextureNode = surfaceNode;
+    sphereTextureJobId++;
+    sphereTextureJob = new UncertaintyTextureJob(textureGenerator, 1, sphereTextureJobId);
+    connect(sphereTextureJob, SIGNAL(levelGenerated(unsigned int)), this, SLOT(UncertaintySphereTextureLevelGenerated(unsigned int)), Qt::QueuedConnection);
+    sphereTextureJob->start(QThread::LowPriority);
+  }
 
   HideAllDataNodes();
   ShowDataNode(surfaceNode);
   this->RequestRenderWindowUpdate();
 }
 
+/**
+  * Puts the latest level from the background job on the sphere.
+  */
+void Sams_View::UncertaintySphereTextureLevelGenerated(unsigned int jobId) {
+  // Ignore levels from jobs that have since been cancelled (by id, as a new job can reuse a deleted one's address).
+  if (sphereTextureJob == NULL || jobId != sphereTextureJobId || sphereTextureNode.IsNull()) {
+    return;
+  }
+
+  mitk::Image::Pointer texture = sphereTextureJob->getTexture();
+  if (texture.IsNull()) {
+    return;
+  }
+  sphereTextureNode->SetProperty("Surface.Texture", mitk::SmartPointerProperty::New(texture));
+
+  // Adjust legend.
+  char colourLow[3];
+  sphereTextureJob->getLegendMinColour(colourLow);
+  char colourHigh[3];
+  sphereTextureJob->getLegendMaxColour(colourHigh);
+  SetLegend(sphereTextureJob->getLegendMinValue(), colourLow, sphereTextureJob->getLegendMaxValue(), colourHigh);
+
+  this->RequestRenderWindowUpdate();
+}
+
+/**
+  * Stops refining the sphere texture (e.g. when the settings change). The sphere keeps the last level it got.
+  */
+void Sams_View::CancelUncertaintySphereTexture() {
+  if (sphereTextureJob == NULL) {
+    return;
+  }
+
+  // Deleting the job cancels it and waits for it to stop.
+  disconnect(sphereTextureJob, 0, this, 0);
+  delete sphereTextureJob;
+  sphereTextureJob = NULL;
+  sphereTextureNode = NULL;
+}
+
 // ----------------------------- //
 // ---- Uncertainty Surface ---- //
 // ----------------------------- //
@@ -1914,7 +2555,8 @@ void Sams_View::SurfaceMapping(
   UncertaintySurfaceMapper::COLOUR colour,
   UncertaintySurfaceMapper::REGISTRATION registration,
   bool invertNormals,
-  bool debugRegistration
+  bool debugRegistration,
+  bool shareAntipodalRays
 ) {
   if (surfaceNode.IsNull()) {
     std::cout << "Surface is null. Stopping." << std::endl;
@@ -1948,8 +2590,13 @@ void Sams_View::SurfaceMapping(
   // Cast it to an MITK surface.
   mitk::Surface::Pointer mitkSurface = dynamic_cast<mitk::Surface*>(surfaceNode->GetData());
 
-  // Map the uncertainty to it.
-  UncertaintySurfaceMapper * mapper = new UncertaintySurfaceMapper();
+  // Map the uncertainty to it. The mapper is kept so that remapping the same surface after the uncertainty
+  // changes only resamples the points that depend on the changes.
+  if (surfaceMapper == NULL) {
+    surfaceMapper = new UncertaintySurfaceMapper();
+    surfaceMapper->setIncremental(true);
+  }
+  UncertaintySurfaceMapper * mapper = surfaceMapper;
   mapper->setUncertainty(GetMitkPreprocessedUncertainty());
   mapper->setSurface(mitkSurface);
   mapper->setSamplingAccumulator(samplingAccumulator);
@@ -1959,7 +2606,10 @@ void Sams_View::SurfaceMapping(
   mapper->setRegistration(registration);
   mapper->setInvertNormals(invertNormals);
   mapper->setDebugRegistration(debugRegistration);
+  // Only used for spheres. Debug registration marks the uncertainty as it goes, so sample each point separately.
+  mapper->setShareAntipodalRays(shareAntipodalRays && !debugRegistration);
   mapper->map();
+  mappedSurface = surfaceNode;
 
   // Adjust legend.
   char colourLow[3];
@@ -1969,11 +2619,27 @@ void Sams_View::SurfaceMapping(
   SetLegend(mapper->getLegendMinValue(), colourLow, mapper->getLegendMaxValue(), colourHigh);
   ShowLegend();
 
-  delete mapper;
-  
   this->RequestRenderWindowUpdate();
 }
 
+/**
+  * Maps the uncertainty (e.g. of another timestep) onto the last surface mapped, with the same settings.
+  * The mapper only resamples the points whose rays read parts of the uncertainty that have changed.
+  */
+void Sams_View::RemapSurface() {
+  if (surfaceMapper == NULL || mappedSurface.IsNull()) {
+    return;
+  }
+  surfaceMapper->setUncertainty(GetMitkPreprocessedUncertainty());
+  surfaceMapper->map();
+
+  char colourLow[3];
+  surfaceMapper->getLegendMinColour(colourLow);
+  char colourHigh[3];
+  surfaceMapper->getLegendMaxColour(colourHigh);
+  SetLegend(surfaceMapper->getLegendMinValue(), colourLow, surfaceMapper->getLegendMaxValue(), colourHigh);
+}
+
 // ------------------------- //
 // ---- Next Scan Plane ---- //
 // ------------------------- //
@@ -1995,6 +2661,23 @@ void Sams_View::ComputeNextScanPlane() {
   calculator->setUncertainty(GetMitkPreprocessedUncertainty());
   calculator->setThreshold(UI.spinBoxNextScanPlaneSVDThreshold->value());
   calculator->setIgnoreZeros(UI.checkBoxNextScanPlaneIgnoreZeros->isChecked());
+  calculator->setStatistics(UncertaintyStatistics::forNode(preprocessedUncertainty));
+
+  // If the threshold being shown is the one SVD would use (see NextScanPlaneShowThresholded), use its (bit packed) mask
+  // rather than thresholding the uncertainty again. It's checked against the range the mask was actually made with, as
+  // the sliders may have moved on (with the threshold still to be made).
+  if (thresholdingEnabled && thresholder != NULL && !thresholdPending) {
+    UncertaintyThresholder * maskThresholder = GetThresholder();
+    itk::ImageRegion<3> maskRegion = maskThresholder->getCroppedRegion();
+    double maskMin, maskMax;
+    bool maskIgnoresZeros = UI.checkBoxNextScanPlaneIgnoreZeros->isChecked();
+    bool showingSVDThreshold = maskThresholder->getMaskRange(maskMin, maskMax) &&
+      maskMax == UI.spinBoxNextScanPlaneSVDThreshold->value() &&
+      (maskIgnoresZeros ? (maskMin > 0.0 && maskMin <= DBL_MIN) : maskMin <= NORMALIZED_MIN);
+    if (showingSVDThreshold) {
+      calculator->setMask(&maskThresholder->getBitPackedMask(), maskRegion);
+    }
+  }
   
   vtkSmartPointer<vtkPlane> plane;
   try {
@@ -28,8 +28,14 @@ PURPOSE.  See the above copyright notices for more information.
 #include <mitkImage.h>
 #include <vtkVector.h>
 #include <mitkOverlayManager.h>
+#include <QTimer>
 #include "UncertaintySurfaceMapper.h"
+#include "UncertaintyPreprocessor.h"
 #include "UncertaintyThresholder.h"
+#include "UncertaintyIsoSurfaceGenerator.h"
+#include "UncertaintyTextureJob.h"
+#include "UncertaintyThresholdJob.h"
+#include "UncertaintyTimeSeries.h"
 #include "ColourLegendOverlay.h"
 #include <mitkPointSet.h>
 #include <mitkPointSetDataInteractor.h>
@@ -49,6 +55,7 @@ class Sams_View : public QmitkAbstractView {
   
   public:
     static const std::string VIEW_ID;
+    virtual ~Sams_View();
     virtual void CreateQtPartControl(QWidget *parent);
 
     // Callback for SamsPointSet.
@@ -112,7 +119,13 @@ class Sams_View : public QmitkAbstractView {
     // Preprocessing...
     void ResetPreprocessingSettings();
     void ToggleErosionEnabled(bool checked);
+    void ReadPreprocessingSettings();
     void PreprocessNode(mitk::DataNode::Pointer node);
+    mitk::Image::Pointer PreprocessTimeStep();
+
+    // Time...
+    void TimeStepSliderMoved(int timeStep);
+    void TimeStepChanged(int timeStep);
 
     // ---- Thresholding ---- //
     void ToggleUncertaintyThresholding(bool checked);  
@@ -122,11 +135,13 @@ class Sams_View : public QmitkAbstractView {
     void LowerThresholdSliderMoved(int lower);
     void LowerThresholdChanged();
     void LowerThresholdChanged(int lower);
+    void LowerThresholdValueChanged(double lower);
 
     void SetUpperThreshold(double);
     void UpperThresholdSliderMoved(int upper);
     void UpperThresholdChanged();
     void UpperThresholdChanged(int upper);
+    void UpperThresholdValueChanged(double upper);
 
     void TopOnePercent();
     void TopFivePercent();
@@ -134,18 +149,32 @@ class Sams_View : public QmitkAbstractView {
     void TopXPercentSliderMoved(double percentage);
     void TopXPercent();
     void TopXPercent(double percentage);
+    void AutoThreshold();
 
     void DisplayThreshold();
     void RemoveThresholdedUncertainty();
     void ResetThresholds();
 
     void ThresholdUncertaintyIfAutoUpdateEnabled();
+    void ThresholdUncertaintyInBackground();
+    void StartThresholdJob();
+    void ThresholdJobFinished(unsigned int jobId);
+    void CancelThresholdJob();
+    UncertaintyThresholder * GetThresholder();
     void ThresholdUncertainty();
+    void ShowThresholdedUncertainty(mitk::Image::Pointer thresholdedImage, mitk::Image::Pointer bands);
+    void UpdateThresholdSurface(mitk::Image::Pointer thresholdedImage);
+    void UpdateThresholdComponents(mitk::Image::Pointer thresholdedImage);
+    bool GetThresholdBandCuts(std::vector<double> & cuts);
+    void UpdateThresholdBands(mitk::Image::Pointer bands);
 
     // ---- Uncertainty Sphere ---- //
     void ThetaResolutionChanged(int);
     void PhiResolutionChanged(int);
     void GenerateUncertaintySphere();
+    void GenerateUncertaintySphereTexture();
+    void UncertaintySphereTextureLevelGenerated(unsigned int jobId);
+    void CancelUncertaintySphereTexture();
 
     // ---- Uncertainty Surface ---- //
     void SurfaceMapping();
@@ -157,8 +186,10 @@ class Sams_View : public QmitkAbstractView {
       UncertaintySurfaceMapper::COLOUR colour,
       UncertaintySurfaceMapper::REGISTRATION registration,
       bool invertNormals,
-      bool debugRegistration = false
+      bool debugRegistration = false,
+      bool shareAntipodalRays = false
     );
+    void RemapSurface();
 
     // ---- Next Scan Plane ---- //
     void NextScanPlaneShowThresholded();
@@ -266,13 +297,40 @@ class Sams_View : public QmitkAbstractView {
     unsigned int uncertaintyWidth;
     unsigned int uncertaintyDepth;
 
+    // Time (the uncertainty can have a volume per timestep, only one is shown at a time)
+    UncertaintyTimeSeries * timeSeries = NULL;
+    unsigned int timeStep = 0;
+
     // Preprocessing
     static const double NORMALIZED_MAX = 1.0;
     static const double NORMALIZED_MIN = 0.0;
+    static const unsigned int PREPROCESSING_SLAB_THICKNESS = 32;
+    UncertaintyPreprocessor * preprocessor = NULL;
+    // What the uncertainty was preprocessed with (read from the UI when the selection is confirmed), so every
+    // timestep is preprocessed the same way, even if the checkboxes have been changed since.
+    struct PreprocessingSettings {
+      bool invert = false;
+      bool erode = false;
+      unsigned int erodeThickness = 2;
+      bool erodeOnlyBorder = false;
+      bool align = false;
+      bool streaming = false;
+      bool singlePrecision = false;
+    };
+    PreprocessingSettings preprocessingSettings;
 
     // Thresholding
-    UncertaintyThresholder * thresholder;
+    static const int THRESHOLD_DEBOUNCE_MS = 50;
+    UncertaintyThresholder * thresholder = NULL;
+    UncertaintyThresholdJob * thresholdJob = NULL;
+    unsigned int thresholdJobId = 0;
+    QTimer * thresholdTimer = NULL;
+    bool thresholdPending = false;
     mitk::DataNode::Pointer thresholdedUncertainty = 0;
+    UncertaintyIsoSurfaceGenerator * thresholdSurfaceGenerator = NULL;
+    mitk::DataNode::Pointer thresholdedSurface = 0;
+    mitk::DataNode::Pointer thresholdedBands = 0;
+    std::vector<double> automaticBandCuts;
     bool thresholdingEnabled = false;
     bool thresholdingAutoUpdate = true;
     double lowerThreshold = 0;
@@ -280,6 +338,14 @@ class Sams_View : public QmitkAbstractView {
 
     // Uncertainty Sphere
     double latLongRatio = 2.0;
+    UncertaintyTextureGenerator * sphereTextureGenerator = NULL;
+    UncertaintyTextureJob * sphereTextureJob = NULL;
+    unsigned int sphereTextureJobId = 0;
+    mitk::DataNode::Pointer sphereTextureNode = 0;
+
+    // Uncertainty Surface
+    UncertaintySurfaceMapper * surfaceMapper = NULL;
+    mitk::DataNode::Pointer mappedSurface = 0;
 
     // Next Scan Plane
     mitk::DataNode::Pointer scanPlane;